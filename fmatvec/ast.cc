@@ -37,17 +37,22 @@ SymbolicExpression::SymbolicExpression(long x) : shared_ptr<const AST::Vertex>(A
 SymbolicExpression::SymbolicExpression(double x) : shared_ptr<const AST::Vertex>(AST::Constant<double>::create(x)) {}
 SymbolicExpression::SymbolicExpression(ConstructSymbol) : shared_ptr<const AST::Vertex>(AST::Symbol::create()) {}
 
-template<class T>
-void erase(T &cache) {
-  for(auto it=cache.begin(), endIt=cache.end(); it!=endIt; )
-    if(it->second.expired()) it=cache.erase(it); else ++it;
+void SymbolicExpression::garbageCollect() {
+  AST::Constant<long>::cache.garbageCollect();
+  AST::Constant<double>::cache.garbageCollect();
+  AST::Symbol::cache.garbageCollect();
+  AST::NativeFunction::cache.garbageCollect();
+  AST::Operation::cache.garbageCollect();
 }
 
-void SymbolicExpression::garbageCollect() {
-  erase(AST::Constant<long>::cache);
-  erase(AST::Constant<double>::cache);
-  erase(AST::Symbol::cache);
-  erase(AST::Operation::cache);
+SymbolicExpression::CacheStatistics SymbolicExpression::getCacheStatistics() {
+  CacheStatistics stat;
+  AST::Constant<long>::cache.addStatistics(stat);
+  AST::Constant<double>::cache.addStatistics(stat);
+  AST::Symbol::cache.addStatistics(stat);
+  AST::NativeFunction::cache.addStatistics(stat);
+  AST::Operation::cache.addStatistics(stat);
+  return stat;
 }
 
 SymbolicExpression SymbolicExpression::operator+(const SymbolicExpression &b) const {
@@ -300,6 +305,41 @@ SymbolicExpression parDer(const SymbolicExpression &dep, const IndependentVariab
   return dep->parDer(indep);
 }
 
+vector<SymbolicExpression> parDer(const vector<SymbolicExpression> &dep, const vector<IndependentVariable> &indep) {
+  unordered_map<const AST::Vertex*, size_t> index;
+  auto order=AST::Operation::getTopologicalOrder(dep, index);
+  SymbolicExpression zero(0);
+  SymbolicExpression one(1);
+  vector<SymbolicExpression> ret(dep.size()*indep.size());
+  vector<SymbolicExpression> der(order.size()); // the derivative of each vertex in order
+  vector<SymbolicExpression> childDer;
+  for(size_t i=0; i<indep.size(); ++i) {
+    auto &x=indep[i];
+    for(size_t v=0; v<order.size(); ++v) {
+      auto *vertex=order[v].get();
+      if(auto o=dynamic_cast<const AST::Operation*>(vertex)) {
+        // the derivative of a operation is linear in the derivatives of its childs: zero if all these are zero
+        childDer.clear();
+        bool allZero=true;
+        for(auto &c : o->child) {
+          childDer.emplace_back(der[index[c.get()]]);
+          allZero = allZero && childDer.back()->isZero();
+        }
+        der[v] = allZero ? zero : o->parDer(childDer);
+      }
+      else if(dynamic_cast<const AST::Symbol*>(vertex))
+        der[v] = vertex==x.get() ? one : zero;
+      else if(dynamic_cast<const AST::NativeFunction*>(vertex))
+        der[v] = vertex->parDer(x); // a NativeFunction differentiates its arguments itself
+      else
+        der[v] = zero; // a constant
+    }
+    for(size_t d=0; d<dep.size(); ++d)
+      ret[d*indep.size()+i]=der[index[dep[d].get()]];
+  }
+  return ret;
+}
+
 #ifdef _MSC_VER
 #ifndef SWIG
 const SymbolicExpression::ConstructSymbol SymbolicExpression::constructSymbol{}; // just used for tag dispatching
@@ -316,20 +356,83 @@ IndependentVariable::IndependentVariable(const shared_ptr<const AST::Symbol> &x)
 
 namespace AST { // internal namespace
 
+namespace {
+  // pow with a integer exponent as a chain of multiplications (binary exponentiation) for small exponents.
+  // The JIT emits the same algorithm (see JITProgram::generateSource) to get bit-identical results.
+  double powInt(double x, int n) {
+    if(n>OpCodeProgram::maxPowIntChain || n<-OpCodeProgram::maxPowIntChain)
+      return std::pow(x, n);
+    unsigned int m=n<0 ? -n : n;
+    double r=1;
+    while(true) {
+      if(m&1)
+        r*=x;
+      m>>=1;
+      if(m==0)
+        break;
+      x*=x;
+    }
+    return n<0 ? 1/r : r;
+  }
+
+  // sin and cos of the same argument at once (the results are equal to std::sin and std::cos)
+  void sinCos(double x, double &s, double &c) {
+#ifdef __GLIBC__
+    ::sincos(x, &s, &c);
+#else
+    s=std::sin(x);
+    c=std::cos(x);
+#endif
+  }
+
+  // pow(x, 0.5) evaluated using sqrt: sqrt(x) differs from pow(x, 0.5) only for the arguments -0 (sqrt is -0, pow +0)
+  // and -inf (sqrt is nan, pow +inf). The JIT emits the same expression (see JITProgram::generateSource).
+  double powHalf(double x) {
+    return x==-numeric_limits<double>::infinity() ? numeric_limits<double>::infinity() : std::sqrt(x)+0.0;
+  }
+
+  // return true if e is the constant 0.5: pow(x, 0.5) is evaluated by powHalf
+  bool isConstantHalf(const SymbolicExpression &e) {
+    auto c=dynamic_pointer_cast<const Constant<double>>(e);
+    return c && c->getValue()==0.5;
+  }
+}
+
 SymbolicExpression substScalar(const SymbolicExpression &se, const IndependentVariable& a, const SymbolicExpression &b) {
-  // if se is the indep a to be replaced -> return b
-  if(se==a)
-    return b;
-  // if se is a constant -> return se
-  auto o=dynamic_cast<const AST::Operation*>(se.get());
-  if(!o)
-    return se;
-  // if se is a Operation -> copy the operation and call subst on its childs
+  return substScalar(vector<SymbolicExpression>{se}, vector<IndependentVariable>{a}, vector<SymbolicExpression>{b})[0];
+}
+
+vector<SymbolicExpression> substScalar(const vector<SymbolicExpression> &se, const vector<IndependentVariable> &a,
+                                       const vector<SymbolicExpression> &b) {
+  if(a.size()!=b.size())
+    throw runtime_error("The size of the independent and the dependent substitution variable does not match.");
+  unordered_map<const Vertex*, size_t> index;
+  auto order=Operation::getTopologicalOrder(se, index);
+  // the substituted expression of each vertex in order
+  vector<SymbolicExpression> subst(order);
+  for(size_t i=0; i<a.size(); ++i)
+    if(auto it=index.find(a[i].get()); it!=index.end())
+      subst[it->second]=b[i];
   vector<SymbolicExpression> child;
-  transform(o->child.begin(), o->child.end(), back_inserter(child), [&a, &b](const SymbolicExpression &x){
-    return substScalar(x, a, b);
-  });
-  return AST::Operation::create(o->op, child);
+  for(size_t v=0; v<order.size(); ++v) {
+    // a operation is only created again if any of its childs has changed (a constant or symbol is kept)
+    auto o=dynamic_cast<const Operation*>(order[v].get());
+    if(!o)
+      continue;
+    child.clear();
+    bool changed=false;
+    for(auto &c : o->child) {
+      child.emplace_back(subst[index[c.get()]]);
+      changed = changed || child.back().get()!=c.get();
+    }
+    if(changed)
+      subst[v]=Operation::create(o->op, child);
+  }
+  vector<SymbolicExpression> ret;
+  ret.reserve(se.size());
+  for(auto &e : se)
+    ret.emplace_back(subst[index[e.get()]]);
+  return ret;
 }
 
 // ***** ByteCode *****
@@ -343,6 +446,273 @@ ByteCode::ByteCode(ByteCode &&) noexcept {
   assert(0 && "ByteCode cannot be moved or copied. But the move-ctor is defined to allow in-place construction e.g. using emplace_back.");
 }
 
+// ***** ByteCodeSlice *****
+
+ByteCodeSlice::ByteCodeSlice(const vector<ByteCode> &byteCode, const vector<size_t> &entry) {
+  // the entry writing each address and the innermost jump skipping each entry
+  unordered_map<const double*, size_t> producer;
+  vector<size_t> jumpOf(byteCode.size(), numeric_limits<size_t>::max());
+  vector<size_t> openJump; // the jumps with a region containing the current entry
+  for(size_t i=0; i<byteCode.size(); ++i) {
+    while(!openJump.empty() && i>openJump.back()+byteCode[openJump.back()].jump)
+      openJump.pop_back();
+    if(!openJump.empty())
+      jumpOf[i]=openJump.back();
+    producer[byteCode[i].retPtr]=i;
+    if(byteCode[i].jump)
+      openJump.emplace_back(i);
+  }
+
+  // the backward slice: the producers of all arguments and the jumps skipping a needed entry
+  vector<bool> needed(byteCode.size(), false);
+  vector<size_t> work;
+  auto need=[&needed, &work](size_t i) {
+    if(!needed[i]) {
+      needed[i]=true;
+      work.emplace_back(i);
+    }
+  };
+  for(auto i : entry)
+    need(i);
+  while(!work.empty()) {
+    auto i=work.back();
+    work.pop_back();
+    for(auto *a : byteCode[i].argsPtr)
+      if(auto it=producer.find(a); it!=producer.end() && it->second<i)
+        need(it->second);
+    if(jumpOf[i]!=numeric_limits<size_t>::max())
+      need(jumpOf[i]);
+  }
+
+  // the jump distance in the slice is the number of needed entries in the region of the jump
+  vector<size_t> nrNeededBefore(byteCode.size()+1, 0);
+  for(size_t i=0; i<byteCode.size(); ++i)
+    nrNeededBefore[i+1]=nrNeededBefore[i]+(needed[i] ? 1 : 0);
+  for(size_t i=0; i<byteCode.size(); ++i)
+    if(needed[i]) {
+      auto jump=byteCode[i].jump ? nrNeededBefore[i+1+byteCode[i].jump]-nrNeededBefore[i+1] : 0;
+      slice.emplace_back(&byteCode[i], jump);
+    }
+}
+
+void ByteCodeSlice::operator()() const {
+  for(size_t i=0; i<slice.size(); ++i) {
+    auto &[bc, jump]=slice[i];
+    bc->func(bc->retPtr, bc->argsPtr);
+    if(jump && bc->retValue!=0)
+      i+=jump;
+  }
+}
+
+// ***** ByteCodeBuilder *****
+
+// a open-addressing hash table (linear probing) from vertices to its position in ByteCodeBuilder::order
+class ByteCodeBuilder::VertexIndex {
+  public:
+    static constexpr size_t npos { numeric_limits<size_t>::max() };
+    VertexIndex() : key(64, nullptr), value(64, npos) {}
+    // insert v with the value npos if not existing: return its slot and true if inserted
+    pair<size_t, bool> insert(const Vertex *v) {
+      if(2*(size+1)>key.size())
+        rehash(2*key.size());
+      size_t slot=probe(v);
+      if(key[slot])
+        return { slot, false };
+      key[slot]=v;
+      ++size;
+      return { slot, true };
+    }
+    // return the value of v (npos if not existing)
+    size_t find(const Vertex *v) const {
+      return value[probe(v)];
+    }
+    size_t& operator[](size_t slot) { return value[slot]; }
+  private:
+    size_t probe(const Vertex *v) const {
+      size_t mask=key.size()-1;
+      // the low bits of a pointer are zero due to alignment: mix all bits
+      size_t slot=(reinterpret_cast<uintptr_t>(v)*0x9E3779B97F4A7C15ull>>16) & mask;
+      while(key[slot] && key[slot]!=v)
+        slot=(slot+1) & mask;
+      return slot;
+    }
+    void rehash(size_t n) {
+      vector<const Vertex*> oldKey(n, nullptr);
+      vector<size_t> oldValue(n, npos);
+      swap(key, oldKey);
+      swap(value, oldValue);
+      for(size_t i=0; i<oldKey.size(); ++i)
+        if(oldKey[i]) {
+          size_t slot=probe(oldKey[i]);
+          key[slot]=oldKey[i];
+          value[slot]=oldValue[i];
+        }
+    }
+    vector<const Vertex*> key; // nullptr for a empty slot (the size is a power of 2)
+    vector<size_t> value;
+    size_t size { 0 };
+};
+
+ByteCodeBuilder::ByteCodeBuilder(const vector<SymbolicExpression> &output, bool lazyConditions) :
+  index(make_unique<VertexIndex>()) {
+  // a iterative depth first walk: a vertex is added to order after all its childs
+  vector<pair<const Vertex*, size_t>> stack; // a vertex and the index of its next child to visit
+  for(auto &o : output) {
+    outputVertex.emplace_back(o.get());
+    if(!index->insert(o.get()).second)
+      continue;
+    stack.emplace_back(o.get(), 0);
+    while(!stack.empty()) {
+      auto [v, next]=stack.back();
+      switch(v->getKind()) {
+        case Vertex::Kind::NativeFunction:
+          supported=false;
+          return;
+        case Vertex::Kind::Operation: {
+          auto op=static_cast<const Operation*>(v);
+          if(lazyConditions && op->op==Operation::Condition) {
+            supported=false;
+            return;
+          }
+          if(next<op->child.size()) {
+            ++stack.back().second;
+            // a vertex on the stack cannot be reached again (a DAG has no cycles): all inserted vertices except these
+            // are already in order
+            if(auto *c=op->child[next].get(); index->insert(c).second)
+              stack.emplace_back(c, 0);
+            continue;
+          }
+          break;
+        }
+        default:
+          break;
+      }
+      (*index)[index->insert(v).first]=order.size();
+      order.emplace_back(v);
+      stack.pop_back();
+    }
+  }
+}
+
+ByteCodeBuilder::~ByteCodeBuilder() = default;
+
+vector<size_t> ByteCodeBuilder::emit(vector<ByteCode> &byteCode) {
+  auto begin=byteCode.size();
+  vector<vector<ByteCode>::iterator> entry(order.size(), byteCode.end());
+  // first copy all symbols: this is a "slow" operation since the symbols may be far away
+  for(size_t i=0; i<order.size(); ++i)
+    if(order[i]->getKind()==Vertex::Kind::Symbol) {
+      auto s=static_cast<const Symbol*>(order[i]);
+      entry[i]=s->emitByteCode(byteCode);
+      symbol.emplace_back(s->shared_from_this(), entry[i]-byteCode.begin());
+    }
+  // now all other vertices: the childs of each vertex are already emitted
+  array<vector<ByteCode>::iterator, 3> childIt;
+  for(size_t i=0; i<order.size(); ++i) {
+    auto *v=order[i];
+    switch(v->getKind()) {
+      case Vertex::Kind::ConstantLong:
+        entry[i]=static_cast<const Constant<long>*>(v)->emitByteCode(byteCode);
+        break;
+      case Vertex::Kind::ConstantDouble:
+        entry[i]=static_cast<const Constant<double>*>(v)->emitByteCode(byteCode);
+        break;
+      case Vertex::Kind::Operation: {
+        auto op=static_cast<const Operation*>(v);
+        for(size_t c=0; c<op->child.size(); ++c)
+          childIt[c]=entry[index->find(op->child[c].get())];
+        // the sin or cos of the same argument (only if already emitted)
+        const vector<ByteCode>::iterator *other=nullptr;
+        if(auto partner=op->getSinCosPartner(); partner.get())
+          if(auto j=index->find(partner.get()); j<i)
+            other=&entry[j];
+        entry[i]=op->emitByteCode(byteCode, childIt.data(), other);
+        break;
+      }
+      default:
+        break; // symbols are already emitted; NativeFunction's are not supported
+    }
+  }
+  assert(byteCode.size()-begin==order.size());
+  vector<size_t> ret;
+  ret.reserve(outputVertex.size());
+  for(auto *o : outputVertex)
+    ret.emplace_back(entry[index->find(o)]-byteCode.begin());
+  return ret;
+}
+
+// ***** ByteCodeBranches *****
+
+const Vertex* ByteCodeBranches::getChild(const Vertex *v, size_t i) {
+  if(v->getKind()==Vertex::Kind::Operation) {
+    auto &c=static_cast<const Operation*>(v)->getChilds();
+    return i<c.size() ? c[i].get() : nullptr;
+  }
+  if(v->getKind()==Vertex::Kind::NativeFunction) {
+    auto nf=static_cast<const NativeFunction*>(v);
+    for(auto *A : {&nf->argS, &nf->dir1S, &nf->dir2S}) {
+      if(i<A->size())
+        return (*A)[i].get();
+      i-=A->size();
+    }
+  }
+  return nullptr;
+}
+
+void ByteCodeBranches::addOutput(const SymbolicExpression &expr) {
+  // count each use: the childs of a vertex are only visited on its first use (using a explicit stack)
+  vector<const Vertex*> stack { expr.get() };
+  while(!stack.empty()) {
+    auto *v=stack.back();
+    stack.pop_back();
+    if(uses[v]++==0)
+      for(size_t i=0; auto *c=getChild(v, i); ++i)
+        stack.emplace_back(c);
+  }
+}
+
+void ByteCodeBranches::getBranchVertices(const SymbolicExpression &branch, unordered_set<const Vertex*> &exclusive,
+                                         vector<const Vertex*> &shared) const {
+  // all vertices of branch in topological order (each vertex before its childs; using a explicit stack)
+  vector<const Vertex*> order;
+  unordered_set<const Vertex*> visited { branch.get() };
+  vector<pair<const Vertex*, size_t>> stack { { branch.get(), 0 } }; // a vertex and the index of its next child
+  while(!stack.empty()) {
+    auto [v, next]=stack.back();
+    if(auto *c=getChild(v, next)) {
+      ++stack.back().second;
+      if(visited.insert(c).second)
+        stack.emplace_back(c, 0);
+      continue;
+    }
+    order.emplace_back(v);
+    stack.pop_back();
+  }
+  reverse(order.begin(), order.end());
+
+  // a vertex is exclusive if all its uses are from exclusive vertices (branch is used once by the Condition)
+  unordered_map<const Vertex*, size_t> usesFromBranch;
+  usesFromBranch[branch.get()]=1;
+  unordered_set<const Vertex*> sharedSet;
+  for(auto *v : order) {
+    auto it=uses.find(v);
+    if(it==uses.end() || usesFromBranch[v]!=it->second)
+      continue;
+    exclusive.insert(v);
+    for(size_t i=0; auto *c=getChild(v, i); ++i)
+      usesFromBranch[c]++;
+  }
+  for(auto *v : order)
+    if(exclusive.count(v))
+      for(size_t i=0; auto *c=getChild(v, i); ++i)
+        if(!exclusive.count(c) && sharedSet.insert(c).second)
+          shared.emplace_back(c);
+}
+
+bool ByteCodeBranches::isInRegion(size_t i) const {
+  return any_of(region.begin(), region.end(), [i](const pair<size_t, size_t> &r) { return r.first<=i && i<r.second; });
+}
+
 // ***** Vertex *****
 
 bool Vertex::isZero() const {
@@ -359,19 +729,11 @@ bool Vertex::isOne() const {
 
 // ***** Constant *****
 
-template<class T> map<typename Constant<T>::CacheKey, weak_ptr<const Constant<T>>> Constant<T>::cache;
+template<class T> InternTable<typename Constant<T>::CacheKey, Constant<T>> Constant<T>::cache;
 
 template<class T>
 SymbolicExpression Constant<T>::create(const T&c_) {
-  auto r=cache.insert(make_pair(c_, weak_ptr<const Constant<T>>()));
-  if(!r.second) {
-    auto oldPtr=r.first->second.lock();
-    if(oldPtr)
-      return oldPtr;
-  }
-  auto newPtr=shared_ptr<Constant<T>>(new Constant<T>(c_));
-  r.first->second=newPtr;
-  return newPtr;
+  return cache.getOrCreate(c_, [&c_]() { return shared_ptr<Constant<T>>(new Constant<T>(c_)); });
 }
 
 template<class T>
@@ -386,19 +748,25 @@ SymbolicExpression Constant<T>::parDer(const IndependentVariable &x) const {
 }
 
 template<class T>
-Constant<T>::Constant(const T& c_) : c(c_) {}
+Constant<T>::Constant(const T& c_) : Vertex(is_same_v<T, long> ? Kind::ConstantLong : Kind::ConstantDouble), c(c_) {}
 
 template<class T>
-std::vector<ByteCode>::iterator Constant<T>::dumpByteCode(vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex) const {
+std::vector<ByteCode>::iterator Constant<T>::dumpByteCode(vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex,
+                                                              ByteCodeBranches *branches) const {
   auto [lastIt, inserted] = existingVertex.insert(make_pair(this, vector<ByteCode>::iterator()));
   if(!inserted) return lastIt->second;
 
+  lastIt->second = emitByteCode(byteCode);
+  return lastIt->second;
+}
+
+template<class T>
+std::vector<ByteCode>::iterator Constant<T>::emitByteCode(vector<ByteCode> &byteCode) const {
   byteCode.emplace_back(0);
   auto it = --byteCode.end();
-  lastIt->second = it;
   it->func = [](double* r, const ByteCode::Arg& a) {};
   it->retValue = c;
-  return --byteCode.end();
+  return it;
 }
 
 template<class T>
@@ -406,31 +774,37 @@ void Constant<T>::walkVertex(const function<void(const shared_ptr<const Vertex>&
   func(this->shared_from_this());
 }
 
+template<class T>
+OpCode::Index Constant<T>::dumpOpCode(OpCodeProgram &prog, map<const Vertex*, OpCode::Index> &existingVertex) const {
+  auto [lastIt, inserted] = existingVertex.insert(make_pair(this, 0));
+  if(!inserted) return lastIt->second;
+
+  lastIt->second = prog.newSlot();
+  prog.constant.emplace_back(lastIt->second, c);
+  return lastIt->second;
+}
+
 template SymbolicExpression Constant<long   >::create(const long   &c_);
 template SymbolicExpression Constant<double>::create(const double&c_);
 template bool Constant<long   >::equal(const SymbolicExpression &b, MapIVSE &m) const;
 template bool Constant<double>::equal(const SymbolicExpression &b, MapIVSE &m) const;
 template SymbolicExpression Constant<long   >::parDer(const IndependentVariable &x) const;
 template SymbolicExpression Constant<double>::parDer(const IndependentVariable &x) const;
-template std::vector<ByteCode>::iterator Constant<long   >::dumpByteCode(vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex) const;
-template std::vector<ByteCode>::iterator Constant<double>::dumpByteCode(vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex) const;
+template std::vector<ByteCode>::iterator Constant<long   >::dumpByteCode(vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex, ByteCodeBranches *branches) const;
+template std::vector<ByteCode>::iterator Constant<double>::dumpByteCode(vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex, ByteCodeBranches *branches) const;
+template std::vector<ByteCode>::iterator Constant<long   >::emitByteCode(vector<ByteCode> &byteCode) const;
+template std::vector<ByteCode>::iterator Constant<double>::emitByteCode(vector<ByteCode> &byteCode) const;
 template void Constant<long   >::walkVertex(const function<void(const shared_ptr<const Vertex>&)> &func) const;
 template void Constant<double>::walkVertex(const function<void(const shared_ptr<const Vertex>&)> &func) const;
+template OpCode::Index Constant<long   >::dumpOpCode(OpCodeProgram &prog, map<const Vertex*, OpCode::Index> &existingVertex) const;
+template OpCode::Index Constant<double>::dumpOpCode(OpCodeProgram &prog, map<const Vertex*, OpCode::Index> &existingVertex) const;
 
 // ***** Symbol *****
 
-map<Symbol::CacheKey, weak_ptr<const Symbol>> Symbol::cache;
+InternTable<Symbol::CacheKey, Symbol, boost::hash<Symbol::CacheKey>> Symbol::cache;
 
 IndependentVariable Symbol::create(const boost::uuids::uuid& uuid_) {
-  auto r=cache.insert(make_pair(uuid_, weak_ptr<const Symbol>()));
-  if(!r.second) {
-    auto oldPtr=r.first->second.lock();
-    if(oldPtr)
-      return oldPtr;
-  }
-  auto newPtr=shared_ptr<const Symbol>(new Symbol(uuid_));
-  r.first->second=newPtr;
-  return newPtr;
+  return cache.getOrCreate(uuid_, [&uuid_]() { return shared_ptr<const Symbol>(new Symbol(uuid_)); });
 }
 
 bool Symbol::equal(const SymbolicExpression &b, MapIVSE &m) const {
@@ -450,7 +824,7 @@ SymbolicExpression Symbol::parDer(const IndependentVariable &x) const {
   return this == x.get() ? Constant<long>::create(1) : Constant<long>::create(0);
 }
 
-Symbol::Symbol(const boost::uuids::uuid& uuid_) : uuid(uuid_) {}
+Symbol::Symbol(const boost::uuids::uuid& uuid_) : Vertex(Kind::Symbol), uuid(uuid_) {}
 
 string Symbol::getUUIDStr() const {
 #ifndef NDEBUG // FMATVEC_DEBUG_SYMBOLICEXPRESSION_UUID
@@ -465,77 +839,66 @@ string Symbol::getUUIDStr() const {
 }
 
 std::vector<ByteCode>::iterator Symbol::dumpByteCode(vector<ByteCode> &byteCode,
-                                                  map<const Vertex*, vector<ByteCode>::iterator> &existingVertex) const {
+                                                  map<const Vertex*, vector<ByteCode>::iterator> &existingVertex,
+                                                  ByteCodeBranches *branches) const {
   auto [lastIt, inserted] = existingVertex.insert(make_pair(this, vector<ByteCode>::iterator()));
   if(!inserted) return lastIt->second;
 
+  lastIt->second = emitByteCode(byteCode);
+  return lastIt->second;
+}
+
+std::vector<ByteCode>::iterator Symbol::emitByteCode(vector<ByteCode> &byteCode) const {
   byteCode.emplace_back(0);
   auto it = --byteCode.end();
-  lastIt->second = it;
   double *xPtr = &x;
   it->func = [xPtr](double* r, const ByteCode::Arg& a) { *r = *xPtr; };
-  return --byteCode.end();
+  return it;
 }
 
 void Symbol::walkVertex(const function<void(const shared_ptr<const Vertex>&)> &func) const {
   func(shared_from_this());
 }
 
-// ***** NativeFunction *****
+OpCode::Index Symbol::dumpOpCode(OpCodeProgram &prog, map<const Vertex*, OpCode::Index> &existingVertex) const {
+  auto [lastIt, inserted] = existingVertex.insert(make_pair(this, 0));
+  if(!inserted) return lastIt->second;
 
-map<NativeFunction::CacheKey, weak_ptr<const NativeFunction>, NativeFunction::CacheKeyComp> NativeFunction::cache;
+  lastIt->second = prog.newSlot();
+  prog.symbol.emplace_back(shared_from_this(), lastIt->second);
+  return lastIt->second;
+}
 
-bool NativeFunction::CacheKeyComp::operator()(const CacheKey& l, const CacheKey& r) const {
-  if(olf(get<0>(l), get<0>(r)) || olf(get<0>(r), get<0>(l)))
-    return olf(get<0>(l), get<0>(r));
+// ***** NativeFunction *****
 
-#define FMATVEC_HELPER(ARG) \
-  if(get<ARG>(l).size() != get<ARG>(r).size()) \
-    return get<ARG>(l).size()<get<ARG>(r).size(); \
-  for(size_t i=0; i<get<ARG>(l).size(); ++i) \
-    if(ol(get<ARG>(l)[i],get<ARG>(r)[i]) || ol(get<ARG>(r)[i],get<ARG>(l)[i])) \
-      return ol(get<ARG>(l)[i], get<ARG>(r)[i]);
-  FMATVEC_HELPER(1)
-  FMATVEC_HELPER(2)
-  FMATVEC_HELPER(3)
+InternTable<NativeFunction::CacheKey, NativeFunction, NativeFunction::CacheKeyHash> NativeFunction::cache;
 
-  return false;
+size_t NativeFunction::CacheKeyHash::operator()(const CacheKey& k) const {
+  size_t h=0;
+  boost::hash_combine(h, get<0>(k));
+  // the size is hashed by hash_range implicitly: hash each vector separately to distinguish the argument groups
+  boost::hash_combine(h, boost::hash_range(get<1>(k).begin(), get<1>(k).end()));
+  boost::hash_combine(h, boost::hash_range(get<2>(k).begin(), get<2>(k).end()));
+  boost::hash_combine(h, boost::hash_range(get<3>(k).begin(), get<3>(k).end()));
+  return h;
 }
 
 NativeFunction::NativeFunction(const shared_ptr<ScalarFunctionWrapArg> &funcWrapper_, const vector<SymbolicExpression> &argS_,
                                const vector<SymbolicExpression> &dir1S_, const vector<SymbolicExpression> &dir2S_) :
-  funcWrapper(funcWrapper_), argS(argS_), dir1S(dir1S_), dir2S(dir2S_) {}
+  Vertex(Kind::NativeFunction), funcWrapper(funcWrapper_), argS(argS_), dir1S(dir1S_), dir2S(dir2S_) {}
 
 SymbolicExpression NativeFunction::create(const shared_ptr<ScalarFunctionWrapArg> &funcWrapper, const vector<SymbolicExpression> &argS,
                                           const vector<SymbolicExpression> &dir1S, const vector<SymbolicExpression> &dir2S) {
-  vector<weak_ptr<const Vertex>> weakArgS;
-  // we cannot just use std::copy here since std::shared_ptr is a private base of SymbolicExpression
-  transform(argS.begin(), argS.end(), back_inserter(weakArgS), [](const SymbolicExpression &x){
-    return weak_ptr<const Vertex>(x);
-  });
-
-  vector<weak_ptr<const Vertex>> weakDir1S;
   // we cannot just use std::copy here since std::shared_ptr is a private base of SymbolicExpression
-  transform(dir1S.begin(), dir1S.end(), back_inserter(weakDir1S), [](const SymbolicExpression &x){
-    return weak_ptr<const Vertex>(x);
-  });
-
-  vector<weak_ptr<const Vertex>> weakDir2S;
-  // we cannot just use std::copy here since std::shared_ptr is a private base of SymbolicExpression
-  transform(dir2S.begin(), dir2S.end(), back_inserter(weakDir2S), [](const SymbolicExpression &x){
-    return weak_ptr<const Vertex>(x);
+  auto rawPtr=[](const vector<SymbolicExpression> &x) {
+    vector<const Vertex*> ret;
+    ret.reserve(x.size());
+    transform(x.begin(), x.end(), back_inserter(ret), [](const SymbolicExpression &x){ return x.get(); });
+    return ret;
+  };
+  return cache.getOrCreate(make_tuple(funcWrapper.get(), rawPtr(argS), rawPtr(dir1S), rawPtr(dir2S)), [&]() {
+    return shared_ptr<NativeFunction>(new NativeFunction(funcWrapper, argS, dir1S, dir2S));
   });
-
-  auto r=cache.insert(make_pair(make_tuple(weak_ptr<ScalarFunctionWrapArg>(funcWrapper),
-                      weakArgS, weakDir1S, weakDir2S), weak_ptr<const NativeFunction>()));
-  if(!r.second) {
-    auto oldPtr=r.first->second.lock();
-    if(oldPtr)
-      return oldPtr;
-  }
-  auto newPtr=shared_ptr<NativeFunction>(new NativeFunction(funcWrapper, argS, dir1S, dir2S));
-  r.first->second=newPtr;
-  return newPtr;
 }
 
 SymbolicExpression NativeFunction::parDer(const IndependentVariable &x) const {
@@ -609,7 +972,8 @@ bool NativeFunction::equal(const SymbolicExpression &b, MapIVSE &m) const {
 }
 
 std::vector<ByteCode>::iterator NativeFunction::dumpByteCode(std::vector<ByteCode> &byteCode,
-                                             std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex) const {
+                                             std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex,
+                                             ByteCodeBranches *branches) const {
 
   auto [lastIt, inserted] = existingVertex.insert(make_pair(this, vector<ByteCode>::iterator()));
   if(!inserted) return lastIt->second;
@@ -617,7 +981,7 @@ std::vector<ByteCode>::iterator NativeFunction::dumpByteCode(std::vector<ByteCod
   std::vector<vector<ByteCode>::iterator> allargSItVec;
   for(auto &A : {argS, dir1S, dir2S})
     for(auto &a : A) {
-      auto it = a->dumpByteCode(byteCode, existingVertex);
+      auto it = a->dumpByteCode(byteCode, existingVertex, branches);
       allargSItVec.push_back(it);
     }
 
@@ -652,9 +1016,78 @@ void NativeFunction::walkVertex(const std::function<void(const std::shared_ptr<c
   func(shared_from_this());
 }
 
+OpCode::Index NativeFunction::dumpOpCode(OpCodeProgram &prog, map<const Vertex*, OpCode::Index> &existingVertex) const {
+  auto [lastIt, inserted] = existingVertex.insert(make_pair(this, 0));
+  if(!inserted) return lastIt->second;
+
+  OpCodeProgram::NativeCall call;
+  call.func = funcWrapper;
+  call.order = dir1S.empty() ? 0 : (dir2S.empty() ? 1 : 2);
+  for(auto &A : {argS, dir1S, dir2S})
+    for(auto &a : A)
+      call.arg.emplace_back(a->dumpOpCode(prog, existingVertex));
+  prog.native.emplace_back(std::move(call));
+
+  lastIt->second = prog.newSlot();
+  prog.code.push_back({OpCodeProgram::Native, lastIt->second, {static_cast<OpCode::Index>(prog.native.size()-1), 0, 0}});
+  return lastIt->second;
+}
+
+// The kernels of all operations. _a, _b and _c must be defined by the user of this macro to access the arguments
+// (the same expressions as in Operation::opMap are used to get bit-identical results for all evaluators).
+#define FMATVEC_OPCODE_KERNELS(KERNEL) \
+  KERNEL(Operation::Plus     , _a + _b                           ) \
+  KERNEL(Operation::Minus    , _a - _b                           ) \
+  KERNEL(Operation::Mult     , _a * _b                           ) \
+  KERNEL(Operation::Div      , _a / _b                           ) \
+  KERNEL(Operation::Pow      , std::pow(_a, _b)                  ) \
+  KERNEL(Operation::Log      , std::log(_a)                      ) \
+  KERNEL(Operation::Sqrt     , std::sqrt(_a)                     ) \
+  KERNEL(Operation::Neg      , - _a                              ) \
+  KERNEL(Operation::Sin      , std::sin(_a)                      ) \
+  KERNEL(Operation::Cos      , std::cos(_a)                      ) \
+  KERNEL(Operation::Tan      , std::tan(_a)                      ) \
+  KERNEL(Operation::Sinh     , std::sinh(_a)                     ) \
+  KERNEL(Operation::Cosh     , std::cosh(_a)                     ) \
+  KERNEL(Operation::Tanh     , std::tanh(_a)                     ) \
+  KERNEL(Operation::ASin     , std::asin(_a)                     ) \
+  KERNEL(Operation::ACos     , std::acos(_a)                     ) \
+  KERNEL(Operation::ATan     , std::atan(_a)                     ) \
+  KERNEL(Operation::ATan2    , std::atan2(_a, _b)                ) \
+  KERNEL(Operation::ASinh    , std::asinh(_a)                    ) \
+  KERNEL(Operation::ACosh    , std::acosh(_a)                    ) \
+  KERNEL(Operation::ATanh    , std::atanh(_a)                    ) \
+  KERNEL(Operation::Exp      , std::exp(_a)                      ) \
+  KERNEL(Operation::Sign     , boost::math::sign(_a)             ) \
+  KERNEL(Operation::Heaviside, 0.5 * boost::math::sign(_a) + 0.5 ) \
+  KERNEL(Operation::Abs      , std::abs(_a)                      ) \
+  KERNEL(Operation::Min      , std::min(_a, _b)                  ) \
+  KERNEL(Operation::Max      , std::max(_a, _b)                  ) \
+  KERNEL(Operation::Condition, _a > 0 ? _b : _c                  ) \
+  KERNEL(OpCodeProgram::PowInt, powInt(_a, static_cast<int>(_b))      ) \
+  KERNEL(OpCodeProgram::PowHalf, powHalf(_a)                         )
+
+namespace {
+  // the value of the operation op with the constant arguments a (used to fold constants; no heap allocation)
+  double foldConstant(int op, const double *a) {
+#define _a a[0]
+#define _b a[1]
+#define _c a[2]
+#define FMATVEC_KERNEL(CODE, EXPR) case CODE: return EXPR;
+    switch(op) {
+      FMATVEC_OPCODE_KERNELS(FMATVEC_KERNEL)
+    }
+#undef FMATVEC_KERNEL
+#undef _a
+#undef _b
+#undef _c
+    throw runtime_error("Internal error: unknown operator in foldConstant.");
+  }
+}
+
 // ***** Operation *****
 
-map<Operation::CacheKey, weak_ptr<const Operation>, Operation::CacheKeyComp> Operation::cache;
+InternTable<Operation::CacheKey, Operation, Operation::CacheKeyHash> Operation::cache;
 
 //MISSING: optimized calls for int arguments
 #define FUNC(expr) [](double* r, const ByteCode::Arg& arg) { \
@@ -699,115 +1132,195 @@ const std::map<Operation::Operator, Operation::OpMap> Operation::opMap {
 #undef _b
 #undef _c
                                                            
+size_t Operation::getNrChilds(Operator op_) {
+  static constexpr array<uint8_t, Condition+1> nrChilds {
+    2, 2, 2, 2, 2, // Plus, Minus, Mult, Div, Pow
+    1, 1, 1, // Log, Sqrt, Neg
+    1, 1, 1, 1, 1, 1, // Sin, Cos, Tan, Sinh, Cosh, Tanh
+    1, 1, 1, 2, // ASin, ACos, ATan, ATan2
+    1, 1, 1, // ASinh, ACosh, ATanh
+    1, 1, 1, 1, // Exp, Sign, Heaviside, Abs
+    2, 2, 3, // Min, Max, Condition
+  };
+  return nrChilds[op_];
+}
+
 SymbolicExpression Operation::create(Operator op_, const vector<SymbolicExpression> &child_) {
-  static bool optimizeExpressions=true; // this is "always" true (except for the initial call, see below)
-  static bool firstCall=true;                              
-  static vector<pair<SymbolicExpression,SymbolicExpression>> optExpr; // list of expression optimizations
-  if(firstCall) { // on the first call build the list of expression optimizations
-    firstCall=false;                                       
-    IndependentVariable a;                                 
-    IndependentVariable b;
-    SymbolicExpression error(std::shared_ptr<const Vertex>{nullptr});
-    // we need to disable the expression optimization during buildup of the expressions to optimize
-    optimizeExpressions=false;
-    optExpr={
-      // list of expressions (the left ones) to optimize; the right ones are the optimized expressions
-      // which must mathematically equal the left ones but are simpler.
-      {    0 + a       ,  a},
-      {  0.0 + a       ,  a},
-      {    a + 0       ,  a},
-      {    a + 0.0     ,  a},
-      {    a - 0       ,  a},
-      {    a - 0.0     ,  a},
-      {    a - a       ,  0},
-      {    0 - a       , -a},
-      {      - 0       ,  0},
-      {    0 * a       ,  0},
-      {  0.0 * a       ,  0},
-      {    a * 0       ,  0},
-      {    a * 0.0     ,  0},
-      {    1 * a       ,  a},
-      {  1.0 * a       ,  a},
-      { -1   * a       , -a},
-      { -1.0 * a       , -a},
-      {    a * 1       ,  a},
-      {    a * 1.0     ,  a},
-      {    a * (-1)    , -a},
-      {    a * (-1.0)  , -a},
-      {    a * a       , pow(a,2)},
-      {    a / 0       , error},
-      {    a / 0.0     , error},
-      {    0 / a       ,  0},
-      {  0.0 / a       ,  0},
-      {    a / a       ,  1},
-      {    a / 1       ,  a},
-      {    a / 1.0     ,  a},
-      {    a / -1      , -a},
-      {    a / -1.0    , -a},
-      { pow(a,1)       , a},
-      { pow(a,1.0)     , a},
-      { pow(a,-1)      , 1/a},
-      { pow(a,-1.0)    , 1/a},
-      { pow(a,0)       , 1},
-      { pow(a,0.0)     , 1},
-      { pow(a,b)*a     , pow(a,b+1)},
-      { a*pow(a,b)     , pow(a,b+1)},
-      { pow(a,b)/a     , pow(a,b-1)},
-      { log(0)         , error},
-      { log(0.0)       , error},
-      { sqrt(-1)       , error},
-      { sqrt(-1.0)     , error},
-      { acosh(-1)      , error},
-      { acosh(-1.0)    , error},
-      { acosh(0)       , error},
-      { acosh(0.0)     , error},
-      { atanh(-1)      , error},
-      { atanh(-1.0)    , error},
-      { atanh(1)       , error},
-      { atanh(1.0)     , error},
+  // this is "always" true (except while this thread builds the list of expression optimizations, see below)
+  static thread_local bool optimizeExpressions=true;
+  if(optimizeExpressions) {
+    // a expression optimization: the expression to optimize (a pattern using the symbols a and b)
+    struct Rule {
+      SymbolicExpression pattern;
+      // build the optimized expression from the expressions matched by a and b (no template expression is
+      // substituted to avoid any heap allocation except for the new vertices); nullptr if the result is an error
+      SymbolicExpression (*build)(const SymbolicExpression &a, const SymbolicExpression &b);
     };
-    // now enable the optimizations again
-    optimizeExpressions=true;
-  }
-
-  if(optimizeExpressions) { // optimizeExpressions is "always" true (except for the initial call, see above)
-    // build the current operation
-    SymbolicExpression curOp=shared_ptr<Operation>(new Operation(op_, child_));
-    // loop over all optimization expressions
-    for(auto &opt : optExpr) {
-      SymbolicExpression in=opt.first;
-      SymbolicExpression out=opt.second;
-      MapIVSE m;
-      if(in->equal(curOp, m)) {
+    // the list of expression optimizations indexed by the operator of the expression to optimize
+    struct Rules {
+      IndependentVariable a;
+      IndependentVariable b;
+      vector<Rule> optExpr;
+      array<vector<size_t>, Condition+1> byOp; // the indices in optExpr for each operator
+    };
+    // on the first call build the list of expression optimizations
+    // (thread-safe static initialization: other threads wait until the list is build)
+    static const Rules rules=[]() {
+      Rules r;
+      auto &a=r.a;
+      auto &b=r.b;
+      // we need to disable the expression optimization during buildup of the expressions to optimize
+      optimizeExpressions=false;
+#define RHS(EXPR) []([[maybe_unused]] const SymbolicExpression &a, [[maybe_unused]] const SymbolicExpression &b) \
+                    -> SymbolicExpression { return EXPR; }
+      r.optExpr={
+        // list of expressions (the left ones) to optimize; the right ones are the optimized expressions
+        // which must mathematically equal the left ones but are simpler.
+        {    0 + a       , RHS(a) },
+        {  0.0 + a       , RHS(a) },
+        {    a + 0       , RHS(a) },
+        {    a + 0.0     , RHS(a) },
+        {    a - 0       , RHS(a) },
+        {    a - 0.0     , RHS(a) },
+        {    a - a       , RHS(0) },
+        {    0 - a       , RHS(-a) },
+        {      - 0       , RHS(0) },
+        {    0 * a       , RHS(0) },
+        {  0.0 * a       , RHS(0) },
+        {    a * 0       , RHS(0) },
+        {    a * 0.0     , RHS(0) },
+        {    1 * a       , RHS(a) },
+        {  1.0 * a       , RHS(a) },
+        { -1   * a       , RHS(-a) },
+        { -1.0 * a       , RHS(-a) },
+        {    a * 1       , RHS(a) },
+        {    a * 1.0     , RHS(a) },
+        {    a * (-1)    , RHS(-a) },
+        {    a * (-1.0)  , RHS(-a) },
+        {    a * a       , RHS(pow(a,2)) },
+        {    a / 0       , nullptr },
+        {    a / 0.0     , nullptr },
+        {    0 / a       , RHS(0) },
+        {  0.0 / a       , RHS(0) },
+        {    a / a       , RHS(1) },
+        {    a / 1       , RHS(a) },
+        {    a / 1.0     , RHS(a) },
+        {    a / -1      , RHS(-a) },
+        {    a / -1.0    , RHS(-a) },
+        { pow(a,1)       , RHS(a) },
+        { pow(a,1.0)     , RHS(a) },
+        { pow(a,-1)      , RHS(1/a) },
+        { pow(a,-1.0)    , RHS(1/a) },
+        { pow(a,0)       , RHS(1) },
+        { pow(a,0.0)     , RHS(1) },
+        { pow(a,b)*a     , RHS(pow(a,b+1)) },
+        { a*pow(a,b)     , RHS(pow(a,b+1)) },
+        { pow(a,b)/a     , RHS(pow(a,b-1)) },
+        { log(0)         , nullptr },
+        { log(0.0)       , nullptr },
+        { sqrt(-1)       , nullptr },
+        { sqrt(-1.0)     , nullptr },
+        { acosh(-1)      , nullptr },
+        { acosh(-1.0)    , nullptr },
+        { acosh(0)       , nullptr },
+        { acosh(0.0)     , nullptr },
+        { atanh(-1)      , nullptr },
+        { atanh(-1.0)    , nullptr },
+        { atanh(1)       , nullptr },
+        { atanh(1.0)     , nullptr },
+      };
+#undef RHS
+      // now enable the optimizations again
+      optimizeExpressions=true;
+      // (left expressions of builtin types, like log(0), are already evaluated by the compiler: these never match)
+      for(size_t i=0; i<r.optExpr.size(); ++i)
+        if(r.optExpr[i].pattern->getKind()==Vertex::Kind::Operation) {
+          auto o=static_cast<const Operation*>(r.optExpr[i].pattern.get());
+          r.byOp[o->op].emplace_back(i);
+          // match (below) handles patterns of at most two levels of operations
+          for(auto &c : o->child)
+            if(c->getKind()==Vertex::Kind::Operation)
+              for(auto &cc : static_cast<const Operation*>(c.get())->child)
+                assert(cc->getKind()!=Vertex::Kind::Operation);
+        }
+      return r;
+    }();
+
+    // match the expression e with the pattern p of a optimization: the symbols a and b of the pattern match any
+    // expression (the matched expressions are stored in m; a fixed size array to avoid any heap allocation)
+    array<const SymbolicExpression*, 2> m;
+    // match a pattern p which is not a operation
+    auto matchLeaf=[&m](const SymbolicExpression &p, const SymbolicExpression &e) {
+      if(p.get()==rules.a.get() || p.get()==rules.b.get()) {
+        auto &mapped=m[p.get()==rules.a.get() ? 0 : 1];
+        if(!mapped) {
+          mapped=&e;
+          return true;
+        }
+        return mapped->get()==e.get();
+      }
+      // a constant (constants are interned)
+      return p.get()==e.get();
+    };
+    // match a pattern p which is a operation of leafs or a leaf
+    auto match=[&matchLeaf](const SymbolicExpression &p, const SymbolicExpression &e) {
+      if(p->getKind()!=Vertex::Kind::Operation)
+        return matchLeaf(p, e);
+      if(e->getKind()!=Vertex::Kind::Operation)
+        return false;
+      auto po=static_cast<const Operation*>(p.get());
+      auto eo=static_cast<const Operation*>(e.get());
+      if(po->op!=eo->op || po->child.size()!=eo->child.size())
+        return false;
+      for(size_t i=0; i<po->child.size(); ++i)
+        if(!matchLeaf(po->child[i], eo->child[i]))
+          return false;
+      return true;
+    };
+    // loop over all optimization expressions of this operator
+    for(auto i : rules.byOp[op_]) {
+      auto &opt=rules.optExpr[i];
+      auto &in=static_cast<const Operation*>(opt.pattern.get())->child;
+      if(in.size()!=child_.size())
+        continue;
+      m={nullptr, nullptr};
+      bool equal=true;
+      for(size_t i=0; i<in.size() && equal; ++i)
+        equal=match(in[i], child_[i]);
+      if(equal) {
         // if this optimization expression matches ...
         // ... and the result is an error -> throw
-        if(!out.get())
+        if(!opt.build)
         {
           stringstream str;
-          str<<in;
+          str<<opt.pattern;
           throw runtime_error("Illegal constant argument in operation: "+str.str());
         }
-        // ... then return the optimized expressions with all symbols of m replaced.
-        for(auto &x : m)
-          out=substScalar(out, x.first, x.second);
-        return out;
+        // ... then return the optimized expression built from the matched expressions.
+        return opt.build(m[0] ? *m[0] : rules.a, m[1] ? *m[1] : rules.b);
       }
     }
 
-    // optimize Constant arguments (if ALL are Constant)
-    bool allConst=all_of(child_.begin(), child_.end(), [](const SymbolicExpression& c) {
-      return c->isConstantInt() || dynamic_pointer_cast<const Constant<double>>(c)!=nullptr;
-    });
+    // optimize Constant arguments (if ALL are Constant): evaluate the operation directly
+    // (with the same special cases as the bytecode: pow with a integer exponent and with the exponent 0.5)
+    array<double, 3> arg {};
+    bool allConst=true;
+    for(size_t i=0; i<child_.size() && allConst; ++i) {
+      if(auto ci=dynamic_cast<const Constant<long>*>(child_[i].get()))
+        arg[i]=ci->getValue();
+      else if(auto cd=dynamic_cast<const Constant<double>*>(child_[i].get()))
+        arg[i]=cd->getValue();
+      else
+        allConst=false;
+    }
     if(allConst) {
-      Operation op(op_, child_);
-      vector<ByteCode> byteCode;
-      byteCode.reserve(ByteCode::N+1);// preserve enought memory, we cannot move/copy a ByteCode.
-      map<const Vertex*, vector<AST::ByteCode>::iterator> existingVertex;
-      auto retIt = op.dumpByteCode(byteCode, existingVertex);
-      std::for_each(byteCode.begin(), byteCode.end(), [](const AST::ByteCode &bc){
-        bc.func(bc.retPtr, bc.argsPtr);
-      });
-      double doubleValue = retIt->retValue;
+      double doubleValue;
+      if(op_ == Pow && child_[1]->isConstantInt())
+        doubleValue = powInt(arg[0], static_cast<int>(arg[1]));
+      else if(op_ == Pow && isConstantHalf(child_[1]))
+        doubleValue = powHalf(arg[0]);
+      else
+        doubleValue = foldConstant(op_, arg.data());
       if(doubleValue > static_cast<double>(numeric_limits<long>::min()) &&
          doubleValue < static_cast<double>(numeric_limits<long>::max())) {
         long intValue=lround(doubleValue);
@@ -818,20 +1331,10 @@ SymbolicExpression Operation::create(Operator op_, const vector<SymbolicExpressi
     }
   }
 
-  vector<weak_ptr<const Vertex>> weakChild;
+  CacheKey key{op_, {nullptr, nullptr, nullptr}};
   // we cannot just use std::copy here since std::shared_ptr is a private base of SymbolicExpression
-  transform(child_.begin(), child_.end(), back_inserter(weakChild), [](const SymbolicExpression &x){
-    return weak_ptr<const Vertex>(x);
-  });
-  auto r=cache.insert(make_pair(make_pair(op_, weakChild), weak_ptr<const Operation>()));
-  if(!r.second) {
-    auto oldPtr=r.first->second.lock();
-    if(oldPtr)
-      return oldPtr;
-  }
-  auto newPtr=shared_ptr<Operation>(new Operation(op_, child_));
-  r.first->second=newPtr;
-  return newPtr;
+  transform(child_.begin(), child_.end(), key.second.begin(), [](const SymbolicExpression &x){ return x.get(); });
+  return cache.getOrCreate(key, [&op_, &child_]() { return shared_ptr<Operation>(new Operation(op_, child_)); });
 }
 
 bool Operation::equal(const SymbolicExpression &b, MapIVSE &m) const {
@@ -852,13 +1355,18 @@ bool Operation::equal(const SymbolicExpression &b, MapIVSE &m) const {
 }
 
 SymbolicExpression Operation::parDer(const IndependentVariable &x) const {
+  // differentiate the DAG of this operation (each shared vertex only once)
+  return fmatvec::parDer(vector<SymbolicExpression>{SymbolicExpression(shared_from_this())}, vector<IndependentVariable>{x})[0];
+}
+
+SymbolicExpression Operation::parDer(const vector<SymbolicExpression> &childDer) const {
   auto v=SymbolicExpression(shared_from_this()); // expression to be differentiated
   auto a=child.size()>=1 ? child[0] : SymbolicExpression(); // expression of first argument
   auto b=child.size()>=2 ? child[1] : SymbolicExpression(); // expression of second argument
   auto c=child.size()>=3 ? child[2] : SymbolicExpression(); // expression of third argument
-  auto ad=child.size()>=1 ? child[0]->parDer(x) : SymbolicExpression(); // pertial derivative of the expression of the first argument wrt the independent x
-  auto bd=child.size()>=2 ? child[1]->parDer(x) : SymbolicExpression(); // pertial derivative of the expression of the second argument wrt the independent x
-  auto cd=child.size()>=3 ? child[2]->parDer(x) : SymbolicExpression(); // pertial derivative of the expression of the third argument wrt the independent x
+  auto ad=child.size()>=1 ? childDer[0] : SymbolicExpression(); // pertial derivative of the expression of the first argument wrt the independent x
+  auto bd=child.size()>=2 ? childDer[1] : SymbolicExpression(); // pertial derivative of the expression of the second argument wrt the independent x
+  auto cd=child.size()>=3 ? childDer[2] : SymbolicExpression(); // pertial derivative of the expression of the third argument wrt the independent x
   switch(op) {
     case Plus:
       return ad + bd;
@@ -928,46 +1436,139 @@ SymbolicExpression Operation::parDer(const IndependentVariable &x) const {
   throw runtime_error("Unknown operation.");
 }
 
-Operation::Operation(Operator op_, const vector<SymbolicExpression> &child_) : op(op_), child(child_) {}
+Operation::Operation(Operator op_, const vector<SymbolicExpression> &child_) : Vertex(Kind::Operation), op(op_), child(child_) {}
 
-bool Operation::CacheKeyComp::operator()(const CacheKey& l, const CacheKey& r) const {
-  if(l.first!=r.first)
-    return l.first<r.first;
-  if(l.second.size()!=r.second.size())
-    return l.second.size()<r.second.size();
-  for(size_t i=0; i<l.second.size(); ++i)
-    if(ol(l.second[i],r.second[i]) || ol(r.second[i],l.second[i]))
-      return ol(l.second[i], r.second[i]);
-  return false;
+size_t Operation::CacheKeyHash::operator()(const CacheKey& k) const {
+  size_t h=0;
+  boost::hash_combine(h, static_cast<int>(k.first));
+  for(auto c : k.second)
+    boost::hash_combine(h, c);
+  return h;
 }
 
 std::vector<ByteCode>::iterator Operation::dumpByteCode(vector<ByteCode> &byteCode,
-                                                     map<const Vertex*, vector<ByteCode>::iterator> &existingVertex) const {
+                                                     map<const Vertex*, vector<ByteCode>::iterator> &existingVertex,
+                                                     ByteCodeBranches *branches) const {
   auto [lastIt, inserted] = existingVertex.insert(make_pair(this, vector<ByteCode>::iterator()));
   if(!inserted) return lastIt->second;
 
   std::vector<vector<ByteCode>::iterator> childItVec;
-  for(auto &c : child) {
-    auto it = c->dumpByteCode(byteCode, existingVertex);
+  for(size_t i=0; i<child.size(); ++i) {
+    // lazy branches of a condition: the vertices only used by this branch are skipped if the branch is not selected
+    if(op == Condition && i>=1 && branches && dumpBranch(i, byteCode, existingVertex, *branches, childItVec))
+      continue;
+    auto it = child[i]->dumpByteCode(byteCode, existingVertex, branches);
     childItVec.push_back(it);
   }
 
+  // the sin or cos of the same argument: not if it is skipped by a jump (a region of a lazy branch which does not
+  // include this entry)
+  vector<ByteCode>::iterator other;
+  bool hasOther = false;
+  if(auto partner = getSinCosPartner(); partner.get()) {
+    auto otherIt = existingVertex.find(partner.get());
+    if(otherIt != existingVertex.end() && !(branches && branches->isInRegion(otherIt->second-byteCode.begin()))) {
+      other = otherIt->second;
+      hasOther = true;
+    }
+  }
+  lastIt->second = emitByteCode(byteCode, childItVec.data(), hasOther ? &other : nullptr);
+  return lastIt->second;
+}
+
+SymbolicExpression Operation::getSinCosPartner() const {
+  if(op != Sin && op != Cos)
+    return SymbolicExpression(shared_ptr<const Vertex>());
+  return cache.find({op == Sin ? Cos : Sin, {child[0].get(), nullptr, nullptr}});
+}
+
+std::vector<ByteCode>::iterator Operation::emitByteCode(vector<ByteCode> &byteCode, const vector<ByteCode>::iterator *childIt,
+                                                     const vector<ByteCode>::iterator *other) const {
   byteCode.emplace_back(child.size());
   auto it = --byteCode.end();
   assert(child.size() <= ByteCode::N && "If more function arguments are needed you have to increase ByteCode::N at compile time.");
-  lastIt->second = it;
   it->func = opMap.at(op).func;
 
-  // optimization for pow with an interger exponent
+  // optimization for pow with an interger exponent (a chain of multiplications) and with the exponent 0.5
   if(op == Pow && child[1]->isConstantInt())
-    it->func = [](double* r, const ByteCode::Arg& a){ *r = std::pow(*a[0], static_cast<int>(*a[1])); };
+    it->func = [](double* r, const ByteCode::Arg& a){ *r = powInt(*a[0], static_cast<int>(*a[1])); };
+  if(op == Pow && isConstantHalf(child[1]))
+    it->func = [](double* r, const ByteCode::Arg& a){ *r = powHalf(*a[0]); };
 
-  auto childIt = childItVec.begin();
-  auto argsPtrIt = it->argsPtr.begin();
-  for(; childIt != childItVec.end(); ++childIt, ++argsPtrIt)
-    *argsPtrIt = (*childIt)->retPtr;
+  for(size_t i=0; i<child.size(); ++i)
+    it->argsPtr[i] = childIt[i]->retPtr;
+
+  // optimization for sin and cos of the same argument: if the other one already exists its byteCode entry computes
+  // both values at once (writing the value of this entry using a additional argument pointer) and this entry is empty.
+  // This entry still reads the other entry to keep the order for ByteCodeSchedule.
+  if(other) {
+    auto first = *other;
+    if(op == Cos)
+      first->func = [](double* r, const ByteCode::Arg& a){ sinCos(*a[0], *r, *a[1]); };
+    else
+      first->func = [](double* r, const ByteCode::Arg& a){ sinCos(*a[0], *a[1], *r); };
+    first->argsPtr.push_back(it->retPtr);
+    it->func = [](double*, const ByteCode::Arg&){};
+    it->argsPtr[0] = first->retPtr;
+  }
 
-  return --byteCode.end();
+  return it;
+}
+
+bool Operation::dumpBranch(size_t i, vector<ByteCode> &byteCode, map<const Vertex*, vector<ByteCode>::iterator> &existingVertex,
+                           ByteCodeBranches &branches, vector<vector<ByteCode>::iterator> &childItVec) const {
+  // nothing to skip if the branch is already emitted or is a symbol or constant
+  if(existingVertex.count(child[i].get()) ||
+     (!dynamic_cast<const Operation*>(child[i].get()) && !dynamic_cast<const NativeFunction*>(child[i].get())))
+    return false;
+  unordered_set<const Vertex*> exclusive;
+  vector<const Vertex*> shared;
+  branches.getBranchVertices(child[i], exclusive, shared);
+  if(!exclusive.count(child[i].get()))
+    return false;
+
+  // the vertices used by the branch and by others are emitted unconditionally
+  for(auto *v : shared)
+    v->dumpByteCode(byteCode, existingVertex, &branches);
+  // the jump skips the branch if it is not selected (the same comparison as in the Condition itself)
+  byteCode.emplace_back(1);
+  auto jumpIt = --byteCode.end();
+  if(i == 1)
+    jumpIt->func = [](double* r, const ByteCode::Arg& a){ *r = !(*a[0] > 0); };
+  else
+    jumpIt->func = [](double* r, const ByteCode::Arg& a){ *r = *a[0] > 0; };
+  jumpIt->argsPtr[0] = childItVec[0]->retPtr;
+  size_t begin = byteCode.size();
+  childItVec.push_back(child[i]->dumpByteCode(byteCode, existingVertex, &branches));
+  jumpIt->jump = byteCode.size() - begin;
+  branches.addRegion(begin, byteCode.size());
+  return true;
+}
+
+vector<SymbolicExpression> Operation::getTopologicalOrder(const vector<SymbolicExpression> &se,
+                                                          unordered_map<const Vertex*, size_t> &index) {
+  vector<SymbolicExpression> order;
+  vector<pair<const SymbolicExpression*, size_t>> stack; // a vertex and the index of its next child to visit
+  for(auto &root : se) {
+    if(index.count(root.get()))
+      continue;
+    stack.emplace_back(&root, 0);
+    while(!stack.empty()) {
+      auto [v, next]=stack.back();
+      auto o=dynamic_cast<const Operation*>(v->get());
+      if(o && next<o->child.size()) {
+        ++stack.back().second;
+        // a vertex is either finished or not visited at all (a vertex on the stack cannot be reached again in a DAG)
+        if(!index.count(o->child[next].get()))
+          stack.emplace_back(&o->child[next], 0);
+        continue;
+      }
+      index.emplace(v->get(), order.size());
+      order.emplace_back(*v);
+      stack.pop_back();
+    }
+  }
+  return order;
 }
 
 void Operation::walkVertex(const function<void(const shared_ptr<const Vertex>&)> &func) const {
@@ -976,6 +1577,607 @@ void Operation::walkVertex(const function<void(const shared_ptr<const Vertex>&)>
   func(shared_from_this());
 }
 
+OpCode::Index Operation::dumpOpCode(OpCodeProgram &prog, map<const Vertex*, OpCode::Index> &existingVertex) const {
+  auto [lastIt, inserted] = existingVertex.insert(make_pair(this, 0));
+  if(!inserted) return lastIt->second;
+
+  OpCode oc { static_cast<uint16_t>(op), 0, { 0, 0, 0 } };
+  assert(child.size() <= oc.arg.size());
+  for(size_t i=0; i<child.size(); ++i)
+    oc.arg[i] = child[i]->dumpOpCode(prog, existingVertex);
+
+  // optimization for pow with an interger exponent and with the exponent 0.5
+  if(op == Pow && child[1]->isConstantInt())
+    oc.code = OpCodeProgram::PowInt;
+  if(op == Pow && isConstantHalf(child[1]))
+    oc = { OpCodeProgram::PowHalf, 0, { oc.arg[0], 0, 0 } };
+
+  oc.ret = lastIt->second = prog.newSlot();
+  prog.code.push_back(oc);
+  return oc.ret;
+}
+
+// ***** OpCodeProgram *****
+
+void OpCodeProgram::addOutput(const SymbolicExpression &se, map<const Vertex*, Index> &existingVertex) {
+  output.emplace_back(se->dumpOpCode(*this, existingVertex));
+}
+
+OpCode::Index OpCodeProgram::addConstant(double c) {
+  auto it=find_if(constant.begin(), constant.end(), [c](const pair<Index, double> &x) {
+    return x.second==c && signbit(x.second)==signbit(c);
+  });
+  if(it!=constant.end())
+    return it->first;
+  auto slot=newSlot();
+  constant.emplace_back(slot, c);
+  return slot;
+}
+
+OpCode::Index OpCodeProgram::addCode(uint16_t c, Index a0, Index a1, Index a2) {
+  auto slot=newSlot();
+  code.push_back({c, slot, {a0, a1, a2}});
+  return slot;
+}
+
+void OpCodeProgram::addAdjoint(const vector<SymbolicExpression> &dep, const vector<IndependentVariable> &indep,
+                               map<const Vertex*, Index> &existingVertex) {
+  constexpr Index none=numeric_limits<Index>::max();
+  // the forward sweep: the instructions of all dep
+  vector<Index> depSlot;
+  for(auto &d : dep)
+    depSlot.emplace_back(d->dumpOpCode(*this, existingVertex));
+  size_t nrFwdCode=code.size();
+  Index nrFwdSlots=nrSlots;
+
+  // the slots of indep (none if dep does not depend on it)
+  vector<Index> indepSlot;
+  for(auto &x : indep) {
+    auto it=find_if(symbol.begin(), symbol.end(), [&x](const pair<shared_ptr<const Symbol>, Index> &s) { return x==s.first; });
+    indepSlot.emplace_back(it==symbol.end() ? none : it->second);
+  }
+  // a slot is active if it depends on any indep: only active slots need a adjoint
+  vector<bool> active(nrFwdSlots, false);
+  for(auto x : indepSlot)
+    if(x!=none)
+      active[x]=true;
+  for(size_t i=0; i<nrFwdCode; ++i) {
+    bool a=false;
+    forEachArg(code[i], [&active, &a](Index x) { a = a || active[x]; });
+    active[code[i].ret]=a;
+  }
+
+  auto zero=addConstant(0);
+  auto one=addConstant(1);
+  vector<Index> adj; // the slot of the adjoint of each slot of the forward sweep (none = zero)
+  // adj[x] += v (adj[x] -= v if neg is true)
+  auto add=[this, &adj, &active](Index x, Index v, bool neg=false) {
+    if(!active[x])
+      return;
+    if(adj[x]==none)
+      adj[x] = neg ? addCode(Operation::Neg, v) : v;
+    else
+      adj[x] = addCode(neg ? Operation::Minus : Operation::Plus, adj[x], v);
+  };
+  // the reverse sweep for each dep (the same derivatives as Operation::parDer and NativeFunction::parDer are used)
+  for(auto d : depSlot) {
+    adj.assign(nrFwdSlots, none);
+    if(active[d])
+      adj[d]=one;
+    for(size_t i=nrFwdCode; i-->0;) {
+      auto oc=code[i]; // a copy since addCode may reallocate code
+      auto g=adj[oc.ret];
+      if(g==none)
+        continue;
+      auto a=oc.arg[0], b=oc.arg[1], c=oc.arg[2], v=oc.ret;
+      auto mult=[this, g](Index x) { return addCode(Operation::Mult, g, x); };
+      auto div=[this, g](Index x) { return addCode(Operation::Div, g, x); };
+      auto sqr=[this](Index x) { return addCode(Operation::Mult, x, x); };
+      switch(oc.code) {
+        case Operation::Plus:
+          add(a, g); add(b, g); break;
+        case Operation::Minus:
+          add(a, g); add(b, g, true); break;
+        case Operation::Mult:
+          if(active[a]) add(a, mult(b));
+          if(active[b]) add(b, mult(a));
+          break;
+        case Operation::Div: {
+          auto t=div(b);
+          add(a, t);
+          if(active[b]) add(b, addCode(Operation::Mult, t, v), true);
+          break;
+        }
+        case Operation::Pow:
+          if(active[a]) add(a, mult(addCode(Operation::Mult, b, addCode(Operation::Pow, a, addCode(Operation::Minus, b, one)))));
+          if(active[b]) add(b, mult(addCode(Operation::Mult, v, addCode(Operation::Log, a))));
+          break;
+        case PowInt: {
+          auto n=find_if(constant.begin(), constant.end(), [b](const pair<Index, double> &x) { return x.first==b; })->second;
+          add(a, mult(addCode(Operation::Mult, b, addCode(PowInt, a, addConstant(n-1)))));
+          break;
+        }
+        case Operation::Log:
+          add(a, div(a)); break;
+        case Operation::Sqrt:
+        case PowHalf:
+          add(a, div(addCode(Operation::Mult, addConstant(2), v))); break;
+        case Operation::Neg:
+          add(a, g, true); break;
+        case Operation::Sin:
+          add(a, mult(addCode(Operation::Cos, a))); break;
+        case Operation::Cos:
+          add(a, mult(addCode(Operation::Sin, a)), true); break;
+        case Operation::Tan:
+          add(a, div(sqr(addCode(Operation::Cos, a)))); break;
+        case Operation::Sinh:
+          add(a, mult(addCode(Operation::Cosh, a))); break;
+        case Operation::Cosh:
+          add(a, mult(addCode(Operation::Sinh, a))); break;
+        case Operation::Tanh:
+          add(a, mult(addCode(Operation::Minus, one, sqr(v)))); break;
+        case Operation::ASin:
+          add(a, div(addCode(Operation::Sqrt, addCode(Operation::Minus, one, sqr(a))))); break;
+        case Operation::ACos:
+          add(a, div(addCode(Operation::Sqrt, addCode(Operation::Minus, one, sqr(a)))), true); break;
+        case Operation::ATan:
+          add(a, div(addCode(Operation::Plus, one, sqr(a)))); break;
+        case Operation::ATan2: {
+          auto t=div(addCode(Operation::Plus, sqr(a), sqr(b)));
+          if(active[a]) add(a, addCode(Operation::Mult, t, b));
+          if(active[b]) add(b, addCode(Operation::Mult, t, a), true);
+          break;
+        }
+        case Operation::ASinh:
+          add(a, div(addCode(Operation::Sqrt, addCode(Operation::Plus, sqr(a), one)))); break;
+        case Operation::ACosh:
+          add(a, div(addCode(Operation::Sqrt, addCode(Operation::Minus, sqr(a), one)))); break;
+        case Operation::ATanh:
+          add(a, div(addCode(Operation::Minus, one, sqr(a)))); break;
+        case Operation::Exp:
+          add(a, mult(v)); break;
+        case Operation::Sign:
+        case Operation::Heaviside:
+          break;
+        case Operation::Abs:
+          add(a, mult(addCode(Operation::Sign, a))); break;
+        case Operation::Min:
+          if(active[a]) add(a, mult(addCode(Operation::Heaviside, addCode(Operation::Minus, b, a))));
+          if(active[b]) add(b, mult(addCode(Operation::Heaviside, addCode(Operation::Minus, a, b))));
+          break;
+        case Operation::Max:
+          if(active[a]) add(a, mult(addCode(Operation::Heaviside, addCode(Operation::Minus, a, b))));
+          if(active[b]) add(b, mult(addCode(Operation::Heaviside, addCode(Operation::Minus, b, a))));
+          break;
+        case Operation::Condition:
+          if(active[b]) add(b, addCode(Operation::Condition, a, g, zero));
+          if(active[c]) add(c, addCode(Operation::Condition, a, zero, g));
+          break;
+        case Native: {
+          auto call=native[a]; // a copy since native is extended
+          if(call.order==2)
+            throw runtime_error("Derivative higher than 2 of external function needed. "
+                                "External functions provide only the second derivative.");
+          // the number of function arguments (the remaining arguments are the direction of the first derivative)
+          size_t nx = call.order==0 ? call.arg.size() : call.arg.size()/2;
+          for(size_t k=0; k<call.arg.size(); ++k) {
+            if(!active[call.arg[k]])
+              continue;
+            // the partial derivative wrt a function argument is a directional derivative of the next order
+            // in the direction of a unit vector; wrt a direction it is the first directional derivative (linearity)
+            NativeCall der;
+            der.func=call.func;
+            der.order = k<nx ? call.order+1 : 1;
+            der.arg.assign(call.arg.begin(), call.arg.begin()+(k<nx ? call.arg.size() : nx));
+            for(size_t j=0; j<nx; ++j)
+              der.arg.emplace_back(j==k%nx ? one : zero);
+            native.emplace_back(move(der));
+            add(call.arg[k], mult(addCode(Native, static_cast<Index>(native.size()-1))));
+          }
+          break;
+        }
+        default:
+          throw runtime_error("Internal error: unknown op code in OpCodeProgram::addAdjoint.");
+      }
+    }
+    for(auto x : indepSlot)
+      output.emplace_back(x==none || adj[x]==none ? zero : adj[x]);
+  }
+}
+
+void OpCodeProgram::addSparseParDer(const vector<SymbolicExpression> &dep, const vector<IndependentVariable> &indep,
+                                    map<const Vertex*, Index> &existingVertex, vector<int> &I, vector<int> &J,
+                                    bool diagonalFirst) {
+  // the nonzero entries must be kept alive until all are dumped since existingVertex is keyed by its address
+  vector<SymbolicExpression> nonZero;
+  // all entries at once: each shared vertex is differentiated only once per indep (not once per entry)
+  auto der=fmatvec::parDer(dep, indep);
+  I.assign(1, 0);
+  J.clear();
+  for(size_t r=0; r<dep.size(); ++r) {
+    if(diagonalFirst) {
+      nonZero.emplace_back(der[r*indep.size()+r]);
+      J.emplace_back(r);
+    }
+    for(size_t c=0; c<indep.size(); ++c) {
+      if(diagonalFirst && c==r)
+        continue;
+      auto &d=der[r*indep.size()+c];
+      if(d->isZero())
+        continue;
+      nonZero.emplace_back(d);
+      J.emplace_back(c);
+    }
+    I.emplace_back(J.size());
+  }
+  for(auto &d : nonZero)
+    addOutput(d, existingVertex);
+}
+
+OpCode::Index OpCodeProgram::reuseSlots() {
+  constexpr size_t unused = numeric_limits<size_t>::max();
+  constexpr size_t released = unused-1;
+  // the index of the last instruction reading a slot (outputs are read after the last instruction)
+  vector<size_t> lastUse(nrSlots, unused);
+  for(size_t i=0; i<code.size(); ++i)
+    forEachArg(code[i], [&lastUse, i](Index a) { lastUse[a]=i; });
+  for(auto o : output)
+    lastUse[o]=code.size();
+
+  // constants and symbols get the first slots and are never reused
+  vector<Index> newSlot(nrSlots);
+  vector<bool> pinned(nrSlots, false);
+  Index n=0;
+  for(auto &c : constant) { pinned[c.first]=true; c.first=newSlot[c.first]=n++; }
+  for(auto &s : symbol)   { pinned[s.second]=true; s.second=newSlot[s.second]=n++; }
+
+  // walk all instructions: release the slots of arguments read the last time and reuse these for the results
+  vector<Index> freeSlot;
+  for(size_t i=0; i<code.size(); ++i) {
+    auto &oc=code[i];
+    forEachArg(oc, [&](Index &a) {
+      auto old=a;
+      a=newSlot[old];
+      if(!pinned[old] && lastUse[old]==i) {
+        freeSlot.push_back(a);
+        lastUse[old]=released; // avoid a second release if a slot is used more than once by this instruction
+      }
+    });
+    auto old=oc.ret;
+    if(freeSlot.empty())
+      oc.ret=newSlot[old]=n++;
+    else {
+      oc.ret=newSlot[old]=freeSlot.back();
+      freeSlot.pop_back();
+    }
+    if(lastUse[old]==unused) // a result which is never read
+      freeSlot.push_back(oc.ret);
+  }
+  for(auto &o : output)
+    o=newSlot[o];
+
+  auto oldNrSlots=nrSlots;
+  nrSlots=n;
+  return oldNrSlots;
+}
+
+vector<int> OpCodeProgram::getInputIndex(const vector<IndependentVariable> &indep) const {
+  vector<int> ret;
+  ret.reserve(symbol.size());
+  for(auto &s : symbol) {
+    auto it = find_if(indep.begin(), indep.end(), [&s](const IndependentVariable &x) { return x==s.first; });
+    ret.emplace_back(it==indep.end() ? -1 : static_cast<int>(it-indep.begin()));
+  }
+  return ret;
+}
+
+double OpCodeProgram::NativeCall::operator()(const ByteCode::Arg &arg) const {
+  switch(order) {
+    case 0: return (*func)(arg);
+    case 1: return func->dirDer(arg);
+    default: return func->dirDerDirDer(arg);
+  }
+}
+
+void OpCodeProgram::initConstants(double *value, size_t lanes) const {
+  for(auto &[slot, c] : constant)
+    fill_n(value+slot*lanes, lanes, c);
+}
+
+void OpCodeProgram::eval(double *value) const {
+  eval(value, code);
+}
+
+void OpCodeProgram::eval(double *value, const vector<OpCode> &instr) const {
+  ByteCode::Arg nativeArg;
+  for(auto &oc : instr) {
+#define _a value[oc.arg[0]]
+#define _b value[oc.arg[1]]
+#define _c value[oc.arg[2]]
+#define FMATVEC_KERNEL(CODE, EXPR) case CODE: value[oc.ret] = EXPR; break;
+    switch(oc.code) {
+      FMATVEC_OPCODE_KERNELS(FMATVEC_KERNEL)
+      case Native: {
+        auto &call = native[oc.arg[0]];
+        nativeArg.resize(call.arg.size());
+        for(size_t i=0; i<call.arg.size(); ++i)
+          nativeArg[i] = value + call.arg[i];
+        value[oc.ret] = call(nativeArg);
+        break;
+      }
+    }
+#undef FMATVEC_KERNEL
+#undef _a
+#undef _b
+#undef _c
+  }
+}
+
+vector<OpCode> OpCodeProgram::getSlice(const vector<Index> &outputSlot) const {
+  // backward over all instructions: a instruction is needed if its result slot is needed at this point
+  // (slots may be reused: a needed slot is no longer needed before the instruction writing it)
+  vector<bool> needed(nrSlots, false);
+  for(auto s : outputSlot)
+    needed[s]=true;
+  vector<OpCode> slice;
+  for(auto it=code.rbegin(); it!=code.rend(); ++it) {
+    if(!needed[it->ret])
+      continue;
+    needed[it->ret]=false;
+    forEachArg(*it, [&needed](Index a) { needed[a]=true; });
+    slice.emplace_back(*it);
+  }
+  reverse(slice.begin(), slice.end());
+  return slice;
+}
+
+void OpCodeProgram::evalBatch(double *value, size_t lanes, size_t n) const {
+  ByteCode::Arg nativeArg;
+  for(auto &oc : code) {
+    double *r = value + oc.ret*lanes;
+    const double *a = value + oc.arg[0]*lanes;
+    const double *b = value + oc.arg[1]*lanes;
+    const double *c = value + oc.arg[2]*lanes;
+#define _a a[l]
+#define _b b[l]
+#define _c c[l]
+#define FMATVEC_KERNEL(CODE, EXPR) case CODE: for(size_t l=0; l<n; ++l) r[l] = EXPR; break;
+    switch(oc.code) {
+      FMATVEC_OPCODE_KERNELS(FMATVEC_KERNEL)
+      case Native: {
+        auto &call = native[oc.arg[0]];
+        nativeArg.resize(call.arg.size());
+        for(size_t l=0; l<n; ++l) {
+          for(size_t i=0; i<call.arg.size(); ++i)
+            nativeArg[i] = value + call.arg[i]*lanes + l;
+          r[l] = call(nativeArg);
+        }
+        break;
+      }
+    }
+#undef FMATVEC_KERNEL
+#undef _a
+#undef _b
+#undef _c
+  }
+}
+
+
+namespace {
+  // the forward mode sweep of evalForward for order 1 (dual numbers) or order 2 (hyper-dual numbers):
+  // each slot holds the value, the derivative in direction 1 and (for order 2) in direction 2 and the second derivative
+  template<int Order>
+  void evalForwardSweep(const OpCodeProgram &prog, double *value) {
+    constexpr size_t S=OpCodeProgram::forwardStride(Order);
+    ByteCode::Arg nativeArg;
+    vector<double> nativeValue;
+    for(auto &oc : prog.code) {
+      const double *a = value + oc.arg[0]*S;
+      const double *b = value + oc.arg[1]*S;
+      const double *c = value + oc.arg[2]*S;
+      double r[S]; // the result (the result slot may be equal to a argument slot)
+      // r = f(a) with f1 = f'(a) and f2() = f''(a) (f2 is only called for order 2)
+      auto unary=[&r, a](double f, double f1, const auto &f2) {
+        r[0] = f;
+        r[1] = f1*a[1];
+        if constexpr (Order==2) {
+          r[2] = f1*a[2];
+          r[3] = f1*a[3] + f2()*a[1]*a[2];
+        }
+      };
+      // r = f(a, b) with the first partial derivatives fa, fb and f2() = {faa, fab, fbb} (f2 is only called for order 2)
+      auto binary=[&r, a, b](double f, double fa, double fb, const auto &f2) {
+        r[0] = f;
+        r[1] = fa*a[1] + fb*b[1];
+        if constexpr (Order==2) {
+          r[2] = fa*a[2] + fb*b[2];
+          auto [faa, fab, fbb] = f2();
+          r[3] = fa*a[3] + fb*b[3] + faa*a[1]*a[2] + fab*(a[1]*b[2]+a[2]*b[1]) + fbb*b[1]*b[2];
+        }
+      };
+      // r = w*x + (1-w)*y for all derivatives (the value is f)
+      auto select=[&r](double f, double w, const double *x, const double *y) {
+        r[0] = f;
+        for(size_t k=1; k<S; ++k)
+          r[k] = w*x[k] + (1-w)*y[k];
+      };
+      using F2 = array<double, 3>;
+      auto zero=[]() { return 0.0; };
+      auto zero2=[]() { return F2{0, 0, 0}; };
+      double x=a[0], y=b[0];
+      switch(oc.code) {
+        case Operation::Plus: binary(x+y, 1, 1, zero2); break;
+        case Operation::Minus: binary(x-y, 1, -1, zero2); break;
+        case Operation::Mult: binary(x*y, y, x, []() { return F2{0, 1, 0}; }); break;
+        case Operation::Div: {
+          double v=x/y;
+          binary(v, 1/y, -v/y, [v, y]() { return F2{0, -1/(y*y), 2*v/(y*y)}; });
+          break;
+        }
+        case Operation::Pow: {
+          double v=std::pow(x, y);
+          if(b[1]==0 && (Order==1 || (b[2]==0 && b[3]==0))) // a constant exponent (avoids log(x) for x<=0)
+            unary(v, y*std::pow(x, y-1), [x, y]() { return y*(y-1)*std::pow(x, y-2); });
+          else {
+            double l=std::log(x);
+            binary(v, y*std::pow(x, y-1), v*l, [x, y, v, l]() {
+              return F2{y*(y-1)*std::pow(x, y-2), std::pow(x, y-1)*(1+y*l), v*l*l};
+            });
+          }
+          break;
+        }
+        case OpCodeProgram::PowInt: {
+          int n=static_cast<int>(y);
+          unary(powInt(x, n), n==0 ? 0 : n*std::pow(x, n-1),
+                [x, n]() { return n*(n-1)==0 ? 0 : n*(n-1)*std::pow(x, n-2); });
+          break;
+        }
+        case Operation::Log: unary(std::log(x), 1/x, [x]() { return -1/(x*x); }); break;
+        case Operation::Sqrt:
+        case OpCodeProgram::PowHalf: {
+          double v=oc.code==Operation::Sqrt ? std::sqrt(x) : powHalf(x);
+          unary(v, 0.5/v, [x, v]() { return -0.25/(v*x); });
+          break;
+        }
+        case Operation::Neg: unary(-x, -1, zero); break;
+        case Operation::Sin: {
+          double v=std::sin(x);
+          unary(v, std::cos(x), [v]() { return -v; });
+          break;
+        }
+        case Operation::Cos: {
+          double v=std::cos(x);
+          unary(v, -std::sin(x), [v]() { return -v; });
+          break;
+        }
+        case Operation::Tan: {
+          double v=std::tan(x), d=1+v*v;
+          unary(v, d, [v, d]() { return 2*v*d; });
+          break;
+        }
+        case Operation::Sinh: {
+          double v=std::sinh(x);
+          unary(v, std::cosh(x), [v]() { return v; });
+          break;
+        }
+        case Operation::Cosh: {
+          double v=std::cosh(x);
+          unary(v, std::sinh(x), [v]() { return v; });
+          break;
+        }
+        case Operation::Tanh: {
+          double v=std::tanh(x), d=1-v*v;
+          unary(v, d, [v, d]() { return -2*v*d; });
+          break;
+        }
+        case Operation::ASin: {
+          double d=1/std::sqrt(1-x*x);
+          unary(std::asin(x), d, [x, d]() { return x*d*d*d; });
+          break;
+        }
+        case Operation::ACos: {
+          double d=-1/std::sqrt(1-x*x);
+          unary(std::acos(x), d, [x, d]() { return x*d*d*d; });
+          break;
+        }
+        case Operation::ATan: {
+          double d=1/(1+x*x);
+          unary(std::atan(x), d, [x, d]() { return -2*x*d*d; });
+          break;
+        }
+        case Operation::ATan2: {
+          double q=x*x+y*y;
+          binary(std::atan2(x, y), y/q, -x/q, [x, y, q]() {
+            return F2{-2*x*y/(q*q), (x*x-y*y)/(q*q), 2*x*y/(q*q)};
+          });
+          break;
+        }
+        case Operation::ASinh: {
+          double d=1/std::sqrt(x*x+1);
+          unary(std::asinh(x), d, [x, d]() { return -x*d*d*d; });
+          break;
+        }
+        case Operation::ACosh: {
+          double d=1/std::sqrt(x*x-1);
+          unary(std::acosh(x), d, [x, d]() { return -x*d*d*d; });
+          break;
+        }
+        case Operation::ATanh: {
+          double d=1/(1-x*x);
+          unary(std::atanh(x), d, [x, d]() { return 2*x*d*d; });
+          break;
+        }
+        case Operation::Exp: {
+          double v=std::exp(x);
+          unary(v, v, [v]() { return v; });
+          break;
+        }
+        case Operation::Sign: unary(boost::math::sign(x), 0, zero); break;
+        case Operation::Heaviside: unary(0.5 * boost::math::sign(x) + 0.5, 0, zero); break;
+        case Operation::Abs: unary(std::abs(x), boost::math::sign(x), zero); break;
+        // the same derivatives as Operation::parDer: weighted by Heaviside (the mean value if both are equal)
+        case Operation::Min: select(std::min(x, y), 0.5 * boost::math::sign(y-x) + 0.5, a, b); break;
+        case Operation::Max: select(std::max(x, y), 0.5 * boost::math::sign(x-y) + 0.5, a, b); break;
+        case Operation::Condition:
+          if(x > 0)
+            copy(b, b+S, r);
+          else
+            copy(c, c+S, r);
+          break;
+        case OpCodeProgram::Native: {
+          auto &call = prog.native[oc.arg[0]];
+          if(call.order==2 || (call.order==1 && Order==2))
+            throw runtime_error("Derivative higher than 2 of external function needed. "
+                                "External functions provide only the second derivative.");
+          // call the function (of order order) with the arguments given by a list of {begin, end, k}:
+          // the k-th component (0 = value) of the arguments begin to end-1 of call
+          auto callFunc=[&](int order, initializer_list<array<size_t, 3>> parts) {
+            nativeValue.clear();
+            for(auto &[begin, end, k] : parts)
+              for(size_t i=begin; i<end; ++i)
+                nativeValue.emplace_back(value[call.arg[i]*S+k]);
+            nativeArg.resize(nativeValue.size());
+            for(size_t i=0; i<nativeValue.size(); ++i)
+              nativeArg[i] = &nativeValue[i];
+            switch(order) {
+              case 0: return (*call.func)(nativeArg);
+              case 1: return call.func->dirDer(nativeArg);
+              default: return call.func->dirDerDirDer(nativeArg);
+            }
+          };
+          size_t n=call.arg.size();
+          if(call.order==0) {
+            r[0] = callFunc(0, {{0, n, 0}});
+            r[1] = callFunc(1, {{0, n, 0}, {0, n, 1}});
+            if constexpr (Order==2) {
+              r[2] = callFunc(1, {{0, n, 0}, {0, n, 2}});
+              r[3] = callFunc(2, {{0, n, 0}, {0, n, 1}, {0, n, 2}}) + callFunc(1, {{0, n, 0}, {0, n, 3}});
+            }
+          }
+          else {
+            // the function is f'(x)[dir] (x are the first n/2 arguments): its derivative is f''(x)[dir, x'] + f'(x)[dir']
+            r[0] = callFunc(1, {{0, n, 0}});
+            r[1] = callFunc(2, {{0, n, 0}, {0, n/2, 1}}) + callFunc(1, {{0, n/2, 0}, {n/2, n, 1}});
+          }
+          break;
+        }
+        default:
+          throw runtime_error("Internal error: unknown op code in OpCodeProgram::evalForward.");
+      }
+      copy(r, r+S, value+oc.ret*S);
+    }
+  }
+}
+
+void OpCodeProgram::evalForward(double *value, int order) const {
+  if(order==1)
+    evalForwardSweep<1>(*this, value);
+  else if(order==2)
+    evalForwardSweep<2>(*this, value);
+  else
+    throw runtime_error("OpCodeProgram::evalForward supports only the orders 1 and 2.");
+}
+
 } // end namespace AST
 
 template<>
@@ -984,9 +2186,8 @@ boost::spirit::qi::rule<boost::spirit::istream_iterator, IndependentVariable()>&
   namespace phx = boost::phoenix;
 
   static boost::spirit::qi::rule<boost::spirit::istream_iterator, IndependentVariable()> ret;
-  static bool init=false;
-  if(!init) {
-    init=true;
+  static once_flag init;
+  call_once(init, [&]() {
 #ifndef NDEBUG // FMATVEC_DEBUG_SYMBOLICEXPRESSION_UUID
     if(getenv("FMATVEC_DEBUG_SYMBOLICEXPRESSION_UUID"))
       ret = *qi::blank >> 's' >> qi::int_[qi::_val=phx::bind(&createSymbolByInt, qi::_1)];
@@ -995,7 +2196,7 @@ boost::spirit::qi::rule<boost::spirit::istream_iterator, IndependentVariable()>&
 #else
     ret = *qi::blank >> (qi::repeat(36)[qi::char_("a-f0-9-")])[qi::_val=phx::bind(&createSymbolByVec, qi::_1)];
 #endif
-  }
+  });
   return ret;
 }
 
@@ -1006,9 +2207,8 @@ boost::spirit::qi::rule<boost::spirit::istream_iterator, SymbolicExpression()>&
   using It = boost::spirit::istream_iterator;
 
   static boost::spirit::qi::rule<boost::spirit::istream_iterator, SymbolicExpression()> vertex;
-  static bool init=false;
-  if(!init) {
-    init=true;
+  static once_flag init;
+  call_once(init, [&]() {
     static qi::rule<It, SymbolicExpression()>  constLong;
     static qi::real_parser<double, qi::strict_real_policies<double>> strict_double;
     static qi::rule<It, SymbolicExpression()>  constDouble;
@@ -1024,7 +2224,7 @@ boost::spirit::qi::rule<boost::spirit::istream_iterator, SymbolicExpression()>&
     qi::rule<It, IndependentVariable()> &symbol = getBoostSpiritQiRule<IndependentVariable>();
     operation   = *qi::blank >> (opSym >> '(' >> (vertex % ',') >> ')')[qi::_val=phx::bind(&AST::Operation::create, qi::_1, qi::_2)];
     vertex      = symbol | operation | constDouble | constLong;
-  }
+  });
   return vertex;
 }
 
@@ -1077,9 +2277,8 @@ boost::spirit::karma::rule<std::ostream_iterator<char>, SymbolicExpression()>& g
   using It = std::ostream_iterator<char>;
 
   static boost::spirit::karma::rule<It, SymbolicExpression()> vertex;
-  static bool init=false;
-  if(!init) {
-    init=true;
+  static once_flag init;
+  call_once(init, [&]() {
     static karma::rule<It, SymbolicExpression()> constLong;
     static karma::rule<It, SymbolicExpression()> constDouble;
     static karma::rule<It, SymbolicExpression()> symbol;
@@ -1099,7 +2298,7 @@ boost::spirit::karma::rule<std::ostream_iterator<char>, SymbolicExpression()>& g
     symbol         = karma::string[karma::_1=phx::bind(&getSymbol, karma::_val, karma::_pass)];
     nativeFunction = karma::int_[karma::_1=phx::bind(&getFunction, karma::_val, karma::_pass)]; // dummy, getFunction throw always
     vertex         = constLong | constDouble | symbol | operation | nativeFunction;
-  }
+  });
   return vertex;
 }
 
@@ -1110,11 +2309,10 @@ boost::spirit::karma::rule<std::ostream_iterator<char>, IndependentVariable()>&
   using It = std::ostream_iterator<char>;
 
   static karma::rule<It, IndependentVariable()> symbol;
-  static bool init=false;
-  if(!init) {
-    init=true;
+  static once_flag init;
+  call_once(init, [&]() {
     symbol = karma::string[karma::_1=phx::bind(&getSymbol, karma::_val, karma::_pass)];
-  }
+  });
   return symbol;
 }
 
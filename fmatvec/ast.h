@@ -3,10 +3,15 @@
 
 #include "fmatvec/function.h"
 #include <map>
+#include <algorithm>
 #include <array>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/container/small_vector.hpp>
 #include <utility>
 #include <fmatvec/stream.h>
@@ -23,7 +28,18 @@ namespace AST {
   class Operation;
   class NativeFunction;
   template<class T> class Constant;
+  class OpCodeProgram;
+  class ExpressionCache;
+  class ExpressionOptimizer;
+  class ByteCodeBranches;
+  class ByteCodeBuilder;
+  class ExpressionArena;
   FMATVEC_EXPORT SymbolicExpression substScalar(const SymbolicExpression &se, const IndependentVariable& a, const SymbolicExpression &b);
+  //! Substitute all independent variables a[i] in all expressions se by b[i] in a single traversal of the expression DAG.
+  //! All substitutions are done simultaneously: a a[j] contained in b[i] is not substituted.
+  FMATVEC_EXPORT std::vector<SymbolicExpression> substScalar(const std::vector<SymbolicExpression> &se,
+                                                             const std::vector<IndependentVariable> &a,
+                                                             const std::vector<SymbolicExpression> &b);
 }
 
 template<class... Arg> class Eval;
@@ -41,9 +57,20 @@ class FMATVEC_EXPORT SymbolicExpression : public std::shared_ptr<const AST::Vert
   friend class AST::Constant<long>;
   friend class AST::Constant<double>;
   friend class AST::NativeFunction;
+  friend class AST::OpCodeProgram;
+  friend class AST::ExpressionCache;
+  friend class AST::ExpressionOptimizer;
+  friend class AST::ByteCodeBranches;
+  friend class AST::ByteCodeBuilder;
+  friend class AST::ExpressionArena;
   friend FMATVEC_EXPORT SymbolicExpression parDer(const SymbolicExpression &dep, const IndependentVariable &indep);
   friend SymbolicExpression AST::substScalar(const SymbolicExpression &se,
                                              const IndependentVariable& a, const SymbolicExpression &b);
+  friend FMATVEC_EXPORT std::vector<SymbolicExpression> parDer(const std::vector<SymbolicExpression> &dep,
+                                                               const std::vector<IndependentVariable> &indep);
+  friend std::vector<SymbolicExpression> AST::substScalar(const std::vector<SymbolicExpression> &se,
+                                                          const std::vector<IndependentVariable> &a,
+                                                          const std::vector<SymbolicExpression> &b);
   protected:
     template<class T> SymbolicExpression(const shared_ptr<T> &x);
 #ifndef SWIG
@@ -69,8 +96,19 @@ class FMATVEC_EXPORT SymbolicExpression : public std::shared_ptr<const AST::Vert
     //! Garbage collect everything.
     //! The only "garbage" which can be left by this class are empty weak_ptr's stored in global maps.
     //! This routine removes such garbage.
+    //! Note that calling this routine is not required: the global maps are also collected incrementally,
+    //! on each insertion of a new entry a bounded number of entries is checked and removed if expired.
     static void garbageCollect();
 
+    //! Statistics of the global maps used to cache all expressions.
+    struct CacheStatistics {
+      size_t live { 0 }; //!< the number of entries of existing expressions
+      size_t expired { 0 }; //!< the number of expired entries (of already deleted expressions) not removed yet
+      size_t collected { 0 }; //!< the total number of expired entries removed by the incremental garbage collection
+    };
+    //! Return the current statistics of the global maps used to cache all expressions (requires a full scan).
+    static CacheStatistics getCacheStatistics();
+
     // default ctors and assignment operators
     SymbolicExpression(const SymbolicExpression& x) = default;
     SymbolicExpression(SymbolicExpression&& x) = default;
@@ -155,6 +193,12 @@ FMATVEC_EXPORT SymbolicExpression operator/(long a, const SymbolicExpression &b)
 //! Generate a new SymbolicExpression being the partial derivate of dep
 //! with respect to indep (indep must be a symbol).
 FMATVEC_EXPORT SymbolicExpression parDer(const SymbolicExpression &dep, const IndependentVariable &indep);
+//! Generate the partial derivatives of all dep with respect to all indep: the derivative of dep[d] wrt indep[i] is
+//! returned at index d*indep.size()+i.
+//! The expression DAG is traversed without recursion and each shared vertex is differentiated only once per indep
+//! (the time is linear in the number of distinct vertices).
+FMATVEC_EXPORT std::vector<SymbolicExpression> parDer(const std::vector<SymbolicExpression> &dep,
+                                                      const std::vector<IndependentVariable> &indep);
 
 //! Write a SymbolicExpression to a stream using serialization.
 FMATVEC_EXPORT std::ostream& operator<<(std::ostream& s, const SymbolicExpression& se);
@@ -163,6 +207,16 @@ FMATVEC_EXPORT std::istream& operator>>(std::istream& s, SymbolicExpression &se)
 //! Create/initialize a IndependentVariable from a stream using deserialization.
 FMATVEC_EXPORT std::istream& operator>>(std::istream& s, IndependentVariable &v);
 
+//! Write all expressions se to a stream in a compact binary form.
+//! Each distinct vertex of all expressions is written only once (in topological order, referenced by its index):
+//! the size is linear in the number of distinct vertices, even if the serialization using operator<< (which writes
+//! shared subexpressions once per use) is exponential in size (e.g. for derivatives).
+//! Symbols are written by its uuid. Expressions with NativeFunction's cannot be written (a exception is thrown).
+FMATVEC_EXPORT void writeBinary(std::ostream &s, const std::vector<SymbolicExpression> &se);
+//! Read expressions written by writeBinary from a stream (exactly the bytes written by writeBinary are read).
+//! The shared vertices are rebuilt only once: the result is a DAG equal to the written one.
+FMATVEC_EXPORT std::vector<SymbolicExpression> readBinary(std::istream &s);
+
 // function operations overloaded for SymbolicExpression
 FMATVEC_EXPORT SymbolicExpression pow(const SymbolicExpression &a, const SymbolicExpression &b);
 FMATVEC_EXPORT SymbolicExpression log(const SymbolicExpression &a);
@@ -218,6 +272,63 @@ struct FMATVEC_EXPORT ByteCode {
   double  retValue; // storage of the return value of the operation: retPtr may point to this value
   double* retPtr; // a pointer to which the operation can write its result to
   Arg argsPtr; // pointers from which the operation reads its arguments
+  size_t jump { 0 }; // if not 0 this entry is a conditional jump: the next jump entries are skipped if retValue!=0
+};
+
+/* ***** Class for the lazy evaluation of the branches of a Condition in the ByteCode *****
+ * The vertices which are only used by one branch of a Condition are emitted (by Operation::dumpByteCode) after a
+ * conditional jump which skips these entries if the branch is not selected.
+ * A vertex is only used by a branch if all its uses (by other vertices or as output) are from vertices of the branch.
+ * Hence, all uses of all outputs must be added before the ByteCode is emitted.
+ * A ByteCode with jumps must be executed by a loop which handles ByteCode::jump (see Eval::callByteCode).
+*/
+class FMATVEC_EXPORT ByteCodeBranches {
+  public:
+    //! Add the uses of all vertices of the output expression expr.
+    void addOutput(const SymbolicExpression &expr);
+    //! Get the vertices of branch which are only used by branch (given that branch itself is used only once).
+    //! shared is set to the vertices which are not only used by branch but used by a vertex in exclusive.
+    void getBranchVertices(const SymbolicExpression &branch, std::unordered_set<const Vertex*> &exclusive,
+                           std::vector<const Vertex*> &shared) const;
+    //! Add the region [begin, end) of byteCode entries which are skipped by a conditional jump.
+    void addRegion(size_t begin, size_t end) { region.emplace_back(begin, end); }
+    //! Return true if the byteCode entry i is part of any region.
+    bool isInRegion(size_t i) const;
+  private:
+    // return the i-th child of v (the arguments of a NativeFunction) or nullptr if v has no more childs
+    static const Vertex* getChild(const Vertex *v, size_t i);
+    std::unordered_map<const Vertex*, size_t> uses; // the number of uses of each vertex
+    std::vector<std::pair<size_t, size_t>> region;
+};
+
+/* ***** Class for the execution of a part of a ByteCode sequence *****
+ * Only the entries needed to compute the given entries (the backward slice) are executed, in the original order.
+ * Conditional jumps (see ByteCodeBranches) are kept if they skip any needed entry (the jump distance is adapted).
+*/
+class FMATVEC_EXPORT ByteCodeSlice {
+  public:
+    //! Create the slice of byteCode needed to compute the entries entry (indices in byteCode).
+    //! byteCode must not be changed or moved while this object exists.
+    ByteCodeSlice(const std::vector<ByteCode> &byteCode, const std::vector<size_t> &entry);
+    //! Execute all entries of the slice.
+    void operator()() const;
+    //! Return the number of entries of the slice.
+    size_t size() const { return slice.size(); }
+  private:
+    std::vector<std::pair<const ByteCode*, size_t>> slice; // the entries and its jump distance in the slice
+};
+
+/* ***** Struct for a compact "bytecode" instruction *****
+ * This is an alternative to ByteCode, see OpCodeProgram.
+ * Instead of a std::function and raw pointers a OpCode just stores the operation to execute and 32-bit indices
+ * into a contiguous array of double values (the "slots") for its arguments and its return value.
+ * Hence, a OpCode is small, trivially copyable and does not depend on the address of the value array.
+*/
+struct OpCode {
+  using Index = uint32_t;
+  uint16_t code; // the operation to execute: a Operation::Operator or a OpCodeProgram::Code
+  Index ret; // the slot to which the result is written
+  std::array<Index, 3> arg; // the slots from which the arguments are read
 };
 
 template<class Func, class ArgS>
@@ -276,6 +387,114 @@ struct SymbolicFuncWrapArg2<double(Vector<Type1,double>,Vector<Type2,double>), V
     const Vector<Type1, SymbolicExpression> &arg1, const Vector<Type2, SymbolicExpression> &arg2);
 };
 
+// ***** InternTable *****
+
+/* A hashed, sharded and thread-safe table for interning (hash-consing) the vertices of the AST.
+ * Each vertex type holds such a table to ensure that equal vertices exist only once. A lookup is O(1) on average.
+ * The table is split into shards, each guarded by its own mutex, such that several threads can create
+ * expressions at the same time. The hash of each key is computed once and stored with the key.
+ * The values are weak_ptr's: expired entries are reused on insertion of the same key or removed by garbageCollect.
+ * Expired entries are also removed incrementally: on each insertion of a new key a few buckets of the shard
+ * are swept. Hence, the size of the table stays proportional to the number of live values without a full scan.
+*/
+template<class Key, class Value, class Hash=std::hash<Key>>
+class InternTable {
+  public:
+    //! Return the value of key if it exists and is not expired.
+    //! Else create a new value using create() and store it. create is called with the shard mutex locked.
+    template<class Create>
+    std::shared_ptr<const Value> getOrCreate(const Key &key, const Create &create);
+    //! Return the value of key if it exists and is not expired (else nullptr). Nothing is created.
+    std::shared_ptr<const Value> find(const Key &key);
+    //! Remove all expired entries.
+    void garbageCollect();
+    //! Add the statistics of this table to stat.
+    void addStatistics(SymbolicExpression::CacheStatistics &stat);
+  private:
+    static constexpr size_t nrShards { 64 };
+    static constexpr size_t nrSweepBuckets { 2 }; // the number of buckets swept on each insertion of a new key
+    struct HashedKey {
+      size_t hash;
+      Key key;
+      bool operator==(const HashedKey &r) const { return hash==r.hash && key==r.key; }
+    };
+    struct StoredHash {
+      size_t operator()(const HashedKey &k) const { return k.hash; }
+    };
+    struct Shard {
+      std::mutex mutex;
+      std::unordered_map<HashedKey, std::weak_ptr<const Value>, StoredHash> map;
+      size_t nextSweepBucket { 0 };
+      size_t collected { 0 };
+      void sweep(); // remove the expired entries of the next nrSweepBuckets buckets (the mutex must be locked)
+    };
+    std::array<Shard, nrShards> shard;
+};
+
+template<class Key, class Value, class Hash>
+template<class Create>
+std::shared_ptr<const Value> InternTable<Key, Value, Hash>::getOrCreate(const Key &key, const Create &create) {
+  HashedKey hk{Hash()(key), key};
+  // use the high bits for the shard since the low bits are used by the map of the shard
+  auto &s=shard[(hk.hash>>(sizeof(size_t)*8-8))%nrShards];
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto [it, inserted]=s.map.try_emplace(hk);
+  auto oldPtr=it->second.lock();
+  if(oldPtr)
+    return oldPtr;
+  std::shared_ptr<const Value> newPtr=create();
+  it->second=newPtr;
+  if(inserted)
+    s.sweep();
+  return newPtr;
+}
+
+template<class Key, class Value, class Hash>
+std::shared_ptr<const Value> InternTable<Key, Value, Hash>::find(const Key &key) {
+  HashedKey hk{Hash()(key), key};
+  auto &s=shard[(hk.hash>>(sizeof(size_t)*8-8))%nrShards];
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto it=s.map.find(hk);
+  return it!=s.map.end() ? it->second.lock() : nullptr;
+}
+
+template<class Key, class Value, class Hash>
+void InternTable<Key, Value, Hash>::Shard::sweep() {
+  auto nrBuckets=map.bucket_count();
+  for(size_t i=0; i<nrSweepBuckets; ++i) {
+    auto b=(nextSweepBucket++)%nrBuckets;
+    // entries cannot be erased using a bucket iterator: find the first expired entry of the bucket, erase it by key
+    // and repeat (buckets hold only about one entry on average)
+    while(true) {
+      auto it=std::find_if(map.begin(b), map.end(b), [](const auto &x) { return x.second.expired(); });
+      if(it==map.end(b))
+        break;
+      auto key=it->first;
+      map.erase(key);
+      ++collected;
+    }
+  }
+}
+
+template<class Key, class Value, class Hash>
+void InternTable<Key, Value, Hash>::garbageCollect() {
+  for(auto &s : shard) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for(auto it=s.map.begin(); it!=s.map.end(); )
+      if(it->second.expired()) it=s.map.erase(it); else ++it;
+  }
+}
+
+template<class Key, class Value, class Hash>
+void InternTable<Key, Value, Hash>::addStatistics(SymbolicExpression::CacheStatistics &stat) {
+  for(auto &s : shard) {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for(auto &x : s.map)
+      (x.second.expired() ? stat.expired : stat.live)++;
+    stat.collected+=s.collected;
+  }
+}
+
 // ***** Vertex *****
 
 //! A abstract class for a Vertex of the AST (abstract syntax tree).
@@ -284,6 +503,11 @@ class FMATVEC_EXPORT Vertex {
   friend NativeFunction;
   public:
 
+    //! The kind of a vertex (the type of a vertex can be tested by this tag without a dynamic_cast).
+    enum class Kind : uint8_t { ConstantLong, ConstantDouble, Symbol, Operation, NativeFunction };
+    //! Return the kind of this vertex.
+    Kind getKind() const { return kind; }
+
     //! Generate a new AST being the partial derivate of this AST with respect to the variable x.
     virtual SymbolicExpression parDer(const IndependentVariable &x) const=0;
     //! Rreturn true if this Vertex is a constant integer.
@@ -296,12 +520,17 @@ class FMATVEC_EXPORT Vertex {
     bool isOne() const;
 
     virtual std::vector<ByteCode>::iterator dumpByteCode(std::vector<ByteCode> &byteCode,
-                                          std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex) const=0;
+                                          std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex,
+                                          ByteCodeBranches *branches=nullptr) const=0;
 
     virtual void walkVertex(const std::function<void(const std::shared_ptr<const Vertex>&)> &func) const=0;
 
+    virtual OpCode::Index dumpOpCode(OpCodeProgram &prog, std::map<const Vertex*, OpCode::Index> &existingVertex) const=0;
+
   protected:
 
+    Vertex(Kind kind_) : kind(kind_) {}
+
     // helper function to make it easy to implement new expression optimizations. See ast.cc Operation::create for details.
     // Returns true if this Vertex the Vertex (SymbolicExpression) b. Every Symbol variables in this Vertex are free. This
     // means that true is also returned if the Symbols in this Vertex can be replaced by anything such that the expressions
@@ -320,6 +549,8 @@ class FMATVEC_EXPORT Vertex {
     };
     using MapIVSE = std::map<IndependentVariable, SymbolicExpression, LessIV>;
     virtual bool equal(const SymbolicExpression &b, MapIVSE &m) const=0;
+  private:
+    const Kind kind;
 };
 
 inline bool Vertex::isConstantInt() const {
@@ -332,6 +563,7 @@ inline bool Vertex::isConstantInt() const {
 template<class T>
 class FMATVEC_EXPORT Constant : public Vertex, public std::enable_shared_from_this<Constant<T>> {
   friend SymbolicExpression;
+  friend ByteCodeBuilder;
   public:
 
     static SymbolicExpression create(const T& c_);
@@ -340,17 +572,22 @@ class FMATVEC_EXPORT Constant : public Vertex, public std::enable_shared_from_th
     //! Get the constant value of the vertex.
     inline const T& getValue() const;
     std::vector<ByteCode>::iterator dumpByteCode(std::vector<ByteCode> &byteCode,
-                                  std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex) const override;
+                                  std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex,
+                                  ByteCodeBranches *branches=nullptr) const override;
 
     void walkVertex(const std::function<void(const std::shared_ptr<const Vertex>&)> &func) const override;
 
+    OpCode::Index dumpOpCode(OpCodeProgram &prog, std::map<const Vertex*, OpCode::Index> &existingVertex) const override;
+
   private:
 
     Constant(const T& c_);
     const T c;
     bool equal(const SymbolicExpression &b, MapIVSE &m) const override;
+    // append the bytecode entry of this constant
+    std::vector<ByteCode>::iterator emitByteCode(std::vector<ByteCode> &byteCode) const;
     using CacheKey = T;
-    static std::map<CacheKey, std::weak_ptr<const Constant>> cache;
+    static InternTable<CacheKey, Constant> cache;
 };
 
 template<>
@@ -374,6 +611,7 @@ const T& Constant<T>::getValue() const {
 class FMATVEC_EXPORT Symbol : public Vertex, public std::enable_shared_from_this<Symbol> {
   friend SymbolicExpression;
   friend IndependentVariable;
+  friend ByteCodeBuilder;
   public:
 
     static IndependentVariable create(const boost::uuids::uuid& uuid_=boost::uuids::random_generator()());
@@ -381,26 +619,42 @@ class FMATVEC_EXPORT Symbol : public Vertex, public std::enable_shared_from_this
     //! Set the value of this independent variable.
     //! This has an influence on the evaluation of all ASTs which depend on this independent variable.
     inline void setValue(double x_) const;
+    //! Get the current value of this independent variable.
+    inline double getValue() const;
+    //! Get the version of the value of this independent variable: incremented by each call of setValue.
+    uint64_t getVersion() const { return version; }
 
     std::string getUUIDStr() const;
+    const boost::uuids::uuid& getUUID() const { return uuid; }
 
     std::vector<ByteCode>::iterator dumpByteCode(std::vector<ByteCode> &byteCode,
-                                  std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex) const override;
+                                  std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex,
+                                  ByteCodeBranches *branches=nullptr) const override;
 
     void walkVertex(const std::function<void(const std::shared_ptr<const Vertex>&)> &func) const override;
 
+    OpCode::Index dumpOpCode(OpCodeProgram &prog, std::map<const Vertex*, OpCode::Index> &existingVertex) const override;
+
   private:
 
     Symbol(const boost::uuids::uuid& uuid_);
     bool equal(const SymbolicExpression &b, MapIVSE &m) const override;
+    // append the bytecode entry copying the value of this symbol
+    std::vector<ByteCode>::iterator emitByteCode(std::vector<ByteCode> &byteCode) const;
     mutable double x = 0.0;
+    mutable uint64_t version = 0;
     boost::uuids::uuid uuid; // each variable has a uuid (this is only used when the AST is serialized and for caching)
     using CacheKey = boost::uuids::uuid;
-    static std::map<CacheKey, std::weak_ptr<const Symbol>> cache;
+    static InternTable<CacheKey, Symbol, boost::hash<CacheKey>> cache;
 };
 
 void Symbol::setValue(double x_) const {
   x=x_;
+  ++version;
+}
+
+double Symbol::getValue() const {
+  return x;
 }
 
 // ***** ScalarFunctionWrapArg *****
@@ -639,6 +893,9 @@ class ScalarFunctionWrapArgVV : public ScalarFunctionWrapArg {
 
 //! A vertex of the AST representing an arbitary function.
 class FMATVEC_EXPORT NativeFunction : public Vertex, public std::enable_shared_from_this<NativeFunction> {
+  friend SymbolicExpression;
+  friend ByteCodeBranches;
+  friend ExpressionOptimizer;
   public:
     static SymbolicExpression create(const std::shared_ptr<ScalarFunctionWrapArg> &funcWrapper,
                                      const std::vector<SymbolicExpression> &argS,
@@ -648,10 +905,13 @@ class FMATVEC_EXPORT NativeFunction : public Vertex, public std::enable_shared_f
 
     std::vector<ByteCode>::iterator dumpByteCode(std::vector<ByteCode> &byteCode,
                                                  std::map<const Vertex*,
-                                                 std::vector<AST::ByteCode>::iterator> &existingVertex) const override;
+                                                 std::vector<AST::ByteCode>::iterator> &existingVertex,
+                                                 ByteCodeBranches *branches=nullptr) const override;
 
     void walkVertex(const std::function<void(const std::shared_ptr<const Vertex>&)> &func) const override;
 
+    OpCode::Index dumpOpCode(OpCodeProgram &prog, std::map<const Vertex*, OpCode::Index> &existingVertex) const override;
+
   private:
     NativeFunction(const std::shared_ptr<ScalarFunctionWrapArg> &func_,
                    const std::vector<SymbolicExpression> &argS,
@@ -664,17 +924,15 @@ class FMATVEC_EXPORT NativeFunction : public Vertex, public std::enable_shared_f
     const std::vector<SymbolicExpression> dir1S;
     const std::vector<SymbolicExpression> dir2S;
     
-    using CacheKey = std::tuple<std::weak_ptr<ScalarFunctionWrapArg>,
-                     std::vector<std::weak_ptr<const Vertex>>,
-                     std::vector<std::weak_ptr<const Vertex>>,
-                     std::vector<std::weak_ptr<const Vertex>> >;
-    struct CacheKeyComp {
-      bool operator()(const CacheKey& l, const CacheKey& r) const;
-      private:
-        std::owner_less<std::weak_ptr<const Vertex>> ol;
-        std::owner_less<std::weak_ptr<const ScalarFunctionWrapArg>> olf;
+    // raw pointers can be used as key since a (not expired) NativeFunction holds all its function and arguments
+    using CacheKey = std::tuple<const ScalarFunctionWrapArg*,
+                     std::vector<const Vertex*>,
+                     std::vector<const Vertex*>,
+                     std::vector<const Vertex*> >;
+    struct CacheKeyHash {
+      size_t operator()(const CacheKey& k) const;
     };
-    static std::map<CacheKey, std::weak_ptr<const NativeFunction>, CacheKeyComp> cache;
+    static InternTable<CacheKey, NativeFunction, CacheKeyHash> cache;
 };
 
 // ***** Operation *****
@@ -682,8 +940,16 @@ class FMATVEC_EXPORT NativeFunction : public Vertex, public std::enable_shared_f
 //! A vertex of the AST representing an operation.
 class FMATVEC_EXPORT Operation : public Vertex, public std::enable_shared_from_this<Operation> {
   friend SymbolicExpression;
+  friend ByteCodeBuilder;
+  friend ExpressionArena;
+  friend ExpressionOptimizer;
   friend SymbolicExpression fmatvec::AST::substScalar(const SymbolicExpression &se,
                                                       const IndependentVariable& a, const SymbolicExpression &b);
+  friend std::vector<SymbolicExpression> fmatvec::AST::substScalar(const std::vector<SymbolicExpression> &se,
+                                                                   const std::vector<IndependentVariable> &a,
+                                                                   const std::vector<SymbolicExpression> &b);
+  friend std::vector<SymbolicExpression> fmatvec::parDer(const std::vector<SymbolicExpression> &dep,
+                                                         const std::vector<IndependentVariable> &indep);
   friend boost::spirit::qi::rule<boost::spirit::istream_iterator, SymbolicExpression()>&
     fmatvec::getBoostSpiritQiRule<SymbolicExpression>();
   friend boost::spirit::karma::rule<std::ostream_iterator<char>, SymbolicExpression()>&
@@ -693,28 +959,50 @@ class FMATVEC_EXPORT Operation : public Vertex, public std::enable_shared_from_t
     //! Defined operations.
     enum Operator { Plus, Minus, Mult, Div, Pow, Log, Sqrt, Neg, Sin, Cos, Tan, Sinh, Cosh, Tanh, ASin, ACos, ATan, ATan2, ASinh, ACosh, ATanh, Exp, Sign, Heaviside, Abs, Min, Max, Condition };
     static SymbolicExpression create(Operator op_, const std::vector<SymbolicExpression> &child_);
+    //! Return the number of childs of the operator op_.
+    static size_t getNrChilds(Operator op_);
     SymbolicExpression parDer(const IndependentVariable &x) const override;
 
     Operator getOp() const { return op; }
     const std::vector<SymbolicExpression>& getChilds() const { return child; }
     std::vector<ByteCode>::iterator dumpByteCode(std::vector<ByteCode> &byteCode,
-                                  std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex) const override;
+                                  std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex,
+                                  ByteCodeBranches *branches=nullptr) const override;
 
     void walkVertex(const std::function<void(const std::shared_ptr<const Vertex>&)> &func) const override;
 
+    OpCode::Index dumpOpCode(OpCodeProgram &prog, std::map<const Vertex*, OpCode::Index> &existingVertex) const override;
+
   private:
 
     Operation(Operator op_, const std::vector<SymbolicExpression> &child_);
     bool equal(const SymbolicExpression &b, MapIVSE &m) const override;
+    // dump the branch i of a Condition lazily (see ByteCodeBranches); returns false if nothing can be skipped
+    bool dumpBranch(size_t i, std::vector<ByteCode> &byteCode,
+                    std::map<const Vertex*, std::vector<AST::ByteCode>::iterator> &existingVertex,
+                    ByteCodeBranches &branches, std::vector<std::vector<ByteCode>::iterator> &childItVec) const;
+    // append the bytecode entry of this operation reading the results of the entries childIt (one for each child).
+    // other is the existing entry of the sin/cos of the same argument (see getSinCosPartner) or nullptr.
+    std::vector<ByteCode>::iterator emitByteCode(std::vector<ByteCode> &byteCode,
+                                                 const std::vector<ByteCode>::iterator *childIt,
+                                                 const std::vector<ByteCode>::iterator *other) const;
+    // return the cos of the same argument for a sin (and vice versa) if it exists, else a null expression
+    SymbolicExpression getSinCosPartner() const;
+    // return the partial derivative of this operation given the partial derivatives childDer of all its childs
+    SymbolicExpression parDer(const std::vector<SymbolicExpression> &childDer) const;
+    // return all vertices of se in topological order (childs before its parents, each vertex only once; only the
+    // childs of operations are walked). index is set to the position of each vertex in the returned vector.
+    // A explicit stack is used: deep expressions do not overflow the call stack.
+    static std::vector<SymbolicExpression> getTopologicalOrder(const std::vector<SymbolicExpression> &se,
+                                                               std::unordered_map<const Vertex*, size_t> &index);
     Operator op;
     std::vector<SymbolicExpression> child;
-    using CacheKey = std::pair<Operator, std::vector<std::weak_ptr<const Vertex>>>;
-    struct CacheKeyComp {
-      bool operator()(const CacheKey& l, const CacheKey& r) const;
-      private:
-        std::owner_less<std::weak_ptr<const Vertex>> ol;
+    // raw pointers can be used as key since a (not expired) Operation holds all its childs (unused childs are nullptr)
+    using CacheKey = std::pair<Operator, std::array<const Vertex*, 3>>;
+    struct CacheKeyHash {
+      size_t operator()(const CacheKey& k) const;
     };
-    static std::map<CacheKey, std::weak_ptr<const Operation>, CacheKeyComp> cache;
+    static InternTable<CacheKey, Operation, CacheKeyHash> cache;
 
     struct OpMap {
       std::string funcName; // used to dump/read the expression using boost spirit/karma: e.g.
@@ -725,6 +1013,446 @@ class FMATVEC_EXPORT Operation : public Vertex, public std::enable_shared_from_t
     static const std::map<Operator, OpMap> opMap;
 };
 
+// ***** OpCodeProgram *****
+
+/* A program of OpCode's for fast runtime evaluation of symbolic expressions.
+ * All values (constants, values of symbols, intermediate and return values) are stored in slots of a value array
+ * which is not part of this class. The program only stores the index of the slots. Hence, the same program can be
+ * evaluated on different value arrays and the layout of the value array is up to the evaluator, see e.g. evalBatch.
+ * The program is build by calling addOutput for each expression to evaluate. Slots of constants and symbols
+ * are never written by the instructions: the evaluator must initialize the constant slots once and must copy
+ * the values of the symbols to its slots before each evaluation.
+*/
+class FMATVEC_EXPORT OpCodeProgram {
+  public:
+    using Index = OpCode::Index;
+    //! Additional op codes (besides the ones of Operation::Operator) which are only used internally.
+    enum Code : uint16_t {
+      PowInt = Operation::Condition+1, // pow with a integer exponent
+      PowHalf,                         // pow with the exponent 0.5 (evaluated using sqrt)
+      Native,                          // call of a NativeFunction: arg[0] is the index in native
+    };
+    //! PowInt is evaluated as a chain of multiplications for exponents up to this absolute value (else using pow).
+    static constexpr int maxPowIntChain { 16 };
+    //! The data for a call of a NativeFunction (the arguments of a NativeFunction are not limited in size)
+    struct NativeCall {
+      std::shared_ptr<ScalarFunctionWrapArg> func;
+      int order; // 0 = function value; 1 = first directional derivative; 2 = second directional derivative
+      std::vector<Index> arg;
+      //! Call the function (of order order) with the arguments arg.
+      double operator()(const ByteCode::Arg &arg) const;
+    };
+
+    //! Add the instructions for se (if not already existing) and add its slot to the outputs.
+    void addOutput(const SymbolicExpression &se, std::map<const Vertex*, Index> &existingVertex);
+    //! Allocate a new slot.
+    Index newSlot() { return nrSlots++; }
+    //! Return the slot of the constant c (a new constant slot is added if c does not exist).
+    Index addConstant(double c);
+    //! Add the instruction code with the arguments a, b, c and return its newly allocated result slot.
+    Index addCode(uint16_t code, Index a, Index b=0, Index c=0);
+    //! Add the instructions for the partial derivatives of all dep wrt all indep using the adjoint (reverse) mode.
+    //! dep is evaluated once and, for each dep, a reverse sweep over its instructions propagates the adjoints to indep.
+    //! dep.size()*indep.size() outputs are added: the derivative of dep[i] wrt indep[j] is output i*indep.size()+j
+    //! (relative to the number of outputs before this call).
+    void addAdjoint(const std::vector<SymbolicExpression> &dep, const std::vector<IndependentVariable> &indep,
+                    std::map<const Vertex*, Index> &existingVertex);
+    //! Add the instructions for the structurally nonzero partial derivatives of dep wrt indep (a sparse Jacobian).
+    //! Only the entries which are not structurally zero are added as outputs, in compressed row storage order:
+    //! the outputs I[r] to I[r+1]-1 (relative to the number of outputs before this call) are the entries of row r,
+    //! J holds the column of each of these entries. If diagonalFirst is true (for a square Jacobian) the diagonal
+    //! entry of each row is always stored (even if zero) as the first entry of the row, like Matrix<Sparse,...>.
+    void addSparseParDer(const std::vector<SymbolicExpression> &dep, const std::vector<IndependentVariable> &indep,
+                         std::map<const Vertex*, Index> &existingVertex, std::vector<int> &I, std::vector<int> &J,
+                         bool diagonalFirst);
+    //! Reuse the slots of intermediate values which are no longer needed (register allocation).
+    //! After this call the number of slots is the maximal number of simultaneously live intermediate values plus
+    //! the slots of constants, symbols and outputs. All slots of constants and symbols are renumbered to the first
+    //! slots. Returns the number of slots before the call.
+    Index reuseSlots();
+    //! Call func(Index&) for each slot read by the instruction oc (oc must be a instruction of this program).
+    template<class Func> void forEachArg(const OpCode &oc, const Func &func) const { forEachArgImpl(*this, oc, func); }
+    template<class Func> void forEachArg(      OpCode &oc, const Func &func)       { forEachArgImpl(*this, oc, func); }
+    //! For each entry in symbol return the index in indep or -1 if the symbol is not part of indep.
+    std::vector<int> getInputIndex(const std::vector<IndependentVariable> &indep) const;
+
+    //! Initialize the constant slots of value (which holds lanes values per slot, see evalBatch).
+    void initConstants(double *value, size_t lanes=1) const;
+
+    //! Evaluate the program. value must hold nrSlots doubles: the value of slot s is stored at value[s].
+    void eval(double *value) const;
+    //! Evaluate only the instructions instr (e.g. a slice of code, see getSlice).
+    void eval(double *value, const std::vector<OpCode> &instr) const;
+    //! Return the instructions of code needed to compute the slots outputSlot (the backward slice, in order).
+    std::vector<OpCode> getSlice(const std::vector<Index> &outputSlot) const;
+    //! Evaluate the program for n points at once (n<=lanes).
+    //! value must hold nrSlots*lanes doubles: the value of slot s at point l is stored at value[s*lanes+l].
+    void evalBatch(double *value, size_t lanes, size_t n) const;
+    //! Evaluate the program in forward mode: the value and the directional derivatives of each slot are propagated in
+    //! a single sweep (dual numbers for order 1, hyper-dual numbers for order 2). No new instructions are created.
+    //! value must hold nrSlots*forwardStride(order) doubles. For slot s at offset o=s*forwardStride(order):
+    //! value[o] is the value and value[o+1] the derivative in direction 1; for order 2 value[o+2] is the derivative in
+    //! direction 2 and value[o+3] the second derivative in direction 1 and 2.
+    //! The derivatives of the constant slots must be zero, the derivatives of the symbol slots are the directions.
+    void evalForward(double *value, int order) const;
+    //! The number of doubles per slot used by evalForward.
+    static constexpr size_t forwardStride(int order) { return order==1 ? 2 : 4; }
+
+    std::vector<OpCode> code; // the instructions
+    Index nrSlots { 0 }; // the number of slots
+    std::vector<std::pair<Index, double>> constant; // the slots of all constants and its value
+    std::vector<std::pair<std::shared_ptr<const Symbol>, Index>> symbol; // the slots of all symbols
+    std::vector<NativeCall> native; // the data of all NativeFunction calls
+    std::vector<Index> output; // the slots of all outputs (in the order of the calls to addOutput)
+
+  private:
+    template<class Prog, class OC, class Func>
+    static void forEachArgImpl(Prog &prog, OC &oc, const Func &func);
+};
+
+// ***** JITProgram *****
+
+/* A OpCodeProgram compiled to native machine code (just-in-time compilation).
+ * C source code is generated for the program and compiled with the C compiler of the system into a shared library
+ * which is loaded using dlopen. The compiled library is cached on disk using a structural hash of the program as key.
+ * Hence, the compiler is only called once for the same expression, even over several process runs.
+ * The compiler can be set with the envvar FMATVEC_JIT_CC (default "cc"). The cache directory can be set with the envvar
+ * FMATVEC_JIT_CACHE_DIR (default $XDG_CACHE_HOME/fmatvec/jit or $HOME/.cache/fmatvec/jit). The cache is only used if
+ * this directory is owned by the current user and not writable by others (a new directory is created with mode 0700).
+ * Else, or if none of these envvars is set, the program is compiled in a private temporary directory without caching.
+ * NativeFunction's cannot be compiled: these are called back from the compiled code.
+ * This is not available on Windows (the ctor throws).
+*/
+class FMATVEC_EXPORT JITProgram {
+  public:
+    //! Generate, compile and load the program prog (or load it from the cache).
+    JITProgram(const OpCodeProgram &prog);
+    ~JITProgram();
+    JITProgram(const JITProgram &) = delete;
+    JITProgram& operator=(const JITProgram &) = delete;
+    //! Evaluate the program.
+    //! in must hold the values of all symbols of the program (in the order of OpCodeProgram::symbol).
+    //! out must hold space for all outputs of the program (in the order of OpCodeProgram::output).
+    void operator()(const double *in, double *out) const { func(in, out, &callNative, const_cast<JITProgram*>(this)); }
+    //! Generate the C source code for prog.
+    static std::string generateSource(const OpCodeProgram &prog);
+    //! Returns true if the last ctor call has loaded the compiled program from the cache (no compiler call).
+    bool loadedFromCache() const { return fromCache; }
+  private:
+    using NativeCallback = double(*)(void *ctx, int idx, double **arg);
+    using Func = void(*)(const double *in, double *out, NativeCallback nat, void *ctx);
+    static double callNative(void *ctx, int idx, double **arg);
+    std::vector<OpCodeProgram::NativeCall> native;
+    void *handle { nullptr };
+    Func func { nullptr };
+    bool fromCache { false };
+};
+
+// The hash of str as hex string: FNV-1a 64bit (stable over all platforms and runs; used as key of the on-disk caches)
+std::string hashString(const std::string &str);
+
+// Return true if path is a directory (dir=true) or a regular file (dir=false) owned by the current user and not writable
+// by others (for a file a symlink is not followed; used to trust the content of the on-disk caches).
+// On Windows only the type of path is checked.
+bool isPrivate(const std::string &path, bool dir);
+
+// ***** ExpressionCache *****
+
+/* A persistent on-disk cache of expressions derived from other expressions (e.g. partial derivatives).
+ * The derivation of large expressions (and its simplification) can be expensive. This cache stores the derived
+ * expressions of a input in a compact binary form (a list of vertices in topological order) and loads these on the next
+ * call (even in another process) instead of deriving them again.
+ * The key is a structural hash of the input expressions: all symbols are numbered by its position in the list of
+ * independent variables or by its first occurrence in the input. Hence, the cache is also used for the same expressions
+ * in another process even if the symbols (its UUIDs) differ.
+ * A cache file is memory-mapped (on POSIX systems) and decoded directly into the vertices.
+ * Inputs with NativeFunction's cannot be cached (these cannot be stored): derive is just called for such inputs.
+ * The cache is disabled by default. It is enabled by setting the cache directory using setDirectory or the envvar
+ * FMATVEC_EXPR_CACHE_DIR.
+ * The cache directory is only used if it is private (see isPrivate; a new directory is created with mode 0700): else
+ * another user could store wrong expressions for a key. A directory which is not private is handled as a disabled cache.
+*/
+class FMATVEC_EXPORT ExpressionCache {
+  public:
+    //! The data stored in the cache.
+    struct Entry {
+      std::vector<SymbolicExpression> expr; //!< all scalar expressions
+      std::vector<int> dim; //!< caller defined integers (e.g. the dimensions of the vectors/matrices stored in expr)
+    };
+    //! Return the entry derived by derive from input or load the entry from the cache.
+    //! tag must distinguish different derive functions for the same input.
+    //! indep must contain all independent variables used by derive. All symbols in the derived expressions must be
+    //! contained in input or indep.
+    static Entry get(const std::string &tag, const std::vector<SymbolicExpression> &input,
+                     const std::vector<IndependentVariable> &indep, const std::function<Entry()> &derive);
+
+    //! Set the cache directory (an empty string disables the cache). The default is the envvar FMATVEC_EXPR_CACHE_DIR.
+    static void setDirectory(const std::string &dir);
+    static std::string getDirectory();
+
+    //! The number of cache hits and misses of this process (misses include entries which cannot be cached).
+    struct Statistics {
+      size_t hits { 0 };
+      size_t misses { 0 };
+    };
+    static Statistics getStatistics();
+  private:
+    class Encoder;
+    class Decoder;
+    friend void fmatvec::writeBinary(std::ostream &s, const std::vector<SymbolicExpression> &se);
+    friend std::vector<SymbolicExpression> fmatvec::readBinary(std::istream &s);
+};
+
+// ***** ExpressionOptimizer *****
+
+/* A optional global optimization of finished expressions (e.g. large derivatives) using equality saturation.
+ * Operation::create applies only local rewrite rules while a expression is built. This class inserts all expressions
+ * into a e-graph (classes of equivalent expressions) and applies rewrite rules to it: the rules of Operation::create,
+ * commutativity, associativity, distribution and factoring, and constant folding. Each rule adds the rewritten form
+ * to the class of the matched expression, hence no form is lost. After the last iteration the cheapest form of each
+ * class is extracted (using a cost per operation, see getCost). If the extracted expressions are not cheaper than the
+ * input the input is returned.
+ * The optimized expressions are mathematically equal to the input but can have different rounding.
+ * NativeFunction's (and its arguments) are not optimized.
+*/
+class FMATVEC_EXPORT ExpressionOptimizer {
+  public:
+    //! Limits of the optimization.
+    struct Options {
+      Options() : maxIterations(10), maxNodes(20000) {} // no default member initializers: used as default argument
+      size_t maxIterations; //!< the maximal number of rewrite iterations
+      size_t maxNodes; //!< stop the rewrite iterations if the e-graph has more nodes
+    };
+    //! Statistics of a optimization.
+    struct Statistics {
+      size_t opsBefore { 0 }; //!< the number of operations of the input (each shared operation counts once)
+      size_t opsAfter { 0 }; //!< the number of operations of the output
+      double costBefore { 0 }; //!< the cost of the input
+      double costAfter { 0 }; //!< the cost of the output
+      size_t iterations { 0 }; //!< the number of rewrite iterations done
+      size_t nodes { 0 }; //!< the number of nodes in the final e-graph
+      bool saturated { false }; //!< true if no rule has changed the e-graph in the last iteration
+    };
+    //! Return the optimized form of all expr (shared subexpressions of all expr are optimized together).
+    static std::vector<SymbolicExpression> optimize(const std::vector<SymbolicExpression> &expr,
+                                                    Statistics *stat=nullptr, const Options &options=Options());
+    //! Return the optimized form of a scalar, vector or matrix expression (defined in symbolic.h).
+    template<class T>
+    static T optimize(const T &expr, Statistics *stat=nullptr, const Options &options=Options());
+
+    //! Return the number of operations of all expr (each shared operation counts once).
+    static size_t countOperations(const std::vector<SymbolicExpression> &expr);
+    //! Return the cost of all expr: the sum of the cost of all operations (each shared operation counts once).
+    //! A addition, subtraction, negation or multiplication costs 1, a division 4, a integer power 2, any other
+    //! operation 8 and a NativeFunction 20.
+    static double getCost(const std::vector<SymbolicExpression> &expr);
+  private:
+    class EGraph;
+    // return all operations and NativeFunction's of expr (each shared vertex once, childs before its parents)
+    static std::vector<const Vertex*> getOperations(const std::vector<SymbolicExpression> &expr);
+};
+
+// ***** ExpressionArena *****
+
+/* A compact storage of expressions for building very large models.
+ * Each vertex is a Node of 16 bytes stored in a contiguous vector: its childs are 32-bit indices of other nodes (no
+ * shared_ptr, no reference counting, no std::vector of childs and no interning per vertex). Constants are stored in
+ * separate tables and each symbol is stored only once.
+ * A node can only refer to nodes added before, hence the nodes are always in topological order and all traversals are
+ * simple loops over the node vector.
+ * The arena is converted to and from SymbolicExpression at the edges: import adds existing expressions (shared
+ * subexpressions of one call of import are shared in the arena as well) and toSymbolicExpression creates the
+ * expressions of some nodes using Operation::create (hence all simplifications of Operation::create are applied on
+ * export; the arena itself does not simplify anything).
+ * NativeFunction's cannot be stored in a arena.
+*/
+class FMATVEC_EXPORT ExpressionArena {
+  public:
+    //! The index of a node.
+    using Index = uint32_t;
+    //! A vertex of the arena.
+    struct Node {
+      Vertex::Kind kind; //!< ConstantLong, ConstantDouble, Symbol or Operation
+      uint8_t op; //!< the Operation::Operator of a operation
+      uint8_t nrChilds; //!< the number of childs of a operation
+      Index arg[3]; //!< the childs of a operation or the index in the constant/symbol table of a constant/symbol
+    };
+
+    //! Create a empty arena with a preallocated storage for nrNodes nodes.
+    ExpressionArena(size_t nrNodes=0);
+
+    //! Add a constant.
+    Index constant(int c) { return constant(static_cast<long>(c)); }
+    Index constant(long c);
+    Index constant(double c);
+    //! Add the independent variable x (each variable is stored only once: the same index is returned for the same x).
+    Index symbol(const IndependentVariable &x);
+    //! Add the operation op with the childs child (the number of childs must match op).
+    Index operation(Operation::Operator op, std::initializer_list<Index> child);
+
+    //! Add the expressions se and return the index of each expression.
+    std::vector<Index> import(const std::vector<SymbolicExpression> &se);
+    Index import(const SymbolicExpression &se) { return import(std::vector<SymbolicExpression>{se})[0]; }
+    //! Return the expressions of the nodes root (all subexpressions used by several roots are shared).
+    std::vector<SymbolicExpression> toSymbolicExpression(const std::vector<Index> &root) const;
+    SymbolicExpression toSymbolicExpression(Index root) const { return toSymbolicExpression(std::vector<Index>{root})[0]; }
+
+    //! Return the number of nodes.
+    size_t size() const { return node.size(); }
+    //! Return the node i.
+    const Node& operator[](Index i) const { return node[i]; }
+    //! Return the value of a constant node i.
+    double getConstant(Index i) const;
+    //! Return the symbol of a symbol node i.
+    const IndependentVariable& getSymbol(Index i) const { return symbolTable[node[i].arg[0]]; }
+    //! Return the (approximate) number of bytes used by this arena (without the symbols itself).
+    size_t getMemoryUsage() const;
+  private:
+    Index add(const Node &n);
+    std::vector<Node> node;
+    std::vector<long> constantLong;
+    std::vector<double> constantDouble;
+    std::vector<IndependentVariable> symbolTable;
+    std::unordered_map<const Vertex*, Index> symbolIndex; // the node of each symbol in symbolTable
+};
+
+// ***** ByteCodeSchedule *****
+
+/* Parallel execution of a ByteCode sequence on several cores.
+ * At construction the ByteCode sequence is partitioned into dependency levels: all entries of a level only depend on
+ * entries of lower levels and are executed in parallel. Consecutive levels with only a few entries are merged into
+ * a serial phase executed by a single thread. The phases are run on a process wide thread pool and are separated by
+ * spinning barriers (no system call between phases).
+ * The caller thread takes part in the execution. If the sequence has less entries than getSerialThreshold(),
+ * if only one thread is available or if the thread pool is already in use (by another thread) the sequence is
+ * executed serially by the caller thread.
+ * Entries marked as serialOnly (NativeFunction's which are not required to be thread-safe) are always executed by
+ * the caller thread.
+*/
+class FMATVEC_EXPORT ByteCodeSchedule {
+  public:
+    //! Create the schedule for byteCode. byteCode must not be changed or moved while this object exists.
+    ByteCodeSchedule(const std::vector<ByteCode> &byteCode_, const std::vector<bool> &serialOnly);
+    //! Execute all entries of the ByteCode sequence.
+    void operator()() const;
+    //! Return the number of dependency levels.
+    size_t getNumberOfLevels() const { return nrLevels; }
+    //! Return the number of phases (parallel levels or serial blocks of levels) separated by barriers.
+    size_t getNumberOfPhases() const { return phase.size(); }
+
+    //! Set the minimal size of a ByteCode sequence to be executed in parallel (default 10000).
+    static void setSerialThreshold(size_t n);
+    static size_t getSerialThreshold();
+    //! Set the number of threads used to execute a sequence, including the caller thread
+    //! (default std::thread::hardware_concurrency()).
+    static void setNumberOfThreads(size_t n);
+    static size_t getNumberOfThreads();
+
+    //! Levels with less entries are not executed in parallel.
+    static constexpr size_t minParallelLevelSize { 64 };
+  private:
+    struct Phase {
+      size_t begin; // the range [begin, end) in order
+      size_t end;
+      size_t nrSerialOnly; // the number of serialOnly entries at the front of the range
+      bool parallel; // false for a serial block of levels
+    };
+    const std::vector<ByteCode> &byteCode;
+    std::vector<const ByteCode*> order; // the ByteCode entries sorted by level
+    std::vector<Phase> phase;
+    size_t nrLevels { 0 };
+    void runPhase(const Phase &p, size_t worker, size_t nrWorkers) const;
+};
+
+// ***** ByteCodeBuilder *****
+
+/* Builds the bytecode of several expressions in a single pass (used by Eval instead of Vertex::dumpByteCode).
+ * The combined DAG of all expressions is sorted topologically by one iterative walk using a open-addressing table of
+ * the visited vertices and the vertex kind tag (no std::function callbacks, std::set/std::map or dynamic_cast).
+ * Afterwards the entries are emitted directly: first all symbols, then all other vertices in topological order (the
+ * entries of all childs exist before the entry of its parent is emitted).
+ * NativeFunction's and (if lazyConditions is true) the lazy branches of a Condition (see ByteCodeBranches) are not
+ * supported: isSupported returns false if the expressions contain such vertices.
+*/
+class FMATVEC_EXPORT ByteCodeBuilder {
+  public:
+    //! Sort the DAG of all expressions in output topologically.
+    ByteCodeBuilder(const std::vector<SymbolicExpression> &output, bool lazyConditions);
+    ~ByteCodeBuilder();
+    //! Return true if all vertices of output can be emitted by this class.
+    bool isSupported() const { return supported; }
+    //! Return the number of entries emitted by emit.
+    size_t size() const { return order.size(); }
+    //! Append the entries of all vertices to byteCode and return the index of the entry of each output.
+    //! The capacity of byteCode must be large enough for all entries (byteCode must not reallocate).
+    std::vector<size_t> emit(std::vector<ByteCode> &byteCode);
+    //! Return each symbol and the index of its entry (valid after emit).
+    const std::vector<std::pair<std::shared_ptr<const Symbol>, size_t>>& getSymbols() const { return symbol; }
+  private:
+    class VertexIndex;
+    std::unique_ptr<VertexIndex> index; // the position in order of each vertex
+    std::vector<const Vertex*> order; // all vertices in topological order
+    std::vector<const Vertex*> outputVertex;
+    std::vector<std::pair<std::shared_ptr<const Symbol>, size_t>> symbol;
+    bool supported { true };
+};
+
+// ***** ByteCodeIncremental *****
+
+/* Incremental execution of a ByteCode sequence: only the entries which depend on a independent variable which has
+ * changed since the last execution are executed.
+ * Each Symbol has a version which is incremented by Symbol::setValue (IndependentVariable::operator^=).
+ * At construction a dependency bitmap over all entries is computed for each symbol. On execution the bitmaps of all
+ * symbols with a changed version are combined and only the marked entries are executed (in the original order).
+ * The first execution runs all entries; entries which do not depend on any symbol are only executed once.
+ * NativeFunction's are treated as pure functions of its arguments.
+ * The sequence must not contain jumps (see ByteCodeBranches).
+*/
+class FMATVEC_EXPORT ByteCodeIncremental {
+  public:
+    //! Create the dependency bitmaps for byteCode. byteCode must not be changed or moved while this object exists.
+    //! symbol holds each symbol used by byteCode and the index of its entry in byteCode.
+    ByteCodeIncremental(const std::vector<ByteCode> &byteCode_,
+                        const std::vector<std::pair<std::shared_ptr<const Symbol>, size_t>> &symbol);
+    //! Execute all entries which depend on a symbol changed since the last call.
+    void operator()() const;
+    //! Return the number of entries executed by the last call.
+    size_t getNumberOfExecuted() const { return nrExecuted; }
+    //! Execute all entries on the next call (needed if the return address of a entry has changed).
+    void reset() { first=true; }
+  private:
+    const std::vector<ByteCode> &byteCode;
+    std::vector<std::shared_ptr<const Symbol>> symbol;
+    std::vector<std::vector<uint64_t>> dependent; // for each symbol the bitmap of all entries depending on it
+    mutable std::vector<uint64_t> lastVersion; // the version of each symbol at the last call
+    mutable std::vector<uint64_t> run; // the bitmap of the entries to execute
+    mutable bool first { true };
+    mutable size_t nrExecuted { 0 };
+};
+
+template<class Prog, class OC, class Func>
+void OpCodeProgram::forEachArgImpl(Prog &prog, OC &oc, const Func &func) {
+  switch(oc.code) {
+    case Operation::Plus: case Operation::Minus: case Operation::Mult: case Operation::Div: case Operation::Pow:
+    case Operation::ATan2: case Operation::Min: case Operation::Max: case PowInt:
+      func(oc.arg[0]);
+      func(oc.arg[1]);
+      break;
+    case Operation::Condition:
+      func(oc.arg[0]);
+      func(oc.arg[1]);
+      func(oc.arg[2]);
+      break;
+    case Native:
+      for(auto &a : prog.native[oc.arg[0]].arg)
+        func(a);
+      break;
+    default:
+      func(oc.arg[0]);
+      break;
+  }
+}
+
 inline SymbolicExpression SymbolicFuncWrapArg1<double(double), SymbolicExpression>::call(
   const std::shared_ptr<fmatvec::Function<double(double)>> &func,
   const SymbolicExpression &arg) {
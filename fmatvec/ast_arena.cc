@@ -0,0 +1,158 @@
+#include "ast.h"
+#include <limits>
+
+using namespace std;
+
+namespace fmatvec {
+
+namespace AST { // internal namespace
+
+ExpressionArena::ExpressionArena(size_t nrNodes) {
+  node.reserve(nrNodes);
+}
+
+ExpressionArena::Index ExpressionArena::add(const Node &n) {
+  if(node.size()>=numeric_limits<Index>::max())
+    throw runtime_error("Too many nodes in ExpressionArena.");
+  node.emplace_back(n);
+  return node.size()-1;
+}
+
+ExpressionArena::Index ExpressionArena::constant(long c) {
+  constantLong.emplace_back(c);
+  return add({ Vertex::Kind::ConstantLong, 0, 0, { static_cast<Index>(constantLong.size()-1), 0, 0 } });
+}
+
+ExpressionArena::Index ExpressionArena::constant(double c) {
+  constantDouble.emplace_back(c);
+  return add({ Vertex::Kind::ConstantDouble, 0, 0, { static_cast<Index>(constantDouble.size()-1), 0, 0 } });
+}
+
+ExpressionArena::Index ExpressionArena::symbol(const IndependentVariable &x) {
+  auto [it, created]=symbolIndex.emplace(x.get(), 0);
+  if(created) {
+    symbolTable.emplace_back(x);
+    it->second=add({ Vertex::Kind::Symbol, 0, 0, { static_cast<Index>(symbolTable.size()-1), 0, 0 } });
+  }
+  return it->second;
+}
+
+ExpressionArena::Index ExpressionArena::operation(Operation::Operator op, initializer_list<Index> child) {
+  if(child.size()!=Operation::getNrChilds(op))
+    throw runtime_error("Wrong number of childs for a operation in ExpressionArena.");
+  Node n { Vertex::Kind::Operation, static_cast<uint8_t>(op), static_cast<uint8_t>(child.size()), { 0, 0, 0 } };
+  size_t i=0;
+  for(auto c : child) {
+    // a child must exist: this also ensures that the nodes are in topological order
+    if(c>=node.size())
+      throw runtime_error("Unknown child node in ExpressionArena.");
+    n.arg[i++]=c;
+  }
+  return add(n);
+}
+
+vector<ExpressionArena::Index> ExpressionArena::import(const vector<SymbolicExpression> &se) {
+  unordered_map<const Vertex*, size_t> index;
+  auto order=Operation::getTopologicalOrder(se, index);
+  vector<Index> nodeOf(order.size()); // the node of each vertex in order
+  for(size_t v=0; v<order.size(); ++v) {
+    auto *vertex=order[v].get();
+    switch(vertex->getKind()) {
+      case Vertex::Kind::ConstantLong:
+        nodeOf[v]=constant(static_cast<const Constant<long>*>(vertex)->getValue());
+        break;
+      case Vertex::Kind::ConstantDouble:
+        nodeOf[v]=constant(static_cast<const Constant<double>*>(vertex)->getValue());
+        break;
+      case Vertex::Kind::Symbol:
+        if(auto it=symbolIndex.find(vertex); it!=symbolIndex.end())
+          nodeOf[v]=it->second;
+        else
+          nodeOf[v]=symbol(Symbol::create(static_cast<const Symbol*>(vertex)->getUUID()));
+        break;
+      case Vertex::Kind::Operation: {
+        auto o=static_cast<const Operation*>(vertex);
+        Node n { Vertex::Kind::Operation, static_cast<uint8_t>(o->op), static_cast<uint8_t>(o->child.size()), { 0, 0, 0 } };
+        for(size_t c=0; c<o->child.size(); ++c)
+          n.arg[c]=nodeOf[index[o->child[c].get()]];
+        nodeOf[v]=add(n);
+        break;
+      }
+      case Vertex::Kind::NativeFunction:
+        throw runtime_error("A SymbolicExpression with a NativeFunction cannot be stored in a ExpressionArena.");
+    }
+  }
+  vector<Index> ret;
+  ret.reserve(se.size());
+  for(auto &e : se)
+    ret.emplace_back(nodeOf[index[e.get()]]);
+  return ret;
+}
+
+vector<SymbolicExpression> ExpressionArena::toSymbolicExpression(const vector<Index> &root) const {
+  // mark all nodes needed by root: the childs of a node have lower indices, hence a single backward sweep is enough
+  vector<bool> needed(node.size(), false);
+  Index end=0;
+  for(auto r : root) {
+    if(r>=node.size())
+      throw runtime_error("Unknown node in ExpressionArena.");
+    needed[r]=true;
+    end=std::max(end, r+1);
+  }
+  for(Index i=end; i-->0;)
+    if(needed[i] && node[i].kind==Vertex::Kind::Operation)
+      for(uint8_t c=0; c<node[i].nrChilds; ++c)
+        needed[node[i].arg[c]]=true;
+  // create the expressions of all needed nodes in a forward sweep (the childs exist before its parent)
+  vector<SymbolicExpression> expr(end, SymbolicExpression(shared_ptr<const Vertex>()));
+  vector<SymbolicExpression> child;
+  for(Index i=0; i<end; ++i) {
+    if(!needed[i])
+      continue;
+    auto &n=node[i];
+    switch(n.kind) {
+      case Vertex::Kind::ConstantLong:
+        expr[i]=SymbolicExpression(constantLong[n.arg[0]]);
+        break;
+      case Vertex::Kind::ConstantDouble:
+        expr[i]=SymbolicExpression(constantDouble[n.arg[0]]);
+        break;
+      case Vertex::Kind::Symbol:
+        expr[i]=symbolTable[n.arg[0]];
+        break;
+      case Vertex::Kind::Operation:
+        child.clear();
+        for(uint8_t c=0; c<n.nrChilds; ++c)
+          child.emplace_back(expr[n.arg[c]]);
+        expr[i]=Operation::create(static_cast<Operation::Operator>(n.op), child);
+        break;
+      case Vertex::Kind::NativeFunction:
+        break; // not possible
+    }
+  }
+  vector<SymbolicExpression> ret;
+  ret.reserve(root.size());
+  for(auto r : root)
+    ret.emplace_back(expr[r]);
+  return ret;
+}
+
+double ExpressionArena::getConstant(Index i) const {
+  auto &n=node[i];
+  if(n.kind==Vertex::Kind::ConstantLong)
+    return constantLong[n.arg[0]];
+  if(n.kind==Vertex::Kind::ConstantDouble)
+    return constantDouble[n.arg[0]];
+  throw runtime_error("The node is not a constant in ExpressionArena.");
+}
+
+size_t ExpressionArena::getMemoryUsage() const {
+  return node.capacity()*sizeof(Node)+constantLong.capacity()*sizeof(long)+
+         constantDouble.capacity()*sizeof(double)+symbolTable.capacity()*sizeof(IndependentVariable)+
+         symbolIndex.size()*(sizeof(const Vertex*)+sizeof(Index)+2*sizeof(void*))+
+         symbolIndex.bucket_count()*sizeof(void*);
+}
+
+} // end namespace AST
+
+} // end namespace fmatvec
@@ -0,0 +1,473 @@
+#include "ast.h"
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <sstream>
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace fmatvec {
+
+namespace AST { // internal namespace
+
+string hashString(const string &str) {
+  uint64_t h=14695981039346656037ull;
+  for(unsigned char c : str) {
+    h^=c;
+    h*=1099511628211ull;
+  }
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+  return buf;
+}
+
+bool isPrivate(const string &path, bool dir) {
+#ifndef _WIN32
+  struct stat st;
+  if((dir ? stat(path.c_str(), &st) : lstat(path.c_str(), &st))!=0)
+    return false;
+  if(dir ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode))
+    return false;
+  return st.st_uid==geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH))==0;
+#else
+  error_code ec;
+  return dir ? filesystem::is_directory(path, ec) : filesystem::is_regular_file(path, ec);
+#endif
+}
+
+namespace {
+  // the file format: magic, byte order mark, key, derived expressions, dims
+  const string magic("FMVEXPR1");
+  constexpr uint32_t byteOrderMark=0x01020304;
+
+  // the kind of each vertex in the binary form
+  enum VertexKind : uint8_t { ConstantLong, ConstantDouble, SymbolRef, OperationRef };
+
+  struct Config {
+    Config() {
+      if(auto *d=getenv("FMATVEC_EXPR_CACHE_DIR"))
+        dir=d;
+    }
+    mutex m;
+    string dir;
+  };
+
+  Config& config() {
+    static Config c;
+    return c;
+  }
+
+  atomic<size_t> nrHits { 0 };
+  atomic<size_t> nrMisses { 0 };
+
+  template<class T>
+  void write(string &data, const T &x) {
+    data.append(reinterpret_cast<const char*>(&x), sizeof(T));
+  }
+
+  // the content of a file: memory-mapped on POSIX systems
+  class FileContent {
+    public:
+      FileContent(const filesystem::path &file) {
+#ifndef _WIN32
+        int fd=open(file.c_str(), O_RDONLY);
+        if(fd<0)
+          return;
+        struct stat st;
+        if(fstat(fd, &st)==0 && st.st_size>0) {
+          auto addr=mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if(addr!=MAP_FAILED) {
+            data=static_cast<const char*>(addr);
+            size=st.st_size;
+          }
+        }
+        close(fd);
+#else
+        ifstream f(file, ios::binary);
+        stringstream str;
+        str<<f.rdbuf();
+        content=str.str();
+        data=content.data();
+        size=content.size();
+#endif
+      }
+      ~FileContent() {
+#ifndef _WIN32
+        if(data)
+          munmap(const_cast<char*>(data), size);
+#endif
+      }
+      FileContent(const FileContent &) = delete;
+      FileContent& operator=(const FileContent &) = delete;
+      const char *data { nullptr };
+      size_t size { 0 };
+#ifdef _WIN32
+    private:
+      string content;
+#endif
+  };
+}
+
+// encodes expressions to the binary form
+class ExpressionCache::Encoder {
+  public:
+    // the symbols indep are numbered by its position
+    Encoder(const vector<IndependentVariable> &indep) {
+      for(auto &iv : indep)
+        addSymbol(iv);
+    }
+
+    // append the graph of all expr to data.
+    // Returns false if expr cannot be encoded (NativeFunction's or unknown symbols if newSymbols is false).
+    bool encode(const vector<SymbolicExpression> &expr, bool newSymbols_) {
+      newSymbols=newSymbols_;
+      index.clear();
+      graph.clear();
+      nrVertices=0;
+      vector<uint32_t> root;
+      for(auto &e : expr) {
+        auto idx=encodeVertex(e);
+        if(!idx)
+          return false;
+        root.emplace_back(*idx);
+      }
+      write(data, nrVertices);
+      data+=graph;
+      write(data, static_cast<uint32_t>(root.size()));
+      for(auto r : root)
+        write(data, r);
+      return true;
+    }
+
+    string data;
+    vector<SymbolicExpression> symbol; // all symbols by its number
+
+  private:
+    void addSymbol(const SymbolicExpression &s) {
+      if(symbolIndex.emplace(s.get(), symbol.size()).second)
+        symbol.emplace_back(s);
+    }
+
+    optional<uint32_t> encodeVertex(const SymbolicExpression &e) {
+      if(auto it=index.find(e.get()); it!=index.end())
+        return it->second;
+      if(auto c=dynamic_pointer_cast<const Constant<long>>(e)) {
+        write(graph, ConstantLong);
+        write(graph, static_cast<int64_t>(c->getValue()));
+      }
+      else if(auto c=dynamic_pointer_cast<const Constant<double>>(e)) {
+        write(graph, ConstantDouble);
+        write(graph, c->getValue());
+      }
+      else if(dynamic_pointer_cast<const Symbol>(e)) {
+        auto it=symbolIndex.find(e.get());
+        if(it==symbolIndex.end()) {
+          if(!newSymbols)
+            return {};
+          addSymbol(e);
+          it=symbolIndex.find(e.get());
+        }
+        write(graph, SymbolRef);
+        write(graph, static_cast<uint32_t>(it->second));
+      }
+      else if(auto op=dynamic_pointer_cast<const Operation>(e)) {
+        // the childs must be written before the operation itself
+        vector<uint32_t> child;
+        for(auto &c : op->getChilds()) {
+          auto idx=encodeVertex(c);
+          if(!idx)
+            return {};
+          child.emplace_back(*idx);
+        }
+        write(graph, OperationRef);
+        write(graph, static_cast<uint8_t>(op->getOp()));
+        write(graph, static_cast<uint8_t>(child.size()));
+        for(auto c : child)
+          write(graph, c);
+      }
+      else
+        return {}; // a NativeFunction
+      index.emplace(e.get(), nrVertices);
+      return nrVertices++;
+    }
+
+    unordered_map<const Vertex*, size_t> symbolIndex;
+    bool newSymbols { true };
+    unordered_map<const Vertex*, uint32_t> index; // the index of each vertex in the current graph
+    string graph; // the vertices of the current graph
+    uint32_t nrVertices { 0 };
+};
+
+// decodes expressions from the binary form (all read functions return false on invalid data)
+class ExpressionCache::Decoder {
+  public:
+    Decoder(const char *begin, const char *end_) : pos(begin), end(end_) {}
+
+    template<class T>
+    bool read(T &x) {
+      if(static_cast<size_t>(end-pos)<sizeof(T))
+        return false;
+      memcpy(&x, pos, sizeof(T));
+      pos+=sizeof(T);
+      return true;
+    }
+
+    // read str.size() bytes and compare these with str
+    bool compare(const string &str) {
+      if(static_cast<size_t>(end-pos)<str.size() || memcmp(pos, str.data(), str.size())!=0)
+        return false;
+      pos+=str.size();
+      return true;
+    }
+
+    // read a graph: the symbols are given by its number
+    bool readGraph(const vector<SymbolicExpression> &symbol, vector<SymbolicExpression> &expr) {
+      uint32_t nrVertices;
+      if(!read(nrVertices))
+        return false;
+      vector<SymbolicExpression> vertex;
+      vertex.reserve(std::min<size_t>(nrVertices, end-pos)); // each vertex has at least one byte
+      for(uint32_t i=0; i<nrVertices; ++i) {
+        uint8_t kind;
+        if(!read(kind))
+          return false;
+        switch(kind) {
+          case ConstantLong: {
+            int64_t c;
+            if(!read(c))
+              return false;
+            vertex.emplace_back(Constant<long>::create(static_cast<long>(c)));
+            break;
+          }
+          case ConstantDouble: {
+            double c;
+            if(!read(c))
+              return false;
+            vertex.emplace_back(Constant<double>::create(c));
+            break;
+          }
+          case SymbolRef: {
+            uint32_t s;
+            if(!read(s) || s>=symbol.size())
+              return false;
+            vertex.emplace_back(symbol[s]);
+            break;
+          }
+          case OperationRef: {
+            uint8_t op, nrChilds;
+            if(!read(op) || !read(nrChilds) || op>Operation::Condition ||
+               nrChilds!=Operation::getNrChilds(static_cast<Operation::Operator>(op)))
+              return false;
+            vector<SymbolicExpression> child(nrChilds);
+            for(auto &c : child) {
+              uint32_t idx;
+              if(!read(idx) || idx>=vertex.size())
+                return false;
+              c=vertex[idx];
+            }
+            // create throws for illegal constant arguments (e.g. a division by the constant 0)
+            try {
+              vertex.emplace_back(Operation::create(static_cast<Operation::Operator>(op), child));
+            }
+            catch(const runtime_error&) {
+              return false;
+            }
+            break;
+          }
+          default:
+            return false;
+        }
+      }
+      uint32_t nrRoots;
+      if(!read(nrRoots) || nrRoots>static_cast<size_t>(end-pos)/sizeof(uint32_t))
+        return false;
+      expr.resize(nrRoots);
+      for(auto &e : expr) {
+        uint32_t idx;
+        if(!read(idx) || idx>=vertex.size())
+          return false;
+        e=vertex[idx];
+      }
+      return true;
+    }
+
+    const char *pos;
+    const char *end;
+};
+
+ExpressionCache::Entry ExpressionCache::get(const string &tag, const vector<SymbolicExpression> &input,
+                                            const vector<IndependentVariable> &indep, const function<Entry()> &derive) {
+  // the cache is only used if the directory is private (a new directory is created with mode 0700)
+  auto dir=getDirectory();
+  error_code ec;
+  if(!dir.empty() && filesystem::create_directories(dir, ec))
+    filesystem::permissions(dir, filesystem::perms::owner_all, ec);
+  if(dir.empty() || !isPrivate(dir, true)) {
+    nrMisses++;
+    return derive();
+  }
+
+  // the key: the tag and the input in binary form (symbols numbered by indep and its first occurrence in input)
+  Encoder enc(indep);
+  enc.data=tag;
+  enc.data+='\0';
+  write(enc.data, static_cast<uint32_t>(indep.size()));
+  if(!enc.encode(input, true)) {
+    nrMisses++;
+    return derive();
+  }
+  auto key=move(enc.data);
+  auto file=filesystem::path(dir)/("fmatvec_expr_"+hashString(key)+".bin");
+
+  // load the entry if the file exists, is private and the stored key is equal (avoids any hash collision)
+  if(isPrivate(file.string(), false)) {
+    FileContent content(file);
+    Decoder dec(content.data, content.data+content.size);
+    Entry entry;
+    uint32_t bom, nrDims;
+    if(content.data && dec.compare(magic) && dec.read(bom) && bom==byteOrderMark) {
+      uint64_t keySize;
+      if(dec.read(keySize) && keySize==key.size() && dec.compare(key) && dec.readGraph(enc.symbol, entry.expr) &&
+         dec.read(nrDims)) {
+        entry.dim.resize(nrDims);
+        bool valid=true;
+        for(auto &d : entry.dim) {
+          int32_t d32;
+          valid = valid && dec.read(d32);
+          d=d32;
+        }
+        if(valid && dec.pos==dec.end) {
+          nrHits++;
+          return entry;
+        }
+      }
+    }
+  }
+
+  nrMisses++;
+  auto entry=derive();
+
+  // store the entry (the cache is optional: errors are ignored)
+  enc.data.clear();
+  if(!enc.encode(entry.expr, false))
+    return entry;
+  string data(magic);
+  write(data, byteOrderMark);
+  write(data, static_cast<uint64_t>(key.size()));
+  data+=key;
+  data+=enc.data;
+  write(data, static_cast<uint32_t>(entry.dim.size()));
+  for(auto d : entry.dim)
+    write(data, static_cast<int32_t>(d));
+  // write to a unique temporary file and rename it afterwards: this is safe if several processes write the same file
+  random_device rd;
+  auto tmp=filesystem::path(file.string()+"."+to_string(rd())+to_string(rd()));
+  {
+    ofstream f(tmp, ios::binary);
+    f.write(data.data(), data.size());
+    filesystem::permissions(tmp, filesystem::perms::owner_read | filesystem::perms::owner_write, ec);
+    if(!f || ec) {
+      f.close();
+      filesystem::remove(tmp, ec);
+      return entry;
+    }
+  }
+  filesystem::rename(tmp, file, ec);
+  if(ec)
+    filesystem::remove(tmp, ec);
+  return entry;
+}
+
+void ExpressionCache::setDirectory(const string &dir) {
+  lock_guard<mutex> lock(config().m);
+  config().dir=dir;
+}
+
+string ExpressionCache::getDirectory() {
+  lock_guard<mutex> lock(config().m);
+  return config().dir;
+}
+
+ExpressionCache::Statistics ExpressionCache::getStatistics() {
+  Statistics stat;
+  stat.hits=nrHits;
+  stat.misses=nrMisses;
+  return stat;
+}
+
+} // end namespace AST
+
+namespace {
+  // the binary form of writeBinary: magic, byte order mark, symbol uuids, size of the graph, graph
+  const string binaryMagic("FMVDAG01");
+}
+
+void writeBinary(ostream &s, const vector<SymbolicExpression> &se) {
+  AST::ExpressionCache::Encoder enc({});
+  if(!enc.encode(se, true))
+    throw runtime_error("A SymbolicExpression with a NativeFunction cannot be written in binary form.");
+  string data(binaryMagic);
+  AST::write(data, AST::byteOrderMark);
+  AST::write(data, static_cast<uint32_t>(enc.symbol.size()));
+  for(auto &sym : enc.symbol) {
+    auto &uuid=dynamic_pointer_cast<const AST::Symbol>(sym)->getUUID();
+    data.append(reinterpret_cast<const char*>(uuid.data), uuid.size());
+  }
+  AST::write(data, static_cast<uint64_t>(enc.data.size()));
+  data+=enc.data;
+  s.write(data.data(), data.size());
+  if(!s)
+    throw runtime_error("Failed to write SymbolicExpression to stream");
+}
+
+vector<SymbolicExpression> readBinary(istream &s) {
+  auto error=[]() {
+    return runtime_error("The stream does not contain valid binary SymbolicExpressions.");
+  };
+  // read exactly n bytes from the stream: in chunks, since n may be a invalid value larger than the stream
+  auto read=[&s, &error](size_t n) {
+    constexpr size_t chunkSize=65536;
+    string data;
+    while(data.size()<n) {
+      auto size=data.size();
+      data.resize(size+std::min(chunkSize, n-size));
+      if(!s.read(data.data()+size, data.size()-size))
+        throw error();
+    }
+    return data;
+  };
+
+  auto header=read(binaryMagic.size()+2*sizeof(uint32_t));
+  AST::ExpressionCache::Decoder dec(header.data(), header.data()+header.size());
+  uint32_t bom, nrSymbols;
+  if(!dec.compare(binaryMagic) || !dec.read(bom) || bom!=AST::byteOrderMark || !dec.read(nrSymbols))
+    throw error();
+  vector<SymbolicExpression> symbol;
+  symbol.reserve(std::min<size_t>(nrSymbols, 1024)); // nrSymbols may be a invalid value
+  for(uint32_t i=0; i<nrSymbols; ++i) {
+    boost::uuids::uuid uuid;
+    auto data=read(uuid.size());
+    memcpy(uuid.data, data.data(), uuid.size());
+    symbol.emplace_back(AST::Symbol::create(uuid));
+  }
+  uint64_t graphSize;
+  auto sizeData=read(sizeof(graphSize));
+  memcpy(&graphSize, sizeData.data(), sizeof(graphSize));
+  auto graph=read(graphSize);
+  AST::ExpressionCache::Decoder graphDec(graph.data(), graph.data()+graph.size());
+  vector<SymbolicExpression> se;
+  if(!graphDec.readGraph(symbol, se) || graphDec.pos!=graphDec.end)
+    throw error();
+  return se;
+}
+
+} // end namespace fmatvec
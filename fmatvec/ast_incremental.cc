@@ -0,0 +1,84 @@
+#include "ast.h"
+
+using namespace std;
+
+namespace fmatvec {
+
+namespace AST { // internal namespace
+
+namespace {
+  constexpr size_t bitsPerWord=64;
+
+  size_t nrWords(size_t nrBits) {
+    return (nrBits+bitsPerWord-1)/bitsPerWord;
+  }
+}
+
+ByteCodeIncremental::ByteCodeIncremental(const vector<ByteCode> &byteCode_,
+                                         const vector<pair<shared_ptr<const Symbol>, size_t>> &symbol_) :
+  byteCode(byteCode_) {
+  // the symbols each entry depends on: the union of the symbols of all entries it reads from
+  size_t symWords=nrWords(symbol_.size());
+  vector<uint64_t> entrySymbols(byteCode.size()*symWords, 0);
+  for(size_t s=0; s<symbol_.size(); ++s)
+    entrySymbols[symbol_[s].second*symWords+s/bitsPerWord]|=uint64_t(1)<<(s%bitsPerWord);
+  unordered_map<const double*, size_t> producer;
+  producer.reserve(byteCode.size());
+  for(size_t i=0; i<byteCode.size(); ++i) {
+    for(auto *a : byteCode[i].argsPtr)
+      if(auto it=producer.find(a); it!=producer.end())
+        for(size_t w=0; w<symWords; ++w)
+          entrySymbols[i*symWords+w]|=entrySymbols[it->second*symWords+w];
+    producer[byteCode[i].retPtr]=i;
+  }
+
+  // transpose to a bitmap over all entries for each symbol
+  size_t entryWords=nrWords(byteCode.size());
+  for(auto &[sym, idx] : symbol_) {
+    symbol.emplace_back(sym);
+    lastVersion.emplace_back(sym->getVersion());
+  }
+  dependent.resize(symbol.size(), vector<uint64_t>(entryWords, 0));
+  for(size_t i=0; i<byteCode.size(); ++i)
+    for(size_t s=0; s<symbol.size(); ++s)
+      if(entrySymbols[i*symWords+s/bitsPerWord] & (uint64_t(1)<<(s%bitsPerWord)))
+        dependent[s][i/bitsPerWord]|=uint64_t(1)<<(i%bitsPerWord);
+  run.resize(entryWords);
+}
+
+void ByteCodeIncremental::operator()() const {
+  if(first) {
+    for(auto &bc : byteCode)
+      bc.func(bc.retPtr, bc.argsPtr);
+    for(size_t s=0; s<symbol.size(); ++s)
+      lastVersion[s]=symbol[s]->getVersion();
+    first=false;
+    nrExecuted=byteCode.size();
+    return;
+  }
+
+  // the entries depending on any changed symbol
+  fill(run.begin(), run.end(), 0);
+  for(size_t s=0; s<symbol.size(); ++s) {
+    auto version=symbol[s]->getVersion();
+    if(version==lastVersion[s])
+      continue;
+    lastVersion[s]=version;
+    for(size_t w=0; w<run.size(); ++w)
+      run[w]|=dependent[s][w];
+  }
+
+  nrExecuted=0;
+  for(size_t w=0; w<run.size(); ++w) {
+    size_t i=w*bitsPerWord;
+    for(uint64_t bits=run[w]; bits!=0; ++i, bits>>=1)
+      if(bits & 1) {
+        byteCode[i].func(byteCode[i].retPtr, byteCode[i].argsPtr);
+        ++nrExecuted;
+      }
+  }
+}
+
+} // end namespace AST
+
+} // end namespace fmatvec
@@ -0,0 +1,252 @@
+#include "ast.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#ifndef _WIN32
+  #include <dlfcn.h>
+#endif
+
+using namespace std;
+
+namespace fmatvec {
+
+namespace AST { // internal namespace
+
+namespace {
+  // the name of the function in the generated C code
+  const string funcName("fmatvec_jit_eval");
+
+  // print a double bit-identical as C literal
+  string cLiteral(double x) {
+    if(std::isnan(x))
+      return "NAN";
+    if(std::isinf(x))
+      return x>0 ? "INFINITY" : "(-INFINITY)";
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%a", x);
+    return string("(")+buf+")";
+  }
+
+  // return the per-user cache directory or a empty path if there is none
+  // (a shared directory like the temp directory is never used: others could plant a library which is loaded)
+  filesystem::path getCacheDir() {
+    if(auto *dir=getenv("FMATVEC_JIT_CACHE_DIR"))
+      return dir;
+    if(auto *dir=getenv("XDG_CACHE_HOME"))
+      return filesystem::path(dir)/"fmatvec"/"jit";
+    if(auto *dir=getenv("HOME"))
+      return filesystem::path(dir)/".cache"/"fmatvec"/"jit";
+    return {};
+  }
+
+  string getCompiler() {
+    auto *cc=getenv("FMATVEC_JIT_CC");
+    return cc ? cc : "cc";
+  }
+
+  string shellQuote(const string &str) {
+    string ret("'");
+    for(auto c : str)
+      if(c=='\'')
+        ret+="'\\''";
+      else
+        ret+=c;
+    return ret+"'";
+  }
+
+  string readFile(const filesystem::path &file) {
+    ifstream f(file, ios::binary);
+    stringstream str;
+    str<<f.rdbuf();
+    return str.str();
+  }
+}
+
+string JITProgram::generateSource(const OpCodeProgram &prog) {
+  auto s = [](OpCode::Index slot) { return "s"+to_string(slot); };
+
+  stringstream str;
+  str<<"// generated by fmatvec: just-in-time compiled symbolic expression"<<endl;
+  str<<"#include <math.h>"<<endl;
+  str<<"typedef double (*fmatvec_native_t)(void *ctx, int idx, double **arg);"<<endl;
+  // the same algorithm as powInt in ast.cc (a chain of multiplications for small exponents)
+  str<<"static double fmatvec_powi(double x, int n) {"<<endl;
+  str<<"  if(n > "<<OpCodeProgram::maxPowIntChain<<" || n < -"<<OpCodeProgram::maxPowIntChain<<") return pow(x, n);"<<endl;
+  str<<"  unsigned int m = n < 0 ? -n : n; double r = 1;"<<endl;
+  str<<"  while(1) { if(m & 1) r *= x; m >>= 1; if(m == 0) break; x *= x; }"<<endl;
+  str<<"  return n < 0 ? 1 / r : r;"<<endl;
+  str<<"}"<<endl;
+  // the same expression as powHalf in ast.cc
+  str<<"static double fmatvec_powh(double x) { return x == -INFINITY ? INFINITY : sqrt(x) + 0.0; }"<<endl;
+  str<<"void "<<funcName<<"(const double *in, double *out, fmatvec_native_t nat, void *ctx) {"<<endl;
+  // declare all slots (slots may be reused by the program)
+  for(OpCode::Index i=0; i<prog.nrSlots; ++i)
+    str<<"  double "<<s(i)<<";"<<endl;
+  for(auto &[slot, c] : prog.constant)
+    str<<"  "<<s(slot)<<" = "<<cLiteral(c)<<";"<<endl;
+  for(size_t i=0; i<prog.symbol.size(); ++i)
+    str<<"  "<<s(prog.symbol[i].second)<<" = in["<<i<<"];"<<endl;
+  // the same expressions as in FMATVEC_OPCODE_KERNELS to get bit-identical results (using the C math library)
+  for(auto &oc : prog.code) {
+    auto a=s(oc.arg[0]);
+    auto b=s(oc.arg[1]);
+    auto c=s(oc.arg[2]);
+    auto sign=[](const string &x) { return "("+x+" == 0 ? 0.0 : signbit("+x+") ? -1.0 : 1.0)"; };
+    string expr;
+    switch(oc.code) {
+      case Operation::Plus:      expr=a+" + "+b; break;
+      case Operation::Minus:     expr=a+" - "+b; break;
+      case Operation::Mult:      expr=a+" * "+b; break;
+      case Operation::Div:       expr=a+" / "+b; break;
+      case Operation::Pow:       expr="pow("+a+", "+b+")"; break;
+      case Operation::Log:       expr="log("+a+")"; break;
+      case Operation::Sqrt:      expr="sqrt("+a+")"; break;
+      case Operation::Neg:       expr="- "+a; break;
+      case Operation::Sin:       expr="sin("+a+")"; break;
+      case Operation::Cos:       expr="cos("+a+")"; break;
+      case Operation::Tan:       expr="tan("+a+")"; break;
+      case Operation::Sinh:      expr="sinh("+a+")"; break;
+      case Operation::Cosh:      expr="cosh("+a+")"; break;
+      case Operation::Tanh:      expr="tanh("+a+")"; break;
+      case Operation::ASin:      expr="asin("+a+")"; break;
+      case Operation::ACos:      expr="acos("+a+")"; break;
+      case Operation::ATan:      expr="atan("+a+")"; break;
+      case Operation::ATan2:     expr="atan2("+a+", "+b+")"; break;
+      case Operation::ASinh:     expr="asinh("+a+")"; break;
+      case Operation::ACosh:     expr="acosh("+a+")"; break;
+      case Operation::ATanh:     expr="atanh("+a+")"; break;
+      case Operation::Exp:       expr="exp("+a+")"; break;
+      case Operation::Sign:      expr=sign(a); break;
+      case Operation::Heaviside: expr="0.5 * "+sign(a)+" + 0.5"; break;
+      case Operation::Abs:       expr="fabs("+a+")"; break;
+      case Operation::Min:       expr=b+" < "+a+" ? "+b+" : "+a; break;
+      case Operation::Max:       expr=a+" < "+b+" ? "+b+" : "+a; break;
+      case Operation::Condition: expr=a+" > 0 ? "+b+" : "+c; break;
+      case OpCodeProgram::PowInt: expr="fmatvec_powi("+a+", (int)"+b+")"; break;
+      case OpCodeProgram::PowHalf: expr="fmatvec_powh("+a+")"; break;
+      case OpCodeProgram::Native: {
+        // NativeFunction's are called back using nat
+        auto &call=prog.native[oc.arg[0]];
+        str<<"  { double *a[] = {";
+        for(size_t i=0; i<call.arg.size(); ++i)
+          str<<(i==0?"":", ")<<"&"<<s(call.arg[i]);
+        if(call.arg.empty())
+          str<<"0";
+        str<<"}; "<<s(oc.ret)<<" = nat(ctx, "<<oc.arg[0]<<", a); }"<<endl;
+        continue;
+      }
+      default:
+        throw runtime_error("Internal error: unknown op code in JITProgram::generateSource.");
+    }
+    str<<"  "<<s(oc.ret)<<" = "<<expr<<";"<<endl;
+  }
+  for(size_t i=0; i<prog.output.size(); ++i)
+    str<<"  out["<<i<<"] = "<<s(prog.output[i])<<";"<<endl;
+  str<<"}"<<endl;
+  return str.str();
+}
+
+#ifndef _WIN32
+
+JITProgram::JITProgram(const OpCodeProgram &prog) : native(prog.native) {
+  // the compile command (-ffp-contract=off avoids FMA contraction to keep bit-identical results with the interpreters)
+  auto compiler=getCompiler();
+  string flags("-O2 -fPIC -shared -ffp-contract=off");
+  auto source=generateSource(prog);
+  // the cache key includes the compiler command since the compiled code depends on it
+  auto key=hashString(compiler+" "+flags+"\n"+source);
+
+  // the cache is only used if the cache directory is private (a new directory is created with mode 0700)
+  error_code ec;
+  auto cacheDir=getCacheDir();
+  bool useCache=false;
+  if(!cacheDir.empty()) {
+    if(filesystem::create_directories(cacheDir, ec))
+      filesystem::permissions(cacheDir, filesystem::perms::owner_all, ec);
+    useCache=isPrivate(cacheDir, true);
+  }
+  // else compile in a private temporary directory (removed after loading) without caching
+  filesystem::path tmpDir;
+  if(!useCache) {
+    auto tmpl=(filesystem::temp_directory_path()/"fmatvec_jit_XXXXXX").string();
+    if(!mkdtemp(tmpl.data()))
+      throw runtime_error("Cannot create a temporary directory for the JIT program: "+string(strerror(errno)));
+    cacheDir=tmpDir=tmpl;
+  }
+  auto removeTmpDir=[&tmpDir, &ec]() {
+    if(!tmpDir.empty())
+      filesystem::remove_all(tmpDir, ec);
+  };
+  auto cSrc=cacheDir/("fmatvec_jit_"+key+".c");
+  auto lib=cacheDir/("fmatvec_jit_"+key+".so");
+
+  // use the cached library if the stored source is equal (avoids any hash collision)
+  fromCache=useCache && isPrivate(lib, false) && isPrivate(cSrc, false) && readFile(cSrc)==source;
+  if(!fromCache) {
+    // compile to unique temporary files and rename these afterwards:
+    // this is safe if several processes compile the same program at the same time
+    random_device rd;
+    auto tmpBase=cacheDir/("fmatvec_jit_"+key+"."+to_string(rd())+to_string(rd()));
+    auto cTmp=filesystem::path(tmpBase.string()+".c");
+    auto libTmp=filesystem::path(tmpBase.string()+".so");
+    auto logTmp=filesystem::path(tmpBase.string()+".log");
+    ofstream(cTmp, ios::binary)<<source;
+    auto cmd=compiler+" "+flags+" -o "+shellQuote(libTmp.string())+" "+shellQuote(cTmp.string())+" -lm > "+
+             shellQuote(logTmp.string())+" 2>&1";
+    auto ret=system(cmd.c_str());
+    if(ret!=0) {
+      auto log=readFile(logTmp);
+      filesystem::remove(cTmp, ec);
+      filesystem::remove(libTmp, ec);
+      filesystem::remove(logTmp, ec);
+      removeTmpDir();
+      throw runtime_error("Compiling the JIT program failed:\n"+cmd+"\n"+log);
+    }
+    filesystem::remove(logTmp, ec);
+    // the library must be renamed before the source since the source marks a valid cache entry
+    filesystem::rename(libTmp, lib);
+    filesystem::rename(cTmp, cSrc);
+  }
+
+  handle=dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+  removeTmpDir(); // a loaded library stays valid after its file is removed
+  if(!handle)
+    throw runtime_error(string("Cannot load the JIT program: ")+dlerror());
+  func=reinterpret_cast<Func>(dlsym(handle, funcName.c_str()));
+  if(!func) {
+    string err(dlerror());
+    dlclose(handle);
+    throw runtime_error("Cannot find the JIT program function: "+err);
+  }
+}
+
+JITProgram::~JITProgram() {
+  if(handle)
+    dlclose(handle);
+}
+
+#else
+
+JITProgram::JITProgram(const OpCodeProgram &prog) {
+  throw runtime_error("Just-in-time compilation of symbolic expressions is not available on Windows.");
+}
+
+JITProgram::~JITProgram() = default;
+
+#endif
+
+double JITProgram::callNative(void *ctx, int idx, double **arg) {
+  auto &call=static_cast<JITProgram*>(ctx)->native[idx];
+  ByteCode::Arg nativeArg(arg, arg+call.arg.size());
+  return call(nativeArg);
+}
+
+} // end namespace AST
+
+} // end namespace fmatvec
@@ -0,0 +1,513 @@
+#include "ast.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <optional>
+#include <unordered_set>
+
+using namespace std;
+
+namespace fmatvec {
+
+namespace AST { // internal namespace
+
+namespace {
+  // the cost of the operation op (powInt = pow with a integer constant exponent)
+  double opCost(uint16_t op, bool powInt) {
+    switch(op) {
+      case Operation::Plus: case Operation::Minus: case Operation::Neg: case Operation::Mult:
+        return 1;
+      case Operation::Div:
+        return 4;
+      case Operation::Pow:
+        return powInt ? 2 : 8;
+      default:
+        return 8;
+    }
+  }
+
+  constexpr double nativeCost=20;
+  constexpr double maxCost=1e300; // larger costs (of deeply nested trees) are not compared
+}
+
+// A e-graph: equivalence classes of nodes. The childs of a node are classes (not nodes).
+class ExpressionOptimizer::EGraph {
+  public:
+    using Id = uint32_t;
+    static constexpr uint16_t leafOp=numeric_limits<uint16_t>::max();
+
+    // a node: a operation with its child classes or a leaf (a symbol, constant or NativeFunction)
+    struct Node {
+      uint16_t op;
+      uint8_t nrChilds;
+      array<Id, 3> child;
+      Id leaf; // the index in leaves (for leafOp only)
+      bool operator==(const Node &b) const {
+        return op==b.op && nrChilds==b.nrChilds && child==b.child && leaf==b.leaf;
+      }
+      bool operator<(const Node &b) const {
+        return tie(op, nrChilds, child, leaf) < tie(b.op, b.nrChilds, b.child, b.leaf);
+      }
+    };
+    struct NodeHash {
+      size_t operator()(const Node &n) const {
+        size_t h=hash<uint64_t>()((static_cast<uint64_t>(n.op)<<32) ^ n.leaf);
+        for(size_t i=0; i<n.nrChilds; ++i)
+          h=h*1000003 ^ hash<Id>()(n.child[i]);
+        return h;
+      }
+    };
+
+    // add all expr (and all its subexpressions) and return the class of each expr
+    vector<Id> addExpressions(const vector<SymbolicExpression> &expr) {
+      // all vertices in topological order (without recursion: large DAGs do not overflow the call stack)
+      unordered_map<const Vertex*, size_t> index;
+      auto order=Operation::getTopologicalOrder(expr, index);
+      vector<Id> id(order.size()); // the class of each vertex in order
+      for(size_t v=0; v<order.size(); ++v) {
+        auto op=order[v]->getKind()==Vertex::Kind::Operation ? static_cast<const Operation*>(order[v].get()) : nullptr;
+        if(op && op->child.size()<=3) {
+          Node n { static_cast<uint16_t>(op->op), static_cast<uint8_t>(op->child.size()), {0, 0, 0}, 0 };
+          for(size_t i=0; i<n.nrChilds; ++i)
+            n.child[i]=id[index[op->child[i].get()]];
+          id[v]=add(n);
+        }
+        else
+          id[v]=addLeaf(order[v]);
+      }
+      vector<Id> ret;
+      ret.reserve(expr.size());
+      for(auto &e : expr)
+        ret.emplace_back(find(id[index[e.get()]]));
+      return ret;
+    }
+
+    // apply all rules at most maxIterations times
+    void saturate(const Options &options, Statistics &stat) {
+      for(stat.iterations=0; stat.iterations<options.maxIterations && nrNodes<options.maxNodes; ++stat.iterations) {
+        size_t nrNodesBefore=nrNodes;
+        changed=false;
+        // all matching is done on a snapshot of the classes at the begin of the iteration
+        snapshot.assign(classNodes.size(), {});
+        snapshotConst.assign(classNodes.size(), {});
+        for(Id c=0; c<classNodes.size(); ++c)
+          if(find(c)==c) {
+            snapshot[c]=classNodes[c];
+            snapshotConst[c]=constant(c);
+          }
+        for(Id c=0; c<snapshot.size() && nrNodes<options.maxNodes; ++c)
+          for(auto &n : snapshot[c])
+            applyRules(c, n);
+        rebuild();
+        if(!changed && nrNodes==nrNodesBefore) {
+          stat.saturated=true;
+          ++stat.iterations;
+          break;
+        }
+      }
+      stat.nodes=nrNodes;
+    }
+
+    // extract the cheapest expression of each class in root; returns false if this is not possible
+    bool extract(const vector<Id> &root, vector<SymbolicExpression> &expr) {
+      // the cost of the cheapest node of each class (the sum of the costs of all nodes of the tree)
+      vector<double> cost(classNodes.size(), numeric_limits<double>::infinity());
+      vector<const Node*> best(classNodes.size(), nullptr);
+      for(bool improved=true; improved;) {
+        improved=false;
+        for(Id c=0; c<classNodes.size(); ++c)
+          for(auto &n : classNodes[c]) {
+            double k=nodeCost(n);
+            for(size_t i=0; i<n.nrChilds; ++i)
+              k+=cost[find(n.child[i])];
+            if(k<cost[c] && k<maxCost) {
+              cost[c]=k;
+              best[c]=&n;
+              improved=true;
+            }
+          }
+      }
+      for(auto r : root)
+        if(!best[find(r)])
+          return false;
+      // build the expression of each class after the expressions of its child classes (using a explicit stack)
+      unordered_map<Id, SymbolicExpression> built;
+      vector<pair<Id, size_t>> stack; // a class and the index of its next child to visit
+      vector<SymbolicExpression> child;
+      expr.clear();
+      for(auto r : root) {
+        stack.emplace_back(find(r), 0);
+        while(!stack.empty()) {
+          auto [c, next]=stack.back();
+          auto &n=*best[c];
+          if(n.op!=leafOp && next<n.nrChilds) {
+            ++stack.back().second;
+            // the best nodes are acyclic: each child class of a best node has a lower cost
+            if(auto cc=find(n.child[next]); !built.count(cc))
+              stack.emplace_back(cc, 0);
+            continue;
+          }
+          stack.pop_back();
+          if(built.count(c))
+            continue; // a class may be pushed several times before it is built
+          if(n.op==leafOp)
+            built.emplace(c, leaves[n.leaf]);
+          else {
+            child.clear();
+            for(size_t i=0; i<n.nrChilds; ++i)
+              child.emplace_back(built.at(find(n.child[i])));
+            built.emplace(c, Operation::create(static_cast<Operation::Operator>(n.op), child));
+          }
+        }
+        expr.emplace_back(built.at(find(r)));
+      }
+      return true;
+    }
+
+  private:
+    Id find(Id c) const {
+      while(parent[c]!=c)
+        c=parent[c]=parent[parent[c]];
+      return c;
+    }
+
+    // add the node n and return its class: a existing class if n already exists
+    Id add(Node n) {
+      for(size_t i=0; i<n.nrChilds; ++i)
+        n.child[i]=find(n.child[i]);
+      if(auto it=memo.find(n); it!=memo.end())
+        return find(it->second);
+      Id id=classNodes.size();
+      parent.emplace_back(id);
+      classNodes.push_back({n});
+      memo.emplace(n, id);
+      ++nrNodes;
+      changed=true;
+      // constant folding: the constant result of a operation with constant arguments is added to the same class
+      if(n.op!=leafOp) {
+        vector<SymbolicExpression> arg;
+        for(size_t i=0; i<n.nrChilds; ++i) {
+          auto c=constant(n.child[i]);
+          if(!c)
+            break;
+          arg.emplace_back(leaves[classNodes[find(n.child[i])][*c].leaf]);
+        }
+        if(arg.size()==n.nrChilds)
+          try {
+            auto e=Operation::create(static_cast<Operation::Operator>(n.op), arg);
+            if(!dynamic_pointer_cast<const Operation>(e))
+              merge(id, addLeaf(e));
+          }
+          catch(...) {
+            // illegal constant arguments (e.g. log(0)): no folding
+          }
+      }
+      return find(id);
+    }
+
+    Id addLeaf(const SymbolicExpression &e) {
+      auto [it, inserted]=leafIndex.emplace(e.get(), leaves.size());
+      if(inserted)
+        leaves.emplace_back(e);
+      return add({leafOp, 0, {0, 0, 0}, it->second});
+    }
+
+    Id addConst(long c) {
+      return addLeaf(Constant<long>::create(c));
+    }
+
+    Id add(Operation::Operator op, Id a) {
+      return add({static_cast<uint16_t>(op), 1, {a, 0, 0}, 0});
+    }
+
+    Id add(Operation::Operator op, Id a, Id b) {
+      return add({static_cast<uint16_t>(op), 2, {a, b, 0}, 0});
+    }
+
+    // merge the classes of a and b
+    void merge(Id a, Id b) {
+      a=find(a);
+      b=find(b);
+      if(a==b)
+        return;
+      if(classNodes[a].size()<classNodes[b].size())
+        swap(a, b);
+      parent[b]=a;
+      classNodes[a].insert(classNodes[a].end(), classNodes[b].begin(), classNodes[b].end());
+      classNodes[b].clear();
+      classNodes[b].shrink_to_fit();
+      changed=true;
+    }
+
+    // restore the invariants after merges: all childs are canonical and equal nodes are in the same class
+    void rebuild() {
+      for(bool merged=true; merged;) {
+        merged=false;
+        memo.clear();
+        nrNodes=0;
+        vector<pair<Id, Id>> toMerge;
+        for(Id c=0; c<classNodes.size(); ++c) {
+          auto &nodes=classNodes[c];
+          for(auto &n : nodes)
+            for(size_t i=0; i<n.nrChilds; ++i)
+              n.child[i]=find(n.child[i]);
+          sort(nodes.begin(), nodes.end());
+          nodes.erase(unique(nodes.begin(), nodes.end()), nodes.end());
+          nrNodes+=nodes.size();
+          for(auto &n : nodes) {
+            auto [it, inserted]=memo.emplace(n, c);
+            if(!inserted && find(it->second)!=c)
+              toMerge.emplace_back(it->second, c);
+          }
+        }
+        for(auto [a, b] : toMerge)
+          if(find(a)!=find(b)) {
+            merge(a, b);
+            merged=true;
+          }
+      }
+    }
+
+    // the index of a constant node in the (live) class c
+    optional<size_t> constant(Id c) const {
+      auto &nodes=classNodes[find(c)];
+      for(size_t i=0; i<nodes.size(); ++i)
+        if(nodes[i].op==leafOp && isConstant(leaves[nodes[i].leaf]))
+          return i;
+      return {};
+    }
+
+    static bool isConstant(const SymbolicExpression &e) {
+      return e->isConstantInt() || dynamic_pointer_cast<const Constant<double>>(e);
+    }
+
+    // the value of the constant of the snapshot class c
+    optional<double> snapConst(Id c) const {
+      auto &i=snapshotConst[c];
+      if(!i)
+        return {};
+      auto &e=leaves[snapshot[c][*i].leaf];
+      if(auto l=dynamic_pointer_cast<const Constant<long>>(e))
+        return l->getValue();
+      return dynamic_pointer_cast<const Constant<double>>(e)->getValue();
+    }
+
+    double nodeCost(const Node &n) const {
+      if(n.op==leafOp)
+        return isConstant(leaves[n.leaf]) || dynamic_pointer_cast<const Symbol>(leaves[n.leaf]) ? 0 : nativeCost;
+      bool powInt=false;
+      if(n.op==Operation::Pow)
+        if(auto c=constant(n.child[1]))
+          powInt=leaves[classNodes[find(n.child[1])][*c].leaf]->isConstantInt();
+      return opCost(n.op, powInt);
+    }
+
+    // call func for each node with operator op in the snapshot class c
+    template<class Func>
+    void forEach(Id c, Operation::Operator op, const Func &func) const {
+      if(c>=snapshot.size())
+        return;
+      for(auto &n : snapshot[c])
+        if(n.op==op)
+          func(n);
+    }
+
+    // apply all rules to the node n of the snapshot class c
+    void applyRules(Id c, const Node &n) {
+      if(n.op==leafOp)
+        return;
+      Id a=n.child[0], b=n.child[1];
+      auto ca = n.nrChilds>=1 ? snapConst(a) : optional<double>();
+      auto cb = n.nrChilds>=2 ? snapConst(b) : optional<double>();
+      auto isConst=[](const optional<double> &x, double v) { return x && *x==v; };
+      switch(n.op) {
+        case Operation::Plus:
+          merge(c, add(Operation::Plus, b, a)); // commutativity
+          if(isConst(cb, 0)) merge(c, a);
+          if(find(a)==find(b)) merge(c, add(Operation::Mult, addConst(2), a));
+          forEach(b, Operation::Neg, [&](const Node &x) { merge(c, add(Operation::Minus, a, x.child[0])); });
+          // associativity: (x+y)+b = x+(y+b)
+          forEach(a, Operation::Plus, [&](const Node &x) {
+            merge(c, add(Operation::Plus, x.child[0], add(Operation::Plus, x.child[1], b)));
+          });
+          // factoring: x*y+x*v = x*(y+v); x*y+x = x*(y+1)
+          forEach(a, Operation::Mult, [&](const Node &x) {
+            if(find(x.child[0])==find(b))
+              merge(c, add(Operation::Mult, b, add(Operation::Plus, x.child[1], addConst(1))));
+            forEach(b, Operation::Mult, [&](const Node &y) {
+              if(find(x.child[0])==find(y.child[0]))
+                merge(c, add(Operation::Mult, x.child[0], add(Operation::Plus, x.child[1], y.child[1])));
+            });
+          });
+          // x/y+u/y = (x+u)/y
+          forEach(a, Operation::Div, [&](const Node &x) {
+            forEach(b, Operation::Div, [&](const Node &y) {
+              if(find(x.child[1])==find(y.child[1]))
+                merge(c, add(Operation::Div, add(Operation::Plus, x.child[0], y.child[0]), x.child[1]));
+            });
+          });
+          break;
+        case Operation::Minus:
+          if(find(a)==find(b)) merge(c, addConst(0));
+          if(isConst(cb, 0)) merge(c, a);
+          if(isConst(ca, 0)) merge(c, add(Operation::Neg, b));
+          merge(c, add(Operation::Plus, a, add(Operation::Neg, b))); // a-b = a+(-b): enables Plus rules
+          forEach(b, Operation::Neg, [&](const Node &x) { merge(c, add(Operation::Plus, a, x.child[0])); });
+          // factoring: x*y-x*v = x*(y-v)
+          forEach(a, Operation::Mult, [&](const Node &x) {
+            forEach(b, Operation::Mult, [&](const Node &y) {
+              if(find(x.child[0])==find(y.child[0]))
+                merge(c, add(Operation::Mult, x.child[0], add(Operation::Minus, x.child[1], y.child[1])));
+            });
+          });
+          forEach(a, Operation::Div, [&](const Node &x) {
+            forEach(b, Operation::Div, [&](const Node &y) {
+              if(find(x.child[1])==find(y.child[1]))
+                merge(c, add(Operation::Div, add(Operation::Minus, x.child[0], y.child[0]), x.child[1]));
+            });
+          });
+          break;
+        case Operation::Mult:
+          merge(c, add(Operation::Mult, b, a)); // commutativity
+          if(isConst(ca, 0) || isConst(cb, 0)) merge(c, addConst(0));
+          if(isConst(cb, 1)) merge(c, a);
+          if(isConst(cb, -1)) merge(c, add(Operation::Neg, a));
+          if(find(a)==find(b)) merge(c, add(Operation::Pow, a, addConst(2)));
+          // associativity: (x*y)*b = x*(y*b)
+          forEach(a, Operation::Mult, [&](const Node &x) {
+            merge(c, add(Operation::Mult, x.child[0], add(Operation::Mult, x.child[1], b)));
+          });
+          // distribution: a*(x+y) = a*x+a*y; a*(x-y) = a*x-a*y
+          forEach(b, Operation::Plus, [&](const Node &x) {
+            merge(c, add(Operation::Plus, add(Operation::Mult, a, x.child[0]), add(Operation::Mult, a, x.child[1])));
+          });
+          forEach(b, Operation::Minus, [&](const Node &x) {
+            merge(c, add(Operation::Minus, add(Operation::Mult, a, x.child[0]), add(Operation::Mult, a, x.child[1])));
+          });
+          forEach(a, Operation::Pow, [&](const Node &x) {
+            if(find(x.child[0])==find(b))
+              merge(c, add(Operation::Pow, b, add(Operation::Plus, x.child[1], addConst(1))));
+          });
+          forEach(a, Operation::Neg, [&](const Node &x) { merge(c, add(Operation::Neg, add(Operation::Mult, x.child[0], b))); });
+          forEach(b, Operation::Div, [&](const Node &x) {
+            merge(c, add(Operation::Div, add(Operation::Mult, a, x.child[0]), x.child[1]));
+          });
+          break;
+        case Operation::Div:
+          if(find(a)==find(b)) merge(c, addConst(1));
+          if(isConst(cb, 1)) merge(c, a);
+          if(isConst(ca, 0)) merge(c, addConst(0));
+          forEach(a, Operation::Div, [&](const Node &x) {
+            merge(c, add(Operation::Div, x.child[0], add(Operation::Mult, x.child[1], b)));
+          });
+          forEach(a, Operation::Mult, [&](const Node &x) {
+            if(find(x.child[0])==find(b))
+              merge(c, x.child[1]);
+          });
+          break;
+        case Operation::Neg:
+          forEach(a, Operation::Neg, [&](const Node &x) { merge(c, x.child[0]); });
+          forEach(a, Operation::Minus, [&](const Node &x) { merge(c, add(Operation::Minus, x.child[1], x.child[0])); });
+          break;
+        case Operation::Pow:
+          if(isConst(cb, 1)) merge(c, a);
+          if(isConst(cb, 0)) merge(c, addConst(1));
+          break;
+        default:
+          break;
+      }
+    }
+
+    mutable vector<Id> parent; // union-find of the classes (path compression in find)
+    vector<vector<Node>> classNodes; // the nodes of each class (empty for merged classes)
+    unordered_map<Node, Id, NodeHash> memo; // the class of each node
+    vector<SymbolicExpression> leaves;
+    unordered_map<const Vertex*, Id> leafIndex;
+    size_t nrNodes { 0 };
+    bool changed { false };
+    vector<vector<Node>> snapshot;
+    vector<optional<size_t>> snapshotConst;
+};
+
+vector<SymbolicExpression> ExpressionOptimizer::optimize(const vector<SymbolicExpression> &expr, Statistics *stat,
+                                                         const Options &options) {
+  Statistics s;
+  s.opsBefore=countOperations(expr);
+  s.costBefore=getCost(expr);
+
+  EGraph g;
+  auto root=g.addExpressions(expr);
+  g.saturate(options, s);
+  vector<SymbolicExpression> ret;
+  if(!g.extract(root, ret) || getCost(ret)>=s.costBefore)
+    ret=expr;
+
+  s.opsAfter=countOperations(ret);
+  s.costAfter=getCost(ret);
+  if(stat)
+    *stat=s;
+  return ret;
+}
+
+vector<const Vertex*> ExpressionOptimizer::getOperations(const vector<SymbolicExpression> &expr) {
+  // return the i-th child of v or nullptr if v has no more childs (the arguments of a NativeFunction are its childs)
+  auto child=[](const Vertex *v, size_t i) -> const Vertex* {
+    if(v->getKind()==Vertex::Kind::Operation) {
+      auto &c=static_cast<const Operation*>(v)->child;
+      return i<c.size() ? c[i].get() : nullptr;
+    }
+    if(v->getKind()==Vertex::Kind::NativeFunction) {
+      auto nf=static_cast<const NativeFunction*>(v);
+      for(auto *A : {&nf->argS, &nf->dir1S, &nf->dir2S}) {
+        if(i<A->size())
+          return (*A)[i].get();
+        i-=A->size();
+      }
+    }
+    return nullptr;
+  };
+  // a depth first walk using a explicit stack (large DAGs do not overflow the call stack)
+  vector<const Vertex*> ret;
+  unordered_set<const Vertex*> visited;
+  vector<pair<const Vertex*, size_t>> stack; // a vertex and the index of its next child to visit
+  for(auto &e : expr) {
+    if(!visited.insert(e.get()).second)
+      continue;
+    stack.emplace_back(e.get(), 0);
+    while(!stack.empty()) {
+      auto [v, next]=stack.back();
+      if(auto *c=child(v, next)) {
+        ++stack.back().second;
+        if(visited.insert(c).second)
+          stack.emplace_back(c, 0);
+        continue;
+      }
+      if(v->getKind()==Vertex::Kind::Operation || v->getKind()==Vertex::Kind::NativeFunction)
+        ret.emplace_back(v);
+      stack.pop_back();
+    }
+  }
+  return ret;
+}
+
+size_t ExpressionOptimizer::countOperations(const vector<SymbolicExpression> &expr) {
+  return getOperations(expr).size();
+}
+
+double ExpressionOptimizer::getCost(const vector<SymbolicExpression> &expr) {
+  double cost=0;
+  for(auto *v : getOperations(expr)) {
+    if(v->getKind()==Vertex::Kind::NativeFunction) {
+      cost+=nativeCost;
+      continue;
+    }
+    auto op=static_cast<const Operation*>(v);
+    bool powInt = op->getOp()==Operation::Pow && op->getChilds()[1]->isConstantInt();
+    cost+=opCost(op->getOp(), powInt);
+  }
+  return cost;
+}
+
+} // end namespace AST
+
+} // end namespace fmatvec
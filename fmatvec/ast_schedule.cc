@@ -0,0 +1,244 @@
+#include "ast.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+
+using namespace std;
+
+namespace fmatvec {
+
+namespace AST { // internal namespace
+
+namespace {
+  // wait until pred returns true: busy wait first and yield afterwards (at most maxSpin checks)
+  // returns the last result of pred
+  template<class Pred>
+  bool spinWait(const Pred &pred, size_t maxSpin=numeric_limits<size_t>::max()) {
+    constexpr size_t spinBeforeYield=1000;
+    for(size_t i=0; i<maxSpin; ++i) {
+      if(pred())
+        return true;
+      if(i>=spinBeforeYield)
+        this_thread::yield();
+    }
+    return pred();
+  }
+
+  size_t defaultNumberOfThreads() {
+    return std::max<size_t>(thread::hardware_concurrency(), 1);
+  }
+
+  atomic<size_t> serialThreshold { 10000 };
+
+  // A process wide pool of threads executing a job on all threads (including the caller thread) at once.
+  class WorkerPool {
+    public:
+      // the job is called with the worker index (0 is the caller thread) and the number of workers
+      using Job = function<void(size_t worker, size_t nrWorkers)>;
+
+      static WorkerPool& instance() {
+        static WorkerPool pool;
+        return pool;
+      }
+
+      ~WorkerPool() {
+        lock_guard<mutex> lock(runMutex);
+        stopThreads();
+      }
+
+      // run job on all workers and wait for its end.
+      // Returns false, without calling job, if the pool is in use by another thread or has only one worker.
+      bool tryRun(const Job &job) {
+        unique_lock<mutex> lock(runMutex, try_to_lock);
+        if(!lock || nrThreads<=1)
+          return false;
+        if(threads.empty())
+          startThreads();
+        currentJob=&job;
+        nrDone.store(0, memory_order_relaxed);
+        {
+          lock_guard<mutex> sleepLock(sleepMutex);
+          generation.fetch_add(1, memory_order_release);
+        }
+        wake.notify_all();
+        job(0, threads.size()+1);
+        spinWait([this]() { return nrDone.load(memory_order_acquire)==threads.size(); });
+        return true;
+      }
+
+      void setNumberOfThreads(size_t n) {
+        lock_guard<mutex> lock(runMutex);
+        stopThreads(); // the threads are started again at the next job
+        nrThreads=std::max<size_t>(n, 1);
+      }
+
+      size_t getNumberOfThreads() const {
+        return nrThreads;
+      }
+
+    private:
+      WorkerPool() = default;
+
+      void startThreads() {
+        auto gen=generation.load(memory_order_relaxed);
+        for(size_t w=1; w<nrThreads; ++w)
+          threads.emplace_back([this, w, gen]() { work(w, gen); });
+      }
+
+      void stopThreads() {
+        if(threads.empty())
+          return;
+        stop=true;
+        {
+          lock_guard<mutex> sleepLock(sleepMutex);
+          generation.fetch_add(1, memory_order_release);
+        }
+        wake.notify_all();
+        for(auto &t : threads)
+          t.join();
+        threads.clear();
+        stop=false;
+      }
+
+      void work(size_t worker, uint64_t seen) {
+        // spin this number of checks for a new job before going to sleep
+        constexpr size_t spinBeforeSleep=20000;
+        auto newJob=[this, &seen]() { return generation.load(memory_order_acquire)!=seen; };
+        while(true) {
+          if(!spinWait(newJob, spinBeforeSleep)) {
+            unique_lock<mutex> sleepLock(sleepMutex);
+            wake.wait(sleepLock, newJob);
+          }
+          seen=generation.load(memory_order_acquire);
+          if(stop)
+            return;
+          (*currentJob)(worker, threads.size()+1);
+          nrDone.fetch_add(1, memory_order_release);
+        }
+      }
+
+      mutex runMutex; // only one job at a time
+      atomic<size_t> nrThreads { defaultNumberOfThreads() };
+      vector<thread> threads;
+      const Job *currentJob { nullptr }; // published by generation
+      bool stop { false }; // published by generation
+      atomic<uint64_t> generation { 0 }; // incremented for each new job (and to stop the threads)
+      atomic<size_t> nrDone { 0 }; // the number of threads which have finished the current job
+      mutex sleepMutex;
+      condition_variable wake;
+  };
+}
+
+ByteCodeSchedule::ByteCodeSchedule(const vector<ByteCode> &byteCode_, const vector<bool> &serialOnly) :
+  byteCode(byteCode_) {
+  // the level of each entry: one more than the maximal level of all entries it reads from
+  vector<size_t> level(byteCode.size());
+  unordered_map<const double*, size_t> producer;
+  producer.reserve(byteCode.size());
+  for(size_t i=0; i<byteCode.size(); ++i) {
+    size_t l=0;
+    for(auto *a : byteCode[i].argsPtr)
+      if(auto it=producer.find(a); it!=producer.end())
+        l=std::max(l, level[it->second]+1);
+    level[i]=l;
+    nrLevels=std::max(nrLevels, l+1);
+    producer[byteCode[i].retPtr]=i;
+  }
+
+  // sort the entries by level (counting sort): the serialOnly entries first in each level
+  vector<size_t> levelSize(nrLevels, 0), levelSerialOnly(nrLevels, 0);
+  for(size_t i=0; i<byteCode.size(); ++i) {
+    levelSize[level[i]]++;
+    if(serialOnly[i])
+      levelSerialOnly[level[i]]++;
+  }
+  vector<size_t> nextSerialOnly(nrLevels), next(nrLevels);
+  for(size_t l=0, begin=0; l<nrLevels; begin+=levelSize[l], ++l) {
+    nextSerialOnly[l]=begin;
+    next[l]=begin+levelSerialOnly[l];
+  }
+  order.resize(byteCode.size());
+  for(size_t i=0; i<byteCode.size(); ++i)
+    order[serialOnly[i] ? nextSerialOnly[level[i]]++ : next[level[i]]++]=&byteCode[i];
+
+  // create the phases: large levels are executed in parallel, consecutive small levels are merged to a serial phase
+  for(size_t l=0, begin=0; l<nrLevels; begin+=levelSize[l], ++l) {
+    if(levelSize[l]>=minParallelLevelSize)
+      phase.push_back({begin, begin+levelSize[l], levelSerialOnly[l], true});
+    else if(!phase.empty() && !phase.back().parallel)
+      phase.back().end+=levelSize[l];
+    else
+      phase.push_back({begin, begin+levelSize[l], 0, false});
+  }
+}
+
+void ByteCodeSchedule::runPhase(const Phase &p, size_t worker, size_t nrWorkers) const {
+  auto exec=[this](size_t begin, size_t end) {
+    for(size_t i=begin; i<end; ++i)
+      order[i]->func(order[i]->retPtr, order[i]->argsPtr);
+  };
+  if(!p.parallel) {
+    if(worker==0)
+      exec(p.begin, p.end);
+    return;
+  }
+  // the serialOnly entries are executed by the caller thread, all others are split into equal parts
+  if(worker==0)
+    exec(p.begin, p.begin+p.nrSerialOnly);
+  auto begin=p.begin+p.nrSerialOnly;
+  auto n=p.end-begin;
+  exec(begin+n*worker/nrWorkers, begin+n*(worker+1)/nrWorkers);
+}
+
+void ByteCodeSchedule::operator()() const {
+  atomic<size_t> arrived { 0 };
+  atomic<bool> failed { false };
+  exception_ptr error;
+  WorkerPool::Job job([this, &arrived, &failed, &error](size_t worker, size_t nrWorkers) {
+    for(size_t p=0; p<phase.size(); ++p) {
+      // on an exception all workers skip the remaining phases but must still pass all barriers
+      if(!failed.load(memory_order_relaxed))
+        try {
+          runPhase(phase[p], worker, nrWorkers);
+        }
+        catch(...) {
+          if(!failed.exchange(true))
+            error=current_exception();
+        }
+      // barrier: wait until all workers have finished this phase
+      if(p+1<phase.size()) {
+        arrived.fetch_add(1, memory_order_acq_rel);
+        spinWait([&arrived, p, nrWorkers]() { return arrived.load(memory_order_acquire)>=(p+1)*nrWorkers; });
+      }
+    }
+  });
+
+  if(order.size()<serialThreshold || !WorkerPool::instance().tryRun(job)) {
+    for(auto &bc : byteCode)
+      bc.func(bc.retPtr, bc.argsPtr);
+    return;
+  }
+  if(error)
+    rethrow_exception(error);
+}
+
+void ByteCodeSchedule::setSerialThreshold(size_t n) {
+  serialThreshold=n;
+}
+
+size_t ByteCodeSchedule::getSerialThreshold() {
+  return serialThreshold;
+}
+
+void ByteCodeSchedule::setNumberOfThreads(size_t n) {
+  WorkerPool::instance().setNumberOfThreads(n);
+}
+
+size_t ByteCodeSchedule::getNumberOfThreads() {
+  return WorkerPool::instance().getNumberOfThreads();
+}
+
+} // end namespace AST
+
+} // end namespace fmatvec
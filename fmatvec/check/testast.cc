@@ -8,7 +8,11 @@
 #endif
 #include <cfenv>
 #include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <thread>
 #include "fmatvec/symbolic.h"
 #include "fmatvec/fmatvec.h"
 #include "fmatvec/linear_algebra_complex.h"
@@ -431,6 +435,758 @@ void checkRefMatrix() {
   cout<<"subMatparder = "<<parDer(sub, t)<<endl;
 }
 
+// a expression of each operation of a and b (and the extra expressions appended)
+Vector<Var, SymbolicExpression> allOperations(const IndependentVariable &a, const IndependentVariable &b,
+                                              const vector<SymbolicExpression> &extra={}) {
+  vector<SymbolicExpression> ops{a+b, a-b, a*b, a/b, pow(a,b), pow(a,3), log(a), sqrt(a), -a, sin(a), cos(a), tan(a),
+    sinh(a), cosh(a), tanh(a), asin(a), acos(a), atan(a), atan2(a,b), asinh(a), acosh(1+b), atanh(a), exp(a),
+    sign(a-b), heaviside(a-b), abs(a-b), fmatvec::min(a,b), fmatvec::max(a,b), condition(a-b, sin(b), cos(b)), 3.5, b};
+  ops.insert(ops.end(), extra.begin(), extra.end());
+  Vector<Var, SymbolicExpression> e(ops.size());
+  for(size_t i=0; i<ops.size(); ++i)
+    e(i)=ops[i];
+  return e;
+}
+
+void checkOpCode() {
+  // all operations evaluated using the ByteCode and the OpCode format must give bit-identical results
+  IndependentVariable a, b;
+  auto e=allOperations(a, b);
+  Eval byteCodeEval{e};
+  Eval opCodeEval{EvalFormat::OpCode, e};
+  for(auto [av, bv] : {make_pair(0.3, 0.7), make_pair(0.6, 0.2)}) {
+    a^=av;
+    b^=bv;
+    auto opCodeValue=opCodeEval();
+    cout<<"opcode eval = "<<opCodeValue<<endl;
+    cout<<"opcode == bytecode "<<(nrmInf(opCodeValue-byteCodeEval())==0)<<endl;
+  }
+
+  // slot reuse: a long chain of operations needs only a few slots for its intermediate values
+  SymbolicExpression chain=a;
+  for(int i=0; i<50; ++i)
+    chain=sin(chain)*b+a;
+  Eval chainEval{EvalFormat::OpCode, chain};
+  auto [slotsBefore, slotsAfter]=chainEval.getNumberOfSlots();
+  cout<<"opcode slots before reuse "<<slotsBefore<<" after reuse "<<slotsAfter<<endl;
+  cout<<"opcode chain == bytecode "<<(chainEval()==Eval{chain}())<<endl;
+}
+
+void checkAdjoint() {
+  // the adjoint mode must give the same partial derivatives as parDer (up to rounding)
+  IndependentVariable a, b;
+  Vector<Var, IndependentVariable> indep({a, b});
+  auto e=allOperations(a, b, {pow(sin(a*b),2.5)/(1+exp(-a)), a*a*a*b});
+  Eval parDerEval{parDer(e, indep)};
+  EvalAdjoint adjointEval(e, indep);
+  for(auto [av, bv] : {make_pair(0.3, 0.7), make_pair(0.6, 0.2)}) {
+    a^=av;
+    b^=bv;
+    auto jac=adjointEval();
+    cout<<"adjoint == parDer "<<(nrmInf(jac-parDerEval())<1e-13*nrmInf(jac))<<endl;
+  }
+
+  // the gradient of a long chain: the adjoint program grows only linear with the size of the expression
+  SymbolicExpression chain=a;
+  for(int i=0; i<50; ++i)
+    chain=sin(chain)*b+a;
+  auto grad=EvalAdjoint(chain, indep)();
+  auto gradParDer=Eval{parDer(chain, indep)}();
+  cout<<"adjoint chain == parDer "<<(nrmInf(grad-gradParDer)<1e-13*nrmInf(grad))<<endl;
+  cout<<"adjoint single derivative == parDer "<<(abs(EvalAdjoint(chain, b)()-gradParDer(1))<1e-13*nrmInf(grad))<<endl;
+#ifndef _WIN32
+  cout<<"adjoint jit == opcode "<<(EvalAdjoint(e, indep, EvalFormat::JIT)()==adjointEval())<<endl;
+#endif
+}
+
+void checkForward() {
+  // the forward mode must give the same directional derivatives as the derivative expressions (up to rounding)
+  IndependentVariable a, b;
+  Vector<Var, IndependentVariable> indep({a, b});
+  auto e=allOperations(a, b, {pow(sin(a*b),2.5)/(1+exp(-a)), a*a*a*b});
+  VecV dir1({0.4, -1.3}), dir2({0.9, 0.6});
+  Eval dirDerEval{parDer(e, indep)*dir1};
+  Eval dirDerDirDerEval{parDer(parDer(e, indep)*dir1, indep)*dir2};
+  EvalForward forwardEval(e, indep);
+  forwardEval.setDirection<0>(1, dir1);
+  forwardEval.setDirection<0>(2, dir2);
+  for(auto [av, bv] : {make_pair(0.3, 0.7), make_pair(0.6, 0.2)}) {
+    a^=av;
+    b^=bv;
+    auto dd=forwardEval.dirDer();
+    cout<<"forward dirDer == dirDer "<<(nrmInf(dd-dirDerEval())<1e-13*nrmInf(dd))<<endl;
+    auto dddd=forwardEval.dirDerDirDer();
+    cout<<"forward dirDerDirDer == dirDerDirDer "<<(nrmInf(dddd-dirDerDirDerEval())<1e-12*nrmInf(dddd))<<endl;
+  }
+
+  // two independent variables: the mixed second derivative
+  EvalForward forward2Eval(e, a, b);
+  forward2Eval.setDirection<0>(1, 2.0);
+  forward2Eval.setDirection<1>(2, 3.0);
+  auto mixed=Eval{parDer(parDer(e, a), b)*6}();
+  cout<<"forward mixed == parDer "<<(nrmInf(forward2Eval.dirDerDirDer()-mixed)<1e-12*nrmInf(mixed))<<endl;
+}
+
+void checkSparseParDer() {
+  // a banded Jacobian: the sparse Jacobian must hold exactly the nonzero entries of the dense Jacobian
+  constexpr int n=8;
+  Vector<Var, IndependentVariable> x(n);
+  for(auto &xi : x)
+    xi=IndependentVariable();
+  Vector<Var, SymbolicExpression> f(n), g(n-2);
+  for(int i=0; i<n; ++i)
+    f(i)=sin(x(i))*(i>0 ? x(i-1) : SymbolicExpression(1))+(i<n-1 ? pow(x(i+1),2) : SymbolicExpression(0));
+  for(int i=0; i<n-2; ++i)
+    g(i)=x(i)*x(i+2)-3;
+  for(int i=0; i<n; ++i)
+    x(i)^=0.1*(i+1);
+  auto check=[&x](const auto &dep, EvalFormat format) {
+    EvalSparseParDer sparseEval(dep, x, format);
+    auto &sparse=sparseEval();
+    auto dense=Eval{parDer(dep, x)}();
+    bool equal=true;
+    int nonZero=0;
+    for(int r=0; r<dense.rows(); ++r) {
+      for(int k=sparse.Ip()[r]; k<sparse.Ip()[r+1]; ++k)
+        if(sparse()[k]!=dense(r,sparse.Jp()[k]))
+          equal=false;
+      for(int c=0; c<dense.cols(); ++c)
+        if(dense(r,c)!=0)
+          nonZero++;
+    }
+    cout<<"sparse jacobian "<<sparse.rows()<<"x"<<sparse.cols()<<" nonzeros "<<sparseEval.nonZeroElements()
+        <<" (dense nonzeros "<<nonZero<<") == parDer "<<equal<<endl;
+  };
+  check(f, EvalFormat::OpCode); // square: the diagonal is stored first
+  check(g, EvalFormat::OpCode); // non-square
+#ifndef _WIN32
+  check(f, EvalFormat::JIT);
+#endif
+}
+
+void checkThreads() {
+  // build and evaluate independent models on several threads at once: all must give the same result as a serial run
+  auto model=[](double x0) {
+    IndependentVariable x, y;
+    SymbolicExpression f=x;
+    for(int i=0; i<200; ++i)
+      f=sin(f)*y+pow(x,2)/(1+i*y)+exp(-x*i);
+    x^=x0;
+    y^=0.3;
+    return Eval{parDer(f, x)}();
+  };
+  constexpr int nrThreads=4;
+  vector<double> serial(nrThreads), parallel(nrThreads);
+  for(int t=0; t<nrThreads; ++t)
+    serial[t]=model(0.1*t);
+  vector<thread> threads;
+  for(int t=0; t<nrThreads; ++t)
+    threads.emplace_back([t, &model, &parallel]() { parallel[t]=model(0.1*t); });
+  for(auto &t : threads)
+    t.join();
+  cout<<"threads == serial "<<(parallel==serial)<<endl;
+}
+
+void checkEvalInput() {
+  // evaluate the same expressions concurrently on several threads with different inputs
+  IndependentVariable x, y;
+  Vector<Var, SymbolicExpression> f({sin(x)*y, pow(x,3)+exp(y), atan2(x,y)});
+  EvalInput fEval({x, y}, f);
+  constexpr int nrThreads=4, nrPoints=1000;
+  auto input=[](int t, int p) { return array<double,2>{0.1*t+0.001*p, 0.3-0.0001*p}; };
+  vector<vector<double>> parallel(nrThreads, vector<double>(nrPoints*fEval.getOutputSize()));
+  vector<thread> threads;
+  for(int t=0; t<nrThreads; ++t)
+    threads.emplace_back([t, &input, &parallel, eval=fEval.clone()]() {
+      for(int p=0; p<nrPoints; ++p)
+        eval(input(t, p).data(), &parallel[t][p*eval.getOutputSize()]);
+    });
+  for(auto &t : threads)
+    t.join();
+  // compare with Eval (inputs set using the symbols)
+  Eval serialEval{f};
+  bool equal=true;
+  for(int t=0; t<nrThreads; ++t)
+    for(int p=0; p<nrPoints; ++p) {
+      auto in=input(t, p);
+      x^=in[0];
+      y^=in[1];
+      auto ref=serialEval();
+      for(int o=0; o<ref.size(); ++o)
+        if(ref(o)!=parallel[t][p*ref.size()+o])
+          equal=false;
+    }
+  cout<<"eval input threads == eval "<<equal<<endl;
+#ifndef _WIN32
+  EvalInput fEvalJIT(EvalFormat::JIT, {x, y}, f);
+  auto eval=fEvalJIT.clone();
+  equal=true;
+  for(int p=0; p<nrPoints; ++p) {
+    array<double,3> out, outJIT;
+    fEval(input(1, p).data(), out.data());
+    eval(input(1, p).data(), outJIT.data());
+    if(out!=outJIT)
+      equal=false;
+  }
+  cout<<"eval input JIT == opcode "<<equal<<endl;
+#endif
+}
+
+void checkByteCodeParallel() {
+  // a large expression with many independent outputs
+  IndependentVariable x, y;
+  constexpr int n=2000;
+  Vector<Var, SymbolicExpression> f(n);
+  SymbolicExpression s=0;
+  for(int i=0; i<n; ++i) {
+    s=s+sin(x*i)*cos(y+i);
+    f(i)=s*exp(-x*y/(i+1))+pow(x+i,2);
+  }
+  Eval fSerial{EvalFormat::ByteCode, f};
+  Eval fParallel{EvalFormat::ByteCodeParallel, f};
+  auto oldThreshold=AST::ByteCodeSchedule::getSerialThreshold();
+  auto oldThreads=AST::ByteCodeSchedule::getNumberOfThreads();
+  AST::ByteCodeSchedule::setSerialThreshold(1000);
+  AST::ByteCodeSchedule::setNumberOfThreads(4);
+  bool equal=true;
+  for(int p=0; p<20; ++p) {
+    x^=0.1+0.01*p;
+    y^=0.3-0.02*p;
+    // bitwise equal since the same operations are executed
+    auto ref=fSerial();
+    auto res=fParallel();
+    for(int i=0; i<n; ++i)
+      if(ref(i)!=res(i))
+        equal=false;
+  }
+  cout<<"bytecode parallel == bytecode "<<equal<<endl;
+  AST::ByteCodeSchedule::setSerialThreshold(oldThreshold);
+  AST::ByteCodeSchedule::setNumberOfThreads(oldThreads);
+}
+
+void checkExpressionCache() {
+  if(AST::ExpressionCache::getDirectory().empty())
+    AST::ExpressionCache::setDirectory("exprcache");
+  // derive the same expressions with new symbols each time: at least the second derivation is loaded from the cache
+  auto run=[](bool &derived) {
+    Vector<Var, IndependentVariable> q(2);
+    IndependentVariable p; // a symbol which is not a independent variable of the derivation
+    Vector<Var, SymbolicExpression> f({sin(q(0)*q(1))+pow(q(0),3)*exp(-q(1))*p, atan2(q(0),q(1))*cos(p)});
+    Matrix<General, Var, Var, SymbolicExpression> J;
+    SymbolicExpression h;
+    derived=false;
+    AST::cachedDerive("checkExpressionCache", forward_as_tuple(f), forward_as_tuple(q), [&]() {
+      derived=true;
+      J<<=parDer(f, q);
+      h<<=parDer(parDer(f(0), q(0)), q(1));
+    }, [&](auto &&func) {
+      func(J);
+      func(h);
+    });
+    q(0)^=0.3;
+    q(1)^=-0.7;
+    p^=1.2;
+    Eval eval{J, h};
+    auto [Jv, hv]=eval();
+    Eval evalRef{parDer(f, q), parDer(parDer(f(0), q(0)), q(1))};
+    auto [JvRef, hvRef]=evalRef();
+    bool equal=hv==hvRef && Jv.rows()==JvRef.rows() && Jv.cols()==JvRef.cols();
+    for(int r=0; equal && r<Jv.rows(); ++r)
+      for(int c=0; c<Jv.cols(); ++c)
+        if(Jv(r,c)!=JvRef(r,c))
+          equal=false;
+    return equal;
+  };
+  bool derived1, derived2;
+  bool equal1=run(derived1);
+  auto before=AST::ExpressionCache::getStatistics();
+  bool equal2=run(derived2);
+  auto after=AST::ExpressionCache::getStatistics();
+  cout<<"expression cache second derivation loaded "<<(!derived2 && after.hits==before.hits+1)<<endl;
+  cout<<"expression cache == derive "<<equal1<<" "<<equal2<<endl;
+
+  // a corrupted cache file is a cache miss: replace the graph of the stored entry by invalid graphs
+  auto tamper=[](const vector<uint8_t> &graph) {
+    const string tag("checkExpressionCache");
+    const size_t keyPos=8+sizeof(uint32_t)+sizeof(uint64_t); // after the magic, the byte order mark and the key size
+    for(auto &file : filesystem::directory_iterator(AST::ExpressionCache::getDirectory())) {
+      ifstream f(file.path(), ios::binary);
+      string data((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+      f.close();
+      if(data.compare(keyPos, tag.size()+1, tag+'\0')!=0)
+        continue;
+      uint64_t keySize;
+      memcpy(&keySize, data.data()+keyPos-sizeof(uint64_t), sizeof(uint64_t));
+      data.resize(keyPos+keySize);
+      data.append(graph.begin(), graph.end());
+      ofstream(file.path(), ios::binary)<<data;
+    }
+  };
+  auto u32=[](uint32_t x) { vector<uint8_t> r(4); memcpy(r.data(), &x, 4); return r; };
+  auto cat=[](initializer_list<vector<uint8_t>> l) { vector<uint8_t> r; for(auto &x : l) r.insert(r.end(), x.begin(), x.end()); return r; };
+  vector<uint8_t> one{0, 1,0,0,0,0,0,0,0}, zero{0, 0,0,0,0,0,0,0,0}; // ConstantLong 1 and 0
+  // a sin with 3 childs
+  auto wrongNrChilds=cat({u32(2), one, {3, AST::Operation::Sin, 3}, u32(0), u32(0), u32(0), u32(1), u32(1)});
+  // a division by the constant 0 (Operation::create throws)
+  auto divByZero=cat({u32(3), one, zero, {3, AST::Operation::Div, 2}, u32(0), u32(1), u32(1), u32(2)});
+  for(auto &graph : {wrongNrChilds, divByZero}) {
+    tamper(graph);
+    bool derived;
+    bool equal=run(derived);
+    cout<<"expression cache corrupted file derived "<<derived<<" "<<equal<<endl;
+  }
+
+  // a cache directory writable by others is never used (as a disabled cache)
+  auto cacheDir=AST::ExpressionCache::getDirectory();
+  filesystem::path sharedDir("exprcache_shared");
+  filesystem::create_directories(sharedDir);
+  filesystem::permissions(sharedDir, filesystem::perms::all);
+  AST::ExpressionCache::setDirectory(sharedDir.string());
+  bool derivedShared1, derivedShared2;
+  run(derivedShared1);
+  run(derivedShared2);
+  cout<<"expression cache shared dir used "<<(!derivedShared1 || !derivedShared2 || !filesystem::is_empty(sharedDir))<<endl;
+  filesystem::remove_all(sharedDir);
+  AST::ExpressionCache::setDirectory(cacheDir);
+}
+
+void checkLazyEval() {
+  // the expression and the Eval are created once on the first (concurrent) use
+  IndependentVariable x;
+  atomic<int> nrCreated { 0 };
+  LazyEval<SymbolicExpression> lazy;
+  lazy.reset([&x, &nrCreated]() {
+    nrCreated++;
+    return parDer(parDer(sin(x)*exp(x), x), x);
+  });
+  cout<<"lazy eval built before use "<<lazy.isBuilt()<<endl;
+  x^=0.4;
+  vector<thread> threads;
+  for(int t=0; t<4; ++t)
+    threads.emplace_back([&lazy]() { lazy.build(); });
+  for(auto &t : threads)
+    t.join();
+  cout<<"lazy eval built after use "<<lazy.isBuilt()<<" created "<<nrCreated<<" value "<<(*lazy)()<<endl;
+}
+
+class NativeCube : public Function<double(double)> {
+  public:
+    double operator()(const double &x) override { return x*x*x+1; }
+};
+
+void checkEvalBatch() {
+  // the batched evaluation must give the same values as Eval at each point
+  IndependentVariable a, b, c;
+  shared_ptr<Function<double(double)>> cube=make_shared<NativeCube>();
+  SymbolicExpression r=3*a+sin(b)*pow(c,3)+fmatvec::min(a,c)-condition(2*a-5, atan2(4*a, b*c), cos(4*b+c));
+  SymbolicExpression f=symbolicFunc(cube, a*b)+c; // with a NativeFunction
+  c^=0.4; // c is not a input of the batch: its current value is used
+  EvalBatch<SymbolicExpression, SymbolicExpression> batch({a, b}, r, f);
+  Eval<SymbolicExpression, SymbolicExpression> eval(r, f);
+  constexpr size_t n=2*EvalBatch<SymbolicExpression, SymbolicExpression>::lanes+5; // not a multiple of lanes
+  constexpr size_t ld=n+3;
+  vector<double> in(2*ld), out(2*ld);
+  for(size_t p=0; p<n; ++p) {
+    in[p]=0.1*p-1.3;
+    in[ld+p]=0.05*p+0.7;
+  }
+  batch(n, in.data(), out.data(), ld, ld);
+  bool equal=true;
+  for(size_t p=0; p<n; ++p) {
+    a^=in[p];
+    b^=in[ld+p];
+    auto [rv, fv]=eval();
+    equal=equal && std::abs(out[p]-rv)<1e-13*std::max(1.0, std::abs(rv)) &&
+                   std::abs(out[ld+p]-fv)<1e-13*std::max(1.0, std::abs(fv));
+  }
+  cout<<"batch equal "<<equal<<" outputs "<<batch.getOutputSize()<<endl;
+}
+
+void checkCacheGarbageCollect() {
+  // many temporary expressions: the expired cache entries are collected incrementally without a full garbage collect
+  IndependentVariable x;
+  auto before=SymbolicExpression::getCacheStatistics();
+  for(int i=0; i<100000; ++i)
+    SymbolicExpression tmp=sin(x*(i+0.5));
+  auto after=SymbolicExpression::getCacheStatistics();
+  cout<<"cache entries collected incrementally "<<(after.collected-before.collected>90000)<<
+        ", expired entries bounded "<<(after.expired<before.expired+1000)<<endl;
+}
+
+void checkJIT() {
+#ifndef _WIN32
+  // all operations evaluated using the JIT and the ByteCode format must give bit-identical results
+  IndependentVariable a, b;
+  auto e=allOperations(a, b);
+  Eval byteCodeEval{e};
+  Eval jitEval{EvalFormat::JIT, e};
+  for(auto [av, bv] : {make_pair(0.3, 0.7), make_pair(0.6, 0.2)}) {
+    a^=av;
+    b^=bv;
+    cout<<"jit == bytecode "<<(nrmInf(jitEval()-byteCodeEval())==0)<<endl;
+  }
+
+  // the same program is loaded from the on disk cache the second time
+  AST::OpCodeProgram program;
+  map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  program.addOutput(sin(a)*b, existingVertex);
+  AST::JITProgram jit1(program);
+  AST::JITProgram jit2(program);
+  double in[2], out[1];
+  for(size_t i=0; i<program.symbol.size(); ++i)
+    in[i]=program.symbol[i].first==a ? 0.3 : 0.7;
+  jit2(in, out);
+  cout<<"jit loaded from cache "<<jit2.loadedFromCache()<<" value "<<out[0]<<endl;
+
+  // a cache directory writable by others is never used: the program is compiled in a private temporary directory
+  string cacheDir(getenv("FMATVEC_JIT_CACHE_DIR") ? getenv("FMATVEC_JIT_CACHE_DIR") : "");
+  filesystem::path sharedDir("jitcache_shared");
+  filesystem::create_directories(sharedDir);
+  filesystem::permissions(sharedDir, filesystem::perms::all);
+  setenv("FMATVEC_JIT_CACHE_DIR", sharedDir.c_str(), 1);
+  AST::JITProgram jit3(program);
+  AST::JITProgram jit4(program);
+  jit4(in, out);
+  cout<<"jit shared cache dir used "<<(jit4.loadedFromCache() || !filesystem::is_empty(sharedDir))<<" value "<<out[0]<<endl;
+  filesystem::remove_all(sharedDir);
+  if(cacheDir.empty())
+    unsetenv("FMATVEC_JIT_CACHE_DIR");
+  else
+    setenv("FMATVEC_JIT_CACHE_DIR", cacheDir.c_str(), 1);
+#endif
+}
+
+void checkOptimizer() {
+  // the optimized expressions must be cheaper and give the same values (up to rounding)
+  IndependentVariable a, b, c, d;
+  Vector<Var, IndependentVariable> indep({a, b});
+  Vector<Var, SymbolicExpression> e({a*b+a*c+a*d, b/c+d/c-a/c, a*a*a+a*b-a*b, pow(sin(a),2)*cos(b)+pow(sin(a),2)*cos(a)});
+  Matrix<General, Var, Var, SymbolicExpression> jac=parDer(e, indep);
+  AST::ExpressionOptimizer::Statistics stat;
+  auto eOpt=AST::ExpressionOptimizer::optimize(e, &stat);
+  cout<<"optimizer ops "<<stat.opsBefore<<" -> "<<stat.opsAfter<<endl;
+  auto jacOpt=AST::ExpressionOptimizer::optimize(jac, &stat);
+  cout<<"optimizer jacobian cheaper "<<(stat.costAfter<stat.costBefore)<<endl;
+  Eval eEval{e}, eOptEval{eOpt};
+  Eval jacEval{jac}, jacOptEval{jacOpt};
+  for(auto v : {0.3, 0.8}) {
+    a^=v;
+    b^=v+0.2;
+    c^=v+0.5;
+    d^=v-0.1;
+    cout<<"optimized == original "<<(nrmInf(eOptEval()-eEval())<1e-14*nrmInf(eEval()))<<" "<<
+          (nrmInf(jacOptEval()-jacEval())<1e-14*nrmInf(jacEval()))<<endl;
+  }
+  // a deep chain is walked without recursion (its destruction still recurses: keep it moderate)
+  SymbolicExpression chain=a;
+  for(int i=0; i<2000; ++i)
+    chain=sin(chain)*b+c;
+  auto chainOpt=AST::ExpressionOptimizer::optimize(vector<SymbolicExpression>{chain});
+  cout<<"optimizer deep chain ops "<<AST::ExpressionOptimizer::countOperations({chain})<<" "<<
+        (AST::ExpressionOptimizer::countOperations(chainOpt)<=6000)<<endl;
+}
+
+void checkStrengthReduction() {
+  // integer powers, pow(x, 0.5) and sin/cos pairs are evaluated by cheaper instructions with the same values
+  IndependentVariable a, b;
+  Vector<Var, SymbolicExpression> e({pow(a,3), pow(b,-2), pow(a,0.5), sin(a), cos(a), sin(b)*cos(b)});
+  for(auto format : {EvalFormat::ByteCode, EvalFormat::OpCode}) {
+    Eval eval{format, e};
+    a^=0.7;
+    b^=1.3;
+    auto v=eval();
+    double av=0.7, bv=1.3;
+    VecV ref({av*av*av, 1/(bv*bv), std::sqrt(av), std::sin(av), std::cos(av), std::sin(bv)*std::cos(bv)});
+    cout<<"strength reduction == reference "<<(nrmInf(v-ref)==0)<<endl;
+  }
+  // pow(x, 0.5) keeps the values of pow also for the special arguments -0 (+0) and -inf (+inf)
+  auto samePow=[](double x, double v) { double p=std::pow(x, 0.5); return p==v && std::signbit(p)==std::signbit(v); };
+  vector<EvalFormat> formats{EvalFormat::ByteCode, EvalFormat::OpCode};
+#ifndef _WIN32
+  formats.emplace_back(EvalFormat::JIT);
+#endif
+  bool equal=true;
+  for(auto format : formats) {
+    Eval eval{format, pow(a,0.5)};
+    for(double x : {-0.0, 0.0, -numeric_limits<double>::infinity(), numeric_limits<double>::infinity(), 2.0}) {
+      a^=x;
+      equal = equal && samePow(x, eval());
+    }
+  }
+  auto folded=dynamic_pointer_cast<const AST::Constant<double>>(pow(SymbolicExpression(-numeric_limits<double>::infinity()), 0.5));
+  cout<<"strength reduction pow half special values "<<equal<<" "<<(folded && folded->getValue()==numeric_limits<double>::infinity())<<endl;
+}
+
+class NativeCount : public Function<double(double)> {
+  public:
+    double operator()(const double &x) override { ++calls; return x; }
+    size_t calls { 0 };
+};
+
+void checkLazyCondition() {
+  // the branch of a condition which is not selected is not evaluated
+  // but subexpressions shared with other outputs or the other branch must still be evaluated
+  IndependentVariable a, b;
+  auto gtCount=make_shared<NativeCount>(), ltCount=make_shared<NativeCount>();
+  shared_ptr<Function<double(double)>> gtFunc=gtCount, ltFunc=ltCount;
+  Eval countEval{condition(a, symbolicFunc(gtFunc, a*b)*2, symbolicFunc(ltFunc, a*b)*3)};
+  SymbolicExpression shared=sin(b)*b;
+  SymbolicExpression gt=log(a)*shared+exp(b);
+  SymbolicExpression lt=sqrt(-a)+shared*2+condition(b, cos(b)*b, log(-b));
+  Vector<Var, SymbolicExpression> e({condition(a, gt, lt), shared});
+  Eval eval{e};
+  for(auto [av, bv] : {make_pair(0.5, 0.3), make_pair(-0.5, 0.3), make_pair(-0.5, -0.3), make_pair(0.5, -0.3)}) {
+    a^=av;
+    b^=bv;
+    double s=std::sin(bv)*bv;
+    double ref=av>0 ? std::log(av)*s+std::exp(bv) : std::sqrt(-av)+s*2+(bv>0 ? std::cos(bv)*bv : std::log(-bv));
+    auto v=eval();
+    cout<<"lazy condition == reference "<<(v(0)==ref && v(1)==s)<<endl;
+    // only the native function of the selected branch is called
+    size_t gtCalls=gtCount->calls, ltCalls=ltCount->calls;
+    double c=countEval();
+    cout<<"lazy condition calls "<<gtCount->calls-gtCalls<<ltCount->calls-ltCalls<<" "<<
+          (c==(av>0 ? av*bv*2 : av*bv*3))<<endl;
+  }
+}
+
+void checkIncremental() {
+  // only the instructions depending on changed independent variables are executed: the results must be equal to a
+  // full evaluation for any sequence of changes
+  IndependentVariable q, p1, p2;
+  Vector<Var, SymbolicExpression> e({sin(q)*p1+pow(p2,2), exp(p1*p2), q*q+3, p2});
+  Eval fullEval{e};
+  Eval incEval{EvalFormat::ByteCodeIncremental, e};
+  q^=0.2; p1^=1.5; p2^=-0.5;
+  bool equal=nrmInf(incEval()-fullEval())==0;
+  for(int i=1; i<=5; ++i) {
+    q^=0.2+0.1*i; // only q changes (the usual case in time integration)
+    equal = equal && nrmInf(incEval()-fullEval())==0;
+    if(i==3) {
+      p2^=0.7; // a parameter changes
+      equal = equal && nrmInf(incEval()-fullEval())==0;
+    }
+    equal = equal && nrmInf(incEval()-fullEval())==0; // nothing changed
+  }
+  cout<<"incremental == full "<<equal<<endl;
+}
+
+void checkSubset() {
+  // a subset of the outputs (here the second row of a matrix) gives the same values as the full evaluation
+  IndependentVariable a, b;
+  Matrix<General, Var, Var, SymbolicExpression> m(2, 3);
+  m(0,0)=sin(a)*exp(b); m(0,1)=pow(a,3)+b; m(0,2)=condition(a-b, log(a), cos(b));
+  m(1,0)=sin(a)*b;      m(1,1)=condition(b, sqrt(b)*a, a-b); m(1,2)=atan2(a, b)*sin(a);
+  a^=0.8;
+  b^=0.3;
+  auto full=Eval{m}();
+  for(auto format : {EvalFormat::ByteCode, EvalFormat::ByteCodeIncremental, EvalFormat::OpCode, EvalFormat::JIT}) {
+#ifdef _WIN32
+    if(format==EvalFormat::JIT)
+      continue;
+#endif
+    Eval eval{format, m};
+    auto row1=eval.addSubset({3, 4, 5}); // the outputs in the order of the matrix iterator: m(1,0), m(1,1), m(1,2)
+    auto &r=eval(row1);
+    bool unknownThrows=false;
+    try { eval(row1+1); } catch(const out_of_range &) { unknownThrows=true; }
+    cout<<"subset == full "<<(r(1,0)==full(1,0) && r(1,1)==full(1,1) && r(1,2)==full(1,2))<<
+          " unknown subset throws "<<unknownThrows<<endl;
+  }
+}
+
+void checkBindOutput() {
+  // the outputs are written directly to a part of a larger caller-owned matrix
+  IndependentVariable a, b;
+  Matrix<General, Var, Var, SymbolicExpression> m(2, 3);
+  m(0,0)=sin(a)*exp(b); m(0,1)=pow(a,3)+b;   m(0,2)=condition(a-b, log(a), cos(b));
+  m(1,0)=sin(a)*b;      m(1,1)=sqrt(b)*a;    m(1,2)=atan2(a, b)*sin(a);
+  Vector<Var, SymbolicExpression> v(2);
+  v(0)=a*b; v(1)=exp(a)-b;
+  SymbolicExpression s=a/b;
+  b^=0.3;
+  for(auto format : {EvalFormat::ByteCode, EvalFormat::ByteCodeParallel, EvalFormat::ByteCodeIncremental,
+                     EvalFormat::OpCode, EvalFormat::JIT}) {
+#ifdef _WIN32
+    if(format==EvalFormat::JIT)
+      continue;
+#endif
+    a^=0.8;
+    Eval ref{format, m, v, s};
+    auto [mFull, vFull, sFull]=ref();
+    Eval eval{format, m, v, s};
+    Matrix<General, Ref, Ref, double> big(5, 4, INIT, 0.0), mDst;
+    mDst.ref(big, RangeV(1,2), RangeV(1,3));
+    double sDst=0;
+    eval.bindOutput<0>(mDst);
+    eval.bindOutput<1>(&big(3,0), big.ldim()); // the first two elements of row 3
+    eval.bindOutput<2>(sDst);
+    eval();
+    bool equal=sDst==sFull && big(3,0)==vFull(0) && big(3,1)==vFull(1);
+    for(int r=0; r<2; ++r)
+      for(int c=0; c<3; ++c)
+        equal=equal && big(1+r,1+c)==mFull(r,c);
+    // rebinding and a new evaluation
+    Vector<Var, double> vDst(2, INIT, 0.0);
+    eval.bindOutput<1>(vDst);
+    a^=0.7;
+    auto [mFull2, vFull2, sFull2]=ref();
+    eval();
+    equal=equal && vDst(0)==vFull2(0) && vDst(1)==vFull2(1) && big(2,3)==mFull2(1,2) && sDst==sFull2;
+    cout<<"bound outputs equal "<<equal<<endl;
+  }
+}
+
+void checkBinarySerialization() {
+  // a expression with many shared subexpressions: the tree form grows exponentially, the binary form linearly
+  IndependentVariable x, y;
+  SymbolicExpression e=x;
+  for(int i=0; i<25; ++i)
+    e=sin(e)*e+y;
+  auto d=e*cos(e)-x;
+  stringstream str;
+  writeBinary(str, {e, d, 3.5});
+  writeBinary(str, {x*y}); // a second record in the same stream
+  auto nrOperations=AST::ExpressionOptimizer::countOperations({e, d});
+  cout<<"binary size linear "<<(str.str().size()<20*(nrOperations+10))<<endl;
+  auto se=readBinary(str);
+  auto se2=readBinary(str);
+  cout<<"binary read equal "<<(se.size()==3 && se[0]==e && se[1]==d && se[2]==SymbolicExpression(3.5) &&
+                               se2.size()==1 && se2[0]==x*y)<<endl;
+  bool thrown=false;
+  try { readBinary(str); } catch(const runtime_error &) { thrown=true; }
+  cout<<"binary read end throws "<<thrown<<endl;
+  // invalid data throws: the layout of {sin(x)} is magic, bom, nrSymbols (at 12), uuid, graphSize (at 32), graph
+  // with nrVertices, symbol x, sin (nrChilds at 51) and roots
+  stringstream valid;
+  writeBinary(valid, {sin(x)});
+  auto invalidThrows=[&valid](size_t pos, const string &bytes, size_t size=string::npos) {
+    auto data=valid.str().substr(0, size);
+    data.replace(pos, bytes.size(), bytes);
+    stringstream invalid(data);
+    try { readBinary(invalid); } catch(const runtime_error &) { return true; }
+    return false;
+  };
+  cout<<"binary read invalid throws "<<invalidThrows(0, "", valid.str().size()-3)<<
+        invalidThrows(12, string(4, '\xff'))<<invalidThrows(32, string(7, '\xff'))<<invalidThrows(51, "\x02")<<endl;
+}
+
+void checkCreateFastPath() {
+  // constants are folded to the same value as the evaluation of the operation
+  IndependentVariable x, y;
+  x^=0.7;
+  y^=3.0;
+  bool equal=true;
+  for(auto &f : vector<function<SymbolicExpression(const SymbolicExpression&, const SymbolicExpression&)>>{
+    [](auto &a, auto &b) { return a/b; }, [](auto &a, auto &b) { return pow(a, b); },
+    [](auto &a, auto &b) { return atan2(a, b); }, [](auto &a, auto &b) { return sin(a)+b; },
+    [](auto &a, auto &b) { return exp(a)*cosh(b); }, [](auto &a, auto &b) { return condition(a-b, log(a), sqrt(b)); },
+    [](auto &a, auto &b) { return heaviside(a)-sign(b)+fmatvec::min(a, b)*fmatvec::max(a, b); } }) {
+    auto folded=f(SymbolicExpression(0.7), SymbolicExpression(3));
+    equal=equal && Eval{folded}()==Eval{f(x, y)}();
+  }
+  cout<<"constant folding equal "<<equal<<endl;
+  // the rules of Operation::create
+  cout<<"rules "<<(x*1.0==x)<<(x*x==pow(x,2))<<(pow(x,y)*x==pow(x,y+1))<<(x-x==SymbolicExpression(0))<<(x*y!=x)<<endl;
+  // the optimized expressions are built from the matched expressions (also if these are operations)
+  auto s=sin(x);
+  cout<<"rules build "<<(s*pow(s,y)==pow(s,y+1))<<(pow(s,y)/s==pow(s,y-1))<<(pow(s,-1)==1/s)<<(0-s==-s)<<
+        (pow(s,s*y)*s==pow(s,s*y+1))<<endl;
+}
+
+void checkDAGParDerSubst() {
+  // a deep chain with many shared subexpressions: the recursive differentiation would be exponential
+  IndependentVariable x, y, z;
+  SymbolicExpression e=x;
+  for(int i=0; i<1000; ++i)
+    e=sin(e)*e+y*(i%3==0 ? z : x);
+  auto der=parDer(vector<SymbolicExpression>{e, x*y}, vector<IndependentVariable>{x, y, z});
+  cout<<"dag parDer size "<<der.size()<<" "<<(der[3]==y)<<(der[4]==x)<<(der[5]==SymbolicExpression(0))<<endl;
+  auto nrOperations=AST::ExpressionOptimizer::countOperations({e});
+  cout<<"dag parDer linear "<<(AST::ExpressionOptimizer::countOperations({der[0], der[1], der[2]})<20*nrOperations)<<endl;
+  // compare with the finite differences of a small part
+  SymbolicExpression f=x;
+  for(int i=0; i<10; ++i)
+    f=sin(f)*f+y*x;
+  Vector<Var, IndependentVariable> xy(2);
+  xy(0)=x; xy(1)=y;
+  RowVector<Var, SymbolicExpression> fd=parDer(f, xy);
+  auto fVec=parDer(vector<SymbolicExpression>{f}, vector<IndependentVariable>{x, y});
+  x^=0.3;
+  y^=0.2;
+  double h=1e-7;
+  double f0=Eval{f}();
+  x^=0.3+h;
+  double fx=Eval{f}();
+  x^=0.3;
+  cout<<"dag parDer value "<<(std::abs(Eval{fVec[0]}()-(fx-f0)/h)<1e-5)<<(Eval{fd(1)}()==Eval{fVec[1]}())<<endl;
+  // many substitutions in one traversal (simultaneous: x in the substitute of y is not substituted again)
+  auto s=AST::substScalar(vector<SymbolicExpression>{e, x*y+z}, vector<IndependentVariable>{x, y},
+                          vector<SymbolicExpression>{y, x});
+  cout<<"dag subst "<<(s[1]==y*x+z)<<(AST::substScalar(s, {x, y}, {y, x})[0]==e)<<endl;
+}
+
+void checkByteCodeBuilder() {
+  // shared subexpressions, sin/cos of the same argument and a Condition (lazy in EvalFormat::ByteCode: general path)
+  IndependentVariable x, y;
+  auto s=sin(x*y)+cos(x*y);
+  Vector<Var, SymbolicExpression> v(3);
+  v(0)=s*s+x;
+  v(1)=pow(s, 3)-y/x;
+  v(2)=condition(x-y, v(0), v(1));
+  auto noCond=v(0)*v(1)+y;
+  bool equal=true;
+  for(auto format : { EvalFormat::ByteCode, EvalFormat::ByteCodeParallel, EvalFormat::ByteCodeIncremental }) {
+    Eval evalV(format, v, noCond);
+    Eval evalRef(EvalFormat::OpCode, v, noCond);
+    for(double xv : { 0.3, 0.7, 1.2 }) {
+      x^=xv;
+      y^=0.5;
+      auto [rv, rNoCond]=evalV();
+      auto [refV, refNoCond]=evalRef();
+      for(int i=0; i<3; ++i)
+        equal=equal && std::abs(rv(i)-refV(i))<1e-12;
+      equal=equal && std::abs(rNoCond-refNoCond)<1e-12;
+    }
+  }
+  cout<<"bytecode builder equal "<<equal<<endl;
+}
+
+void checkExpressionArena() {
+  // build a large model directly in the arena
+  IndependentVariable x, y;
+  AST::ExpressionArena arena;
+  auto ax=arena.symbol(x);
+  auto ay=arena.symbol(y);
+  auto e=ax;
+  for(int i=0; i<1000; ++i)
+    e=arena.operation(AST::Operation::Plus, { arena.operation(AST::Operation::Mult,
+      { arena.operation(AST::Operation::Sin, { e }), arena.constant(0.5) }), i%2==0 ? ax : ay });
+  cout<<"arena node size "<<sizeof(AST::ExpressionArena::Node)<<" nodes "<<arena.size()<<
+        " same symbol "<<(arena.symbol(x)==ax)<<endl;
+  // the same model built by SymbolicExpression
+  SymbolicExpression f=x;
+  for(int i=0; i<1000; ++i)
+    f=sin(f)*0.5+(i%2==0 ? x : y);
+  x^=0.3;
+  y^=0.2;
+  auto fArena=arena.toSymbolicExpression(e);
+  cout<<"arena export equal "<<(fArena==f)<<(Eval{fArena}()==Eval{f}())<<endl;
+  // import and export again: shared subexpressions are shared in the arena
+  auto s=sin(x*y);
+  AST::ExpressionArena arena2;
+  auto idx=arena2.import({ s+1, s*s, condition(x-y, s, x) });
+  cout<<"arena import nodes "<<arena2.size()<<" constant "<<arena2.getConstant(arena2[idx[0]].arg[1])<<endl;
+  auto back=arena2.toSymbolicExpression(idx);
+  cout<<"arena roundtrip equal "<<(back[0]==s+1)<<(back[1]==s*s)<<(back[2]==condition(x-y, s, x))<<endl;
+  try {
+    arena2.operation(AST::Operation::Plus, { idx[0] });
+  }
+  catch(const exception &ex) {
+    cout<<"arena error: "<<ex.what()<<endl;
+  }
+}
+
 int main() {
 #ifdef _WIN32
   SetConsoleCP(CP_UTF8);
@@ -451,6 +1207,29 @@ int main() {
   checkSymReread(pdn0Value, v, a_, a5, a6, pdn0Ser);
   checkSymRereadExistingIndeps(pdn0Value, v, a_, a5, a6, pdn0Ser);
   checkRefMatrix();
+  checkOpCode();
+  checkJIT();
+  checkAdjoint();
+  checkForward();
+  checkSparseParDer();
+  checkThreads();
+  checkCacheGarbageCollect();
+  checkEvalBatch();
+  checkEvalInput();
+  checkByteCodeParallel();
+  checkExpressionCache();
+  checkLazyEval();
+  checkOptimizer();
+  checkStrengthReduction();
+  checkLazyCondition();
+  checkIncremental();
+  checkSubset();
+  checkBindOutput();
+  checkBinarySerialization();
+  checkCreateFastPath();
+  checkDAGParDerSubst();
+  checkByteCodeBuilder();
+  checkExpressionArena();
 
   return 0;  
 }
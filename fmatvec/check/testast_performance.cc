@@ -15,6 +15,9 @@ int main() {
 #endif
 
   double rSumSym=0;
+  double rSumOpCode=0;
+  double rSumBatch=0;
+  double rSumJIT=0;
   double rSumNative=0;
   {
     IndependentVariable a;
@@ -35,6 +38,72 @@ int main() {
     cout<<"r.eval.SUM = "<<rSumSym<<endl;
     cout<<"execution time of symbolic performance test with N="<<N<<": "<<delta.count()<<"sec (about factor 2 slower)"<<endl;
   }
+  {
+    IndependentVariable a;
+    IndependentVariable b;
+    IndependentVariable c;
+    SymbolicExpression r=3*a+sin(b)*pow(c,3)+fmatvec::min(a,c)-condition(2*a+5, atan2(4*a, b*c), cos(4*b+c));
+    Eval rEval{EvalFormat::OpCode, r};
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int i=0; i<N; ++i)
+    {
+      a^=4.7+static_cast<double>(i)/N;
+      b^=8.3+static_cast<double>(i)/N;
+      c^=2.9+static_cast<double>(i)/N;
+      rSumOpCode+=rEval()/N;
+    }
+    auto end=std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> delta=end-start;
+    cout<<"r.eval.SUM = "<<rSumOpCode<<endl;
+    cout<<"execution time of opcode symbolic performance test with N="<<N<<": "<<delta.count()<<"sec"<<endl;
+  }
+  {
+    IndependentVariable a;
+    IndependentVariable b;
+    IndependentVariable c;
+    SymbolicExpression r=3*a+sin(b)*pow(c,3)+fmatvec::min(a,c)-condition(2*a+5, atan2(4*a, b*c), cos(4*b+c));
+    EvalBatch rEval({a, b, c}, r);
+    constexpr int B=1024; // number of points per call
+    vector<double> in(3*B), out(B);
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int i0=0; i0<N; i0+=B)
+    {
+      int n=std::min(B, N-i0);
+      for(int p=0; p<n; ++p) {
+        in[    p]=4.7+static_cast<double>(i0+p)/N;
+        in[  B+p]=8.3+static_cast<double>(i0+p)/N;
+        in[2*B+p]=2.9+static_cast<double>(i0+p)/N;
+      }
+      rEval(n, in.data(), out.data(), B);
+      for(int p=0; p<n; ++p)
+        rSumBatch+=out[p]/N;
+    }
+    auto end=std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> delta=end-start;
+    cout<<"r.eval.SUM = "<<rSumBatch<<endl;
+    cout<<"execution time of batched symbolic performance test with N="<<N<<": "<<delta.count()<<"sec"<<endl;
+  }
+#ifndef _WIN32
+  {
+    IndependentVariable a;
+    IndependentVariable b;
+    IndependentVariable c;
+    SymbolicExpression r=3*a+sin(b)*pow(c,3)+fmatvec::min(a,c)-condition(2*a+5, atan2(4*a, b*c), cos(4*b+c));
+    Eval rEval{EvalFormat::JIT, r};
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int i=0; i<N; ++i)
+    {
+      a^=4.7+static_cast<double>(i)/N;
+      b^=8.3+static_cast<double>(i)/N;
+      c^=2.9+static_cast<double>(i)/N;
+      rSumJIT+=rEval()/N;
+    }
+    auto end=std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> delta=end-start;
+    cout<<"r.eval.SUM = "<<rSumJIT<<endl;
+    cout<<"execution time of jit symbolic performance test with N="<<N<<": "<<delta.count()<<"sec"<<endl;
+  }
+#endif
   {
     double a;
     double b;
@@ -56,5 +125,9 @@ int main() {
     cout<<"execution time of native performance test with N="<<N<<": "<<delta.count()<<"sec (about factor 2 faster)"<<endl;
   }
 
-  return rSumSym != rSumNative;
+  return rSumSym != rSumNative || rSumOpCode != rSumNative || rSumBatch != rSumNative
+#ifndef _WIN32
+         || rSumJIT != rSumNative
+#endif
+  ;
 }
@@ -121,6 +121,15 @@ int main() {
     dumpV(funcRV.dirDerDirDer(argd, argd2, arg));
     dumpM(funcM.dirDerDirDer(argd, argd2, arg));
     dumpM(funcR.dirDerDirDer(argd, argd2, arg));
+
+    // fused evaluation of the value and its derivatives
+    auto [valS, pdS, pdpdS]=funcS.valueParDerAndParDerParDer(arg);
+    cout<<check(valS, funcS(arg))<<endl;
+    cout<<check(pdS, funcS.parDer(arg))<<endl;
+    cout<<check(pdpdS, funcS.parDerParDer(arg))<<endl;
+    auto [valV, pdV]=funcV.valueAndParDer(arg);
+    dumpV(valV);
+    dumpV(pdV);
   }
 
   {
@@ -291,6 +300,55 @@ int main() {
     funcRV.parDer2DirDer1(arg1Dir, arg1, arg2);
     funcM .parDer2DirDer1(arg1Dir, arg1, arg2);
     funcR .parDer2DirDer1(arg1Dir, arg1, arg2);
+
+    // fused evaluation of the value and its derivatives (compared with the separate evaluations)
+    SymbolicFunction<double(double, double)> fusedS(x1, x2, sin(x1)*x2*x2+x1*x1*x2);
+    Vector<Fixed<3>, SymbolicExpression> fusedVector;
+    fusedVector(0)=x1*x2; fusedVector(1)=cos(x1)*x2; fusedVector(2)=x1*x1*exp(x2);
+    SymbolicFunction<Vec3(double, double)> fusedV(x1, x2, fusedVector);
+    auto checkV=[](const Vec3 &a, const Vec3 &b) {
+      return check(a(0), b(0))+", "+check(a(1), b(1))+", "+check(a(2), b(2));
+    };
+    auto statBefore=AST::ExpressionCache::getStatistics();
+    {
+      auto [valS, pdS]=fusedS.valueAndParDer1(arg1, arg2);
+      cout<<check(valS, fusedS(arg1, arg2))<<endl;
+      cout<<check(pdS, fusedS.parDer1(arg1, arg2))<<endl;
+      auto [valV, pdV]=fusedV.valueAndParDer1(arg1, arg2);
+      cout<<checkV(valV, fusedV(arg1, arg2))<<endl;
+      cout<<checkV(pdV, fusedV.parDer1(arg1, arg2))<<endl;
+    }
+    {
+      auto [valS, pdS]=fusedS.valueAndParDer2(arg1, arg2);
+      cout<<check(valS, fusedS(arg1, arg2))<<endl;
+      cout<<check(pdS, fusedS.parDer2(arg1, arg2))<<endl;
+      auto [valV, pdV]=fusedV.valueAndParDer2(arg1, arg2);
+      cout<<checkV(valV, fusedV(arg1, arg2))<<endl;
+      cout<<checkV(pdV, fusedV.parDer2(arg1, arg2))<<endl;
+    }
+    {
+      auto [valS, pdS, pdpdS]=fusedS.valueParDer1AndParDer1ParDer1(arg1, arg2);
+      cout<<check(valS, fusedS(arg1, arg2))<<endl;
+      cout<<check(pdS, fusedS.parDer1(arg1, arg2))<<endl;
+      cout<<check(pdpdS, fusedS.parDer1ParDer1(arg1, arg2))<<endl;
+      auto [valV, pdV, pdpdV]=fusedV.valueParDer1AndParDer1ParDer1(arg1, arg2);
+      cout<<checkV(valV, fusedV(arg1, arg2))<<endl;
+      cout<<checkV(pdV, fusedV.parDer1(arg1, arg2))<<endl;
+      cout<<checkV(pdpdV, fusedV.parDer1ParDer1(arg1, arg2))<<endl;
+    }
+    {
+      auto [valS, pdS, pdpdS]=fusedS.valueParDer2AndParDer2ParDer2(arg1, arg2);
+      cout<<check(valS, fusedS(arg1, arg2))<<endl;
+      cout<<check(pdS, fusedS.parDer2(arg1, arg2))<<endl;
+      cout<<check(pdpdS, fusedS.parDer2ParDer2(arg1, arg2))<<endl;
+      auto [valV, pdV, pdpdV]=fusedV.valueParDer2AndParDer2ParDer2(arg1, arg2);
+      cout<<checkV(valV, fusedV(arg1, arg2))<<endl;
+      cout<<checkV(pdV, fusedV.parDer2(arg1, arg2))<<endl;
+      cout<<checkV(pdpdV, fusedV.parDer2ParDer2(arg1, arg2))<<endl;
+    }
+    // each derivative is derived once (pd1, pd2, pd1pd1 and pd2pd2 of both functions): the fused evaluators reuse these
+    auto statAfter=AST::ExpressionCache::getStatistics();
+    cout<<"number of derivations "<<statAfter.hits+statAfter.misses-statBefore.hits-statBefore.misses<<endl;
   }
 
   {
@@ -701,6 +759,16 @@ int main() {
     cout<<check(Eval{parDer(parDer(resN,i2),i2)}(), Eval{parDer(parDer(resS,i2),i2)}())<<endl;
     cout<<check(Eval{parDer(parDer(resN,i1),i2)}(), Eval{parDer(parDer(resS,i1),i2)}())<<endl;
     cout<<check(Eval{parDer(parDer(resN,i2),i1)}(), Eval{parDer(parDer(resS,i2),i1)}())<<endl;
+    // adjoint mode: the gradient of the native function and of its first derivative
+    Vector<Var, IndependentVariable> i12({i1, i2});
+    auto adjN=EvalAdjoint(resN, i12)();
+    auto adjS=Eval{parDer(resS, i12)}();
+    cout<<check(adjN(0), adjS(0))<<endl;
+    cout<<check(adjN(1), adjS(1))<<endl;
+    auto adjDerN=EvalAdjoint(parDer(resN,i1), i12)();
+    auto adjDerS=Eval{parDer(parDer(resS,i1), i12)}();
+    cout<<check(adjDerN(0), adjDerS(0))<<endl;
+    cout<<check(adjDerN(1), adjDerS(1))<<endl;
   }
 
   // native function with one vector argument as symbolic function
@@ -1114,5 +1182,33 @@ int main() {
     cout<<check(Eval{parDer(parDer(resN,i2),i1)}(), Eval{parDer(parDer(resS,i2),i1)}())<<endl;
   }
 
+  {
+    // the evaluators requested by setPrebuildDerivativeOrder are built, even if init() was already called by the ctor
+    class Func : public SymbolicFunction<double(double)> {
+      public:
+        using SymbolicFunction<double(double)>::SymbolicFunction;
+        string built() const {
+          return to_string(lazy->pdEval.isBuilt())+to_string(lazy->fwdEval.isBuilt())+to_string(lazy->pdpdEval.isBuilt());
+        }
+    };
+    IndependentVariable x;
+    Func func(x, sin(x)*x);
+    cout<<"prebuilt derivatives "<<func.built();
+    func.setPrebuildDerivativeOrder(1);
+    cout<<" "<<func.built();
+    func.setPrebuildDerivativeOrder(2);
+    cout<<" "<<func.built()<<endl;
+  }
+
+  {
+    // a SymbolicFunction is movable: the lazily built evaluators are moved with it
+    IndependentVariable x;
+    SymbolicFunction<double(double)> func(x, sin(x)*x);
+    auto pd=func.parDer(0.3);
+    SymbolicFunction<double(double)> moved(std::move(func));
+    cout<<"moved function "<<(moved(0.3)==std::sin(0.3)*0.3)<<(moved.parDer(0.3)==pd)<<
+          (moved.parDerParDer(0.3)==Eval{parDer(parDer(sin(x)*x, x), x)}())<<endl;
+  }
+
   return 0;  
 }
@@ -3,7 +3,9 @@
 
 #include "ast.h"
 #include <set>
+#include <atomic>
 #include "function.h"
+#include "sparse_matrix.h"
 #include <boost/hana/type.hpp>
 
 namespace fmatvec {
@@ -20,10 +22,22 @@ Dep parDer(const Dep &dep, const ATIndep &indep) {
     ret.resize(dep.size());
   else
     ret.resize(dep.rows(), dep.cols());
-  auto d=dep.begin();
-  auto r=ret.begin();
-  for(; d!=dep.end(); ++d, ++r)
-    *r=parDer(*d, indep);
+  if constexpr (std::is_same_v<ATIndep, IndependentVariable> && !std::is_same_v<Dep, SymbolicExpression>) {
+    // differentiate all entries at once: shared vertices are differentiated only once
+    std::vector<SymbolicExpression> depVec;
+    for(auto d=dep.begin(); d!=dep.end(); ++d)
+      depVec.emplace_back(*d);
+    auto der=parDer(depVec, std::vector<IndependentVariable>{indep});
+    auto r=ret.begin();
+    for(size_t i=0; i<der.size(); ++i, ++r)
+      *r=der[i];
+  }
+  else {
+    auto d=dep.begin();
+    auto r=ret.begin();
+    for(; d!=dep.end(); ++d, ++r)
+      *r=parDer(*d, indep);
+  }
   return ret;
 }
 
@@ -44,9 +58,24 @@ Vector<Fixed<3>, ATDep> parDer(const Matrix<Rotation, Fixed<3>, Fixed<3>, ATDep>
 template<class DepShape, class IndepShape, class ATDep, class ATIndep>
 Matrix<General, DepShape, IndepShape, ATDep> parDer(const Vector<DepShape, ATDep> &dep, const Vector<IndepShape, ATIndep> &indep) {
   Matrix<General, DepShape, IndepShape, ATDep> ret(dep.size(), indep.size());
-  for(int r=0; r<dep.size(); ++r)
+  if constexpr (std::is_same_v<ATDep, SymbolicExpression> && std::is_same_v<ATIndep, IndependentVariable>) {
+    // differentiate all entries at once: shared vertices are differentiated only once per indep
+    std::vector<SymbolicExpression> depVec;
+    for(int r=0; r<dep.size(); ++r)
+      depVec.emplace_back(dep(r));
+    std::vector<IndependentVariable> indepVec;
     for(int c=0; c<indep.size(); ++c)
-      ret(r,c)=parDer(dep(r), indep(c));
+      indepVec.emplace_back(indep(c));
+    auto der=parDer(depVec, indepVec);
+    for(int r=0; r<dep.size(); ++r)
+      for(int c=0; c<indep.size(); ++c)
+        ret(r,c)=der[r*indep.size()+c];
+  }
+  else {
+    for(int r=0; r<dep.size(); ++r)
+      for(int c=0; c<indep.size(); ++c)
+        ret(r,c)=parDer(dep(r), indep(c));
+  }
   return ret;
 }
 
@@ -152,6 +181,16 @@ Dst& operator^=(Dst &dst, const Src &src) {
 
 
 
+//! The instruction format used by Eval.
+enum class EvalFormat {
+  ByteCode, //!< a std::function and raw pointers per instruction (AST::ByteCode)
+  ByteCodeParallel, //!< as ByteCode but executed level scheduled on several threads (AST::ByteCodeSchedule)
+  ByteCodeIncremental, //!< as ByteCode but only the instructions depending on changed independent variables are
+                      //!< executed (AST::ByteCodeIncremental)
+  OpCode,   //!< compact op codes with slot indices into a contiguous value array executed by a switch (AST::OpCode)
+  JIT,      //!< native machine code compiled at runtime by the system C compiler (AST::JITProgram)
+};
+
 /* Class for evaluating a symbolic expression
  * This class is not copy/move-able to since it uses ByteCode which itself uses internal raw pointers (for
  * performance reasons) which cannot be copied/moved.
@@ -175,10 +214,38 @@ class Eval {
     // construct an evaluation object for all symbolic args
     // An arg can be a symbolic scalar, vector or matrix
     Eval(const Arg&... arg);
+    // construct an evaluation object for all symbolic args using the instruction format format
+    Eval(EvalFormat format_, const Arg&... arg);
     // evaluate all symbolic args given by the ctor and return a tuple of corrsponding evaluated numeric values.
     // Note that the return values can be get easily using "structured binding".
     inline const NumRetType& operator()() const;
+    //! Add a subset of the outputs which can be evaluated without evaluating all other outputs and return its id.
+    //! output are the indices of the scalar outputs: all scalars of all args in order (vectors and matrices in the
+    //! order of its iterators). Only the instructions needed by these outputs are executed by operator()(subset).
+    //! EvalFormat::JIT cannot execute a part of the compiled code: operator()(subset) evaluates all outputs.
+    size_t addSubset(const std::vector<size_t> &output);
+    //! Evaluate only the outputs of the subset with the id subset (see addSubset) and return all numeric values.
+    //! All values not part of the subset keep the values of the last evaluation.
+    const NumRetType& operator()(size_t subset) const;
+    //! Write the values of the I-th arg directly to dst instead of to the return value of operator().
+    //! dst must be a double, if the I-th arg is a scalar, or a vector/matrix of the same size as the I-th arg, of any
+    //! shape and storage (e.g. a Matrix<General,Ref,Ref,double> or a Vector<Ref,double> referencing a part of a larger
+    //! matrix). The last instructions of the evaluation write to dst: no copy from the return value is needed.
+    //! The values of the I-th arg in the return value of operator() are no longer updated.
+    //! dst must exist as long as it is bound (until the next call of bindOutput for I or the destruction of this object).
+    template<int I, class Dst>
+    void bindOutput(Dst &dst);
+    //! Same as above, but write to the raw memory dst: a scalar is written to dst[0], the i-th element of a vector to
+    //! dst[i*ld] and the element (r,c) of a matrix to dst[r+c*ld] (column major with the leading dimension ld).
+    //! ld=0 means dense storage (1 for vectors and the number of rows for matrices).
+    template<int I>
+    void bindOutput(double *dst, int ld=0);
+    //! Return the number of value slots used by the evaluation before and after slot reuse.
+    //! (slots are only reused by EvalFormat::OpCode: for all other formats each instruction has its own slot)
+    std::pair<size_t, size_t> getNumberOfSlots() const;
   private:
+    // the instruction format used
+    EvalFormat format;
     // the numeric values as a tuple
     NumTuple numTuple;
     // hold a reference to Symbols used by the evaluation to avoid deleting these symbols (since the code has pointers to these)
@@ -192,23 +259,86 @@ class Eval {
     // members for bytecode evaluation
 
     std::vector<AST::ByteCode> byteCode;
+    std::vector<std::unique_ptr<AST::ByteCodeSlice>> byteCodeSubset; // the slices of byteCode for all subsets
 
     // the constructor and operator() for runtime evaluation
     void ctorByteCode(const Arg&... arg);
     inline void callByteCode() const;
+
+    // members for parallel bytecode evaluation (byteCode is also used)
+
+    std::unique_ptr<AST::ByteCodeSchedule> schedule;
+
+    // the operator() for runtime evaluation (the ctor is ctorByteCode)
+    inline void callByteCodeParallel() const;
+
+    // members for incremental bytecode evaluation (byteCode is also used)
+
+    std::unique_ptr<AST::ByteCodeIncremental> incremental;
+
+    // the operator() for runtime evaluation (the ctor is ctorByteCode)
+    inline void callByteCodeIncremental() const;
+
+    // members for opcode evaluation
+
+    AST::OpCodeProgram program;
+    mutable std::vector<double> value; // the slots of program
+    size_t nrSlotsBeforeReuse { 0 };
+    std::vector<double*> outputPtr; // the address in numTuple of each output (for all formats)
+    // the slices of program.code and the outputs of all subsets
+    std::vector<std::pair<std::vector<AST::OpCode>, std::vector<size_t>>> opCodeSubset;
+
+    // the constructor and operator() for runtime evaluation
+    void ctorOpCode(const Arg&... arg);
+    inline void callOpCode() const;
+
+    // members for jit evaluation (program and outputPtr are also used; value holds the inputs and outputs)
+
+    std::unique_ptr<AST::JITProgram> jit;
+    size_t nrJITSubsets { 0 }; // the number of subsets (all outputs are evaluated for each subset)
+
+    // the constructor and operator() for runtime evaluation
+    void ctorJIT(const Arg&... arg);
+    inline void callJIT() const;
+
+    // helper functions for bindOutput
+
+    // return the index of the first output of the I-th arg
+    template<int I>
+    size_t getOutputOffset() const;
+    // call func(o, r, c) for each output o of the I-th arg with (r,c) its row and column (for vectors c=0)
+    template<int I, class Func>
+    void forEachOutput(const Func &func);
+    // let output o write to dst (for all formats)
+    void setOutputPtr(size_t o, double *dst);
 };
 
 template<class... Arg>
 Eval<Arg...>::~Eval() = default;
 
 template<class... Arg>
-Eval<Arg...>::Eval(const Arg&... arg) {
-  ctorByteCode(arg...);
+Eval<Arg...>::Eval(const Arg&... arg) : Eval(EvalFormat::ByteCode, arg...) {}
+
+template<class... Arg>
+Eval<Arg...>::Eval(EvalFormat format_, const Arg&... arg) : format(format_) {
+  switch(format) {
+    case EvalFormat::ByteCode: ctorByteCode(arg...); break;
+    case EvalFormat::ByteCodeParallel: ctorByteCode(arg...); break;
+    case EvalFormat::ByteCodeIncremental: ctorByteCode(arg...); break;
+    case EvalFormat::OpCode: ctorOpCode(arg...); break;
+    case EvalFormat::JIT: ctorJIT(arg...); break;
+  }
 }
 
 template<class... Arg>
 auto Eval<Arg...>::operator()() const -> const NumRetType& {
-  callByteCode();
+  switch(format) {
+    case EvalFormat::ByteCode: callByteCode(); break;
+    case EvalFormat::ByteCodeParallel: callByteCodeParallel(); break;
+    case EvalFormat::ByteCodeIncremental: callByteCodeIncremental(); break;
+    case EvalFormat::OpCode: callOpCode(); break;
+    case EvalFormat::JIT: callJIT(); break;
+  }
   // return the numeric values: the above call has written to its addresses
   if constexpr (std::tuple_size_v<NumTuple> == 1)
     return std::get<0>(numTuple);
@@ -216,6 +346,179 @@ auto Eval<Arg...>::operator()() const -> const NumRetType& {
     return numTuple;
 }
 
+template<class... Arg>
+size_t Eval<Arg...>::addSubset(const std::vector<size_t> &output) {
+  for(auto o : output)
+    if(o>=outputPtr.size())
+      throw std::runtime_error("The output index "+std::to_string(o)+" of the subset is out of range.");
+  switch(format) {
+    case EvalFormat::ByteCode:
+    case EvalFormat::ByteCodeParallel:
+    case EvalFormat::ByteCodeIncremental: {
+      // the last entries of byteCode copy the outputs to its return value
+      std::vector<size_t> entry;
+      for(auto o : output)
+        entry.emplace_back(byteCode.size()-outputPtr.size()+o);
+      byteCodeSubset.emplace_back(std::make_unique<AST::ByteCodeSlice>(byteCode, entry));
+      return byteCodeSubset.size()-1;
+    }
+    case EvalFormat::OpCode: {
+      std::vector<AST::OpCode::Index> slot;
+      for(auto o : output)
+        slot.emplace_back(program.output[o]);
+      opCodeSubset.emplace_back(program.getSlice(slot), output);
+      return opCodeSubset.size()-1;
+    }
+    case EvalFormat::JIT:
+      break;
+  }
+  return nrJITSubsets++;
+}
+
+template<class... Arg>
+auto Eval<Arg...>::operator()(size_t subset) const -> const NumRetType& {
+  switch(format) {
+    case EvalFormat::ByteCode:
+    case EvalFormat::ByteCodeParallel:
+    case EvalFormat::ByteCodeIncremental:
+      (*byteCodeSubset.at(subset))();
+      break;
+    case EvalFormat::OpCode: {
+      auto &[code, output]=opCodeSubset.at(subset);
+      for(auto &[sym, slot] : program.symbol)
+        value[slot] = sym->getValue();
+      program.eval(value.data(), code);
+      for(auto o : output)
+        *outputPtr[o] = value[program.output[o]];
+      break;
+    }
+    case EvalFormat::JIT:
+      if(subset>=nrJITSubsets)
+        throw std::out_of_range("The subset "+std::to_string(subset)+" does not exist.");
+      callJIT();
+      break;
+  }
+  if constexpr (std::tuple_size_v<NumTuple> == 1)
+    return std::get<0>(numTuple);
+  else
+    return numTuple;
+}
+
+template<class... Arg>
+template<int I, class Dst>
+void Eval<Arg...>::bindOutput(Dst &dst) {
+  using Num = std::tuple_element_t<I,NumTuple>;
+  if constexpr (std::is_same_v<Num, double>)
+    setOutputPtr(getOutputOffset<I>(), &dst);
+  else {
+    auto &num = std::get<I>(numTuple);
+    if constexpr (Num::isVector) {
+      if(dst.size()!=num.size())
+        throw std::runtime_error("The size of the output does not match.");
+    }
+    else {
+      if(dst.rows()!=num.rows() || dst.cols()!=num.cols())
+        throw std::runtime_error("The size of the output does not match.");
+    }
+    forEachOutput<I>([this, &dst](size_t o, int r, int c) {
+      if constexpr (Num::isVector)
+        setOutputPtr(o, &dst(r));
+      else
+        setOutputPtr(o, &dst(r,c));
+    });
+  }
+}
+
+template<class... Arg>
+template<int I>
+void Eval<Arg...>::bindOutput(double *dst, int ld) {
+  using Num = std::tuple_element_t<I,NumTuple>;
+  if constexpr (std::is_same_v<Num, double>)
+    setOutputPtr(getOutputOffset<I>(), dst);
+  else {
+    if(ld==0) {
+      if constexpr (Num::isVector)
+        ld=1;
+      else
+        ld=std::get<I>(numTuple).rows();
+    }
+    forEachOutput<I>([this, dst, ld](size_t o, int r, int c) {
+      if constexpr (Num::isVector)
+        setOutputPtr(o, dst+r*ld);
+      else
+        setOutputPtr(o, dst+r+c*ld);
+    });
+  }
+}
+
+template<class... Arg>
+template<int I>
+size_t Eval<Arg...>::getOutputOffset() const {
+  if constexpr (I==0)
+    return 0;
+  else {
+    auto &num = std::get<I-1>(numTuple);
+    size_t n=0;
+    if constexpr (std::is_same_v<std::decay_t<decltype(num)>, double>)
+      n=1;
+    else
+      for(auto it=num.begin(); it!=num.end(); ++it)
+        ++n;
+    return getOutputOffset<I-1>()+n;
+  }
+}
+
+template<class... Arg>
+template<int I, class Func>
+void Eval<Arg...>::forEachOutput(const Func &func) {
+  // the outputs are ordered as the iterators of the I-th arg: map the address of each element to its row and column
+  auto &num = std::get<I>(numTuple);
+  using Num = std::tuple_element_t<I,NumTuple>;
+  std::map<const double*, std::pair<int, int>> index;
+  if constexpr (Num::isVector) {
+    for(int i=0; i<num.size(); ++i)
+      index.emplace(&num(i), std::make_pair(i, 0));
+  }
+  else {
+    for(int r=0; r<num.rows(); ++r)
+      for(int c=0; c<num.cols(); ++c)
+        index.emplace(&num(r,c), std::make_pair(r, c));
+  }
+  size_t o=getOutputOffset<I>();
+  for(auto it=num.begin(); it!=num.end(); ++it, ++o) {
+    auto [r, c]=index.at(&*it);
+    func(o, r, c);
+  }
+}
+
+template<class... Arg>
+void Eval<Arg...>::setOutputPtr(size_t o, double *dst) {
+  switch(format) {
+    case EvalFormat::ByteCode:
+    case EvalFormat::ByteCodeParallel:
+    case EvalFormat::ByteCodeIncremental:
+      // the last entries of byteCode copy the outputs to its return value
+      byteCode[byteCode.size()-outputPtr.size()+o].retPtr=dst;
+      if(incremental)
+        incremental->reset();
+      break;
+    case EvalFormat::OpCode:
+    case EvalFormat::JIT:
+      break;
+  }
+  outputPtr[o]=dst;
+}
+
+template<class... Arg>
+std::pair<size_t, size_t> Eval<Arg...>::getNumberOfSlots() const {
+  if(format == EvalFormat::ByteCode || format == EvalFormat::ByteCodeParallel ||
+     format == EvalFormat::ByteCodeIncremental)
+    return { byteCode.size(), byteCode.size() };
+  if(format == EvalFormat::JIT)
+    return { program.nrSlots, program.nrSlots };
+  return { nrSlotsBeforeReuse, program.nrSlots };
+}
+
 template<class... Arg>
 template<int I>
 void Eval<Arg...>::walkAT(const SymTuple &symTuple, NumTuple &numTuple,
@@ -250,6 +553,36 @@ void Eval<Arg...>::walkAT(const SymTuple &symTuple, NumTuple &numTuple,
 
 template<class... Arg>
 void Eval<Arg...>::ctorByteCode(const Arg&... arg) {
+  // the fast path: sort the DAG of all args topologically in a single pass and emit the entries directly
+  {
+    std::vector<SymbolicExpression> output;
+    walkAT(SymTuple(arg...), numTuple, [&output](auto &sym, auto &num) { output.emplace_back(sym); });
+    AST::ByteCodeBuilder builder(output, format == EvalFormat::ByteCode);
+    if(builder.isSupported()) {
+      // pre-allocate byteCode (ByteCode has not move-ctor)
+      byteCode.reserve(builder.size()+output.size());
+      auto exprRet=builder.emit(byteCode);
+      for(auto &[s, idx] : builder.getSymbols())
+        symbolStore.insert(s);
+      // add code to copy the result of each AT to the address of the return value
+      auto exprRetIt = exprRet.begin();
+      walkAT(SymTuple(arg...), numTuple, [this, &exprRetIt](auto &sym, auto &num) {
+        outputPtr.emplace_back(&num);
+        byteCode.emplace_back(1);
+        auto it = --byteCode.end();
+        it->func = [](double* r, const AST::ByteCode::Arg& a) { *r = *a[0]; };
+        it->argsPtr = { byteCode[*(exprRetIt++)].retPtr };
+        it->retPtr = &num;
+      });
+      if(format == EvalFormat::ByteCodeParallel)
+        schedule=std::make_unique<AST::ByteCodeSchedule>(byteCode, std::vector<bool>(byteCode.size(), false));
+      if(format == EvalFormat::ByteCodeIncremental)
+        incremental=std::make_unique<AST::ByteCodeIncremental>(byteCode, builder.getSymbols());
+      return;
+    }
+  }
+
+  // the general path (NativeFunction's and lazy branches of Condition's):
   // first walk through all vertices in all args and count the number of operations needed
   size_t byteCodeCount=0;
   std::set<const AST::Vertex*> existingVertex1;
@@ -259,6 +592,9 @@ void Eval<Arg...>::ctorByteCode(const Arg&... arg) {
 
       if(auto s=std::dynamic_pointer_cast<const AST::Symbol>(v); s)
         byteCodeCount++;
+      // the jumps of the lazy branches of a Condition
+      if(auto o=std::dynamic_pointer_cast<const AST::Operation>(v); o && o->getOp()==AST::Operation::Condition)
+        byteCodeCount+=2;
       byteCodeCount++;
     });
     byteCodeCount++;
@@ -278,20 +614,42 @@ void Eval<Arg...>::ctorByteCode(const Arg&... arg) {
   });
   // now add the code of the symbolic expression: this is a "fast" operation since only addresses inside of byteCode are used
   // Also store a interator to each AT (atomic type) result of the symbolic expression
+  // The branches of a Condition are evaluated lazily using jumps (not possible for the level scheduled execution).
   std::vector< std::vector<AST::ByteCode>::iterator > exprRet;
-  walkAT(SymTuple(arg...), numTuple, [this, &existingVertex, &exprRet](auto &sym, auto &num) {
-    exprRet.emplace_back(sym->dumpByteCode(byteCode, existingVertex));
+  std::unique_ptr<AST::ByteCodeBranches> branches;
+  if(format == EvalFormat::ByteCode) {
+    branches=std::make_unique<AST::ByteCodeBranches>();
+    walkAT(SymTuple(arg...), numTuple, [&branches](auto &sym, auto &num) { branches->addOutput(sym); });
+  }
+  walkAT(SymTuple(arg...), numTuple, [this, &existingVertex, &exprRet, &branches](auto &sym, auto &num) {
+    exprRet.emplace_back(sym->dumpByteCode(byteCode, existingVertex, branches.get()));
   });
   // lastly add code to copy the result of each AT (the iterators from above) to the address of the return value.
   // This is again a "slow" operation since the address of the return value may be far away fromo byteCode.
   auto exprRetIt = exprRet.begin();
   walkAT(SymTuple(arg...), numTuple, [this, &exprRet, &exprRetIt](auto &sym, auto &num) {
+    outputPtr.emplace_back(&num);
     byteCode.emplace_back(1);
     auto it = --byteCode.end();
     it->func = [](double* r, const AST::ByteCode::Arg& a) { *r = *a[0]; };
     it->argsPtr = { (*(exprRetIt++))->retPtr };
     it->retPtr = &num;
   });
+
+  if(format == EvalFormat::ByteCodeParallel) {
+    // NativeFunction's are not required to be thread-safe: these are only executed by the caller thread
+    std::vector<bool> serialOnly(byteCode.size(), false);
+    for(auto &[v, it] : existingVertex)
+      if(dynamic_cast<const AST::NativeFunction*>(v))
+        serialOnly[it-byteCode.begin()]=true;
+    schedule=std::make_unique<AST::ByteCodeSchedule>(byteCode, serialOnly);
+  }
+  if(format == EvalFormat::ByteCodeIncremental) {
+    std::vector<std::pair<std::shared_ptr<const AST::Symbol>, size_t>> symbolEntry;
+    for(auto &s : symbolStore)
+      symbolEntry.emplace_back(s, existingVertex.at(s.get())-byteCode.begin());
+    incremental=std::make_unique<AST::ByteCodeIncremental>(byteCode, symbolEntry);
+  }
 }
 
 template<class... Arg>
@@ -299,9 +657,701 @@ void Eval<Arg...>::callByteCode() const {
 #if defined(FMATVEC_DEBUG) && !defined(SWIG)
   SymbolicExpression::evalOperationsCount = byteCode.size();
 #endif
-  std::for_each(byteCode.begin(), byteCode.end(), [](const AST::ByteCode &bc){
-    bc.func(bc.retPtr, bc.argsPtr);
+  for(auto it=byteCode.begin(); it!=byteCode.end(); ++it) {
+    it->func(it->retPtr, it->argsPtr);
+    // a conditional jump (a branch of a Condition which is not selected)
+    if(it->jump && it->retValue!=0)
+      it+=it->jump;
+  }
+}
+
+template<class... Arg>
+void Eval<Arg...>::callByteCodeIncremental() const {
+  (*incremental)();
+#if defined(FMATVEC_DEBUG) && !defined(SWIG)
+  SymbolicExpression::evalOperationsCount = incremental->getNumberOfExecuted();
+#endif
+}
+
+template<class... Arg>
+void Eval<Arg...>::callByteCodeParallel() const {
+#if defined(FMATVEC_DEBUG) && !defined(SWIG)
+  SymbolicExpression::evalOperationsCount = byteCode.size();
+#endif
+  (*schedule)();
+}
+
+namespace AST {
+  // call func for each scalar SymbolicExpression of x (x is a SymbolicExpression or a vector/matrix of SymbolicExpression)
+  // (or for each IndependentVariable of x)
+  template<class Sym, class Func>
+  void forEachAT(const Sym &x, const Func &func) {
+    if constexpr (std::is_same_v<Sym, SymbolicExpression> || std::is_same_v<Sym, IndependentVariable>)
+      func(x);
+    else
+      for(auto it=x.begin(); it!=x.end(); ++it)
+        func(*it);
+  }
+
+  template<class T>
+  T ExpressionOptimizer::optimize(const T &expr, Statistics *stat, const Options &options) {
+    std::vector<SymbolicExpression> exprVec;
+    forEachAT(expr, [&exprVec](const SymbolicExpression &se) { exprVec.emplace_back(se); });
+    auto opt=optimize(exprVec, stat, options);
+    if constexpr (std::is_same_v<T, SymbolicExpression>)
+      return opt[0];
+    else {
+      T ret(expr);
+      size_t i=0;
+      for(auto it=ret.begin(); it!=ret.end(); ++it)
+        *it=opt[i++];
+      return ret;
+    }
+  }
+
+  // Set all (scalar, vector or matrix) expressions passed by forEachDerived to its callback by calling derive or
+  // load these from the ExpressionCache.
+  // input is a tuple of all expressions derive depends on, indep is a tuple of all independent variables used by derive.
+  // tag must distinguish different derive functions for the same input (see ExpressionCache::get).
+  template<class Input, class Indep, class Derive, class ForEachDerived>
+  void cachedDerive(const std::string &tag, const Input &input, const Indep &indep,
+                    const Derive &derive, const ForEachDerived &forEachDerived) {
+    std::vector<SymbolicExpression> inputVec;
+    std::apply([&inputVec](const auto&... x) {
+      (forEachAT(x, [&inputVec](const SymbolicExpression &se) { inputVec.emplace_back(se); }), ...);
+    }, input);
+    std::vector<IndependentVariable> indepVec;
+    std::apply([&indepVec](const auto&... x) {
+      (forEachAT(x, [&indepVec](const IndependentVariable &iv) { indepVec.emplace_back(iv); }), ...);
+    }, indep);
+
+    bool derived=false;
+    auto entry=ExpressionCache::get(tag, inputVec, indepVec, [&derive, &forEachDerived, &derived]() {
+      derive();
+      derived=true;
+      // store all scalar expressions and the dimensions of all vectors/matrices
+      ExpressionCache::Entry e;
+      forEachDerived([&e](const auto &x) {
+        using X = std::decay_t<decltype(x)>;
+        if constexpr (!std::is_same_v<X, SymbolicExpression>) {
+          if constexpr (X::isVector)
+            e.dim.emplace_back(x.size());
+          else {
+            e.dim.emplace_back(x.rows());
+            e.dim.emplace_back(x.cols());
+          }
+        }
+        forEachAT(x, [&e](const SymbolicExpression &se) { e.expr.emplace_back(se); });
+      });
+      return e;
+    });
+    if(derived)
+      return;
+
+    // set all expressions from the cache entry
+    size_t exprIdx=0, dimIdx=0;
+    forEachDerived([&entry, &exprIdx, &dimIdx](auto &x) {
+      using X = std::decay_t<decltype(x)>;
+      if constexpr (std::is_same_v<X, SymbolicExpression>)
+        x=entry.expr.at(exprIdx++);
+      else {
+        if constexpr (X::isVector)
+          x.resize(entry.dim.at(dimIdx++));
+        else {
+          auto rows=entry.dim.at(dimIdx++);
+          x.resize(rows, entry.dim.at(dimIdx++));
+        }
+        for(auto it=x.begin(); it!=x.end(); ++it)
+          *it=entry.expr.at(exprIdx++);
+      }
+    });
+  }
+
+  // Return the (scalar, vector or matrix) expression of type Ret returned by derive or load it from the ExpressionCache.
+  template<class Ret, class Input, class Indep, class Derive>
+  Ret cachedDerive(const std::string &tag, const Input &input, const Indep &indep, const Derive &derive) {
+    Ret ret;
+    cachedDerive(tag, input, indep, [&ret, &derive]() { ret<<=derive(); }, [&ret](auto &&f) { f(ret); });
+    return ret;
+  }
+}
+
+/* A evaluator object (a Eval object or another evaluator like EvalForward) which is created on first use.
+ * The expressions to evaluate are created by a function set by reset. This function and the ctor of the evaluator are
+ * called on the first call of operator* or build. This is thread-safe: concurrent first calls create the evaluator
+ * only once. The function returns the expression for a single Arg or a std::tuple of all expressions for several Arg's
+ * (which are passed as ctor arguments to the evaluator).
+*/
+template<class Evaluator, class... Arg>
+class LazyEvaluator {
+  public:
+    using Expressions = std::conditional_t<sizeof...(Arg)==1, std::tuple_element_t<0, std::tuple<Arg...>>,
+                                           std::tuple<Arg...>>;
+    //! Set the function creating the expressions to evaluate. A already created evaluator is deleted.
+    //! This must not be called concurrently to operator* or build.
+    void reset(std::function<Expressions()> create_) {
+      std::lock_guard<std::mutex> lock(m);
+      create=std::move(create_);
+      ptr.store(nullptr, std::memory_order_release);
+      eval.reset();
+    }
+    //! Return the evaluator (create it on the first call).
+    const Evaluator& operator*() const {
+      auto *p=ptr.load(std::memory_order_acquire);
+      return p ? *p : build();
+    }
+    //! Create the evaluator, if not already done, and return it.
+    const Evaluator& build() const {
+      std::lock_guard<std::mutex> lock(m);
+      if(!eval) {
+        if(!create)
+          throw std::runtime_error("No expression given for this LazyEval object.");
+        if constexpr (sizeof...(Arg)==1)
+          eval=std::make_unique<Evaluator>(create());
+        else
+          std::apply([this](const Arg&... arg) { eval=std::make_unique<Evaluator>(arg...); }, create());
+        ptr.store(eval.get(), std::memory_order_release);
+      }
+      return *eval;
+    }
+    //! Return true if the evaluator is already created.
+    bool isBuilt() const { return ptr.load(std::memory_order_acquire)!=nullptr; }
+  private:
+    std::function<Expressions()> create;
+    mutable std::mutex m;
+    mutable std::unique_ptr<Evaluator> eval;
+    mutable std::atomic<const Evaluator*> ptr { nullptr };
+};
+
+//! A Eval object which is created on first use (see LazyEvaluator).
+template<class... Arg>
+using LazyEval = LazyEvaluator<Eval<Arg...>, Arg...>;
+
+/* Class for evaluating symbolic expressions at many points at once (batched evaluation).
+ * Eval executes its bytecode once per point. This class instead executes each instruction for a block of up to
+ * "lanes" points before the next instruction is executed. Hence, the per instruction dispatch cost is payed only
+ * once per block and the loops over the points of a block can be vectorized by the compiler.
+ * The independent variables indep given in the ctor are the inputs which vary between the points. All other
+ * independent variables used in arg are evaluated with their current value (like in Eval).
+ * The outputs are all scalar SymbolicExpression's of all args in the order of the args and of its iterators.
+*/
+template<class... Arg>
+class EvalBatch {
+  public:
+    //! The number of points evaluated at once by each instruction.
+    static constexpr size_t lanes { 16 };
+
+    // construct an batched evaluation object for all symbolic args with the inputs indep.
+    EvalBatch(const std::vector<IndependentVariable> &indep, const Arg&... arg);
+
+    //! Evaluate all outputs at n points.
+    //! in must hold the inputs in structure-of-arrays layout: the value of indep[i] at point p is in[i*ldIn+p].
+    //! The outputs are written to out: the value of output o at point p is written to out[o*ldOut+p].
+    //! ldIn and ldOut default to n.
+    void operator()(size_t n, const double *in, double *out, size_t ldIn=0, size_t ldOut=0) const;
+
+    //! Return the number of inputs (the size of indep).
+    size_t getInputSize() const { return nrInputs; }
+    //! Return the number of outputs (the number of scalar SymbolicExpression's in all args).
+    size_t getOutputSize() const { return program.output.size(); }
+  private:
+    AST::OpCodeProgram program;
+    size_t nrInputs;
+    std::vector<int> inputIndex; // for each program.symbol the index in indep or -1 if its not a input
+    mutable std::vector<double> value; // the slots of program for all lanes
+};
+
+template<class... Arg>
+EvalBatch<Arg...>::EvalBatch(const std::vector<IndependentVariable> &indep, const Arg&... arg) : nrInputs(indep.size()) {
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  (AST::forEachAT(arg, [this, &existingVertex](const SymbolicExpression &se) {
+    program.addOutput(se, existingVertex);
+  }), ...);
+  program.reuseSlots();
+  inputIndex = program.getInputIndex(indep);
+  // constants are never overwritten: initialize these slots for all lanes once
+  value.resize(program.nrSlots*lanes);
+  program.initConstants(value.data(), lanes);
+}
+
+template<class... Arg>
+void EvalBatch<Arg...>::operator()(size_t n, const double *in, double *out, size_t ldIn, size_t ldOut) const {
+  ldIn = ldIn==0 ? n : ldIn;
+  ldOut = ldOut==0 ? n : ldOut;
+  // symbols which are not inputs have the same value for all points
+  for(size_t i=0; i<program.symbol.size(); ++i)
+    if(inputIndex[i]<0)
+      std::fill_n(value.begin()+program.symbol[i].second*lanes, lanes, program.symbol[i].first->getValue());
+  for(size_t p0=0; p0<n; p0+=lanes) {
+    size_t nl = std::min(lanes, n-p0);
+    for(size_t i=0; i<program.symbol.size(); ++i)
+      if(inputIndex[i]>=0)
+        std::copy_n(in+inputIndex[i]*ldIn+p0, nl, value.begin()+program.symbol[i].second*lanes);
+    program.evalBatch(value.data(), lanes, nl);
+    for(size_t o=0; o<program.output.size(); ++o)
+      std::copy_n(value.begin()+program.output[o]*lanes, nl, out+o*ldOut+p0);
+  }
+}
+
+/* Class for evaluating symbolic expressions with inputs given explicitly at each call.
+ * Eval reads its inputs from the values of the independent variables (set using operator^=). Hence, the same Eval
+ * (and even the same expressions) cannot be evaluated by several threads with different inputs. This class instead
+ * reads the values of the independent variables indep given in the ctor from a input array passed at each call
+ * and writes all outputs to a output array. All other independent variables used in arg are evaluated with their
+ * current value (like in Eval).
+ * The compiled program is immutable and shared between copies of this class: a copy (see clone) only copies the
+ * value array of the program (which holds no pointers since the program uses slot indices). Hence, to evaluate the
+ * same expressions concurrently each thread just uses its own copy.
+ * Note that NativeFunction's used in arg must be thread-safe to evaluate concurrently.
+ * The outputs are all scalar SymbolicExpression's of all args in the order of the args and of its iterators.
+ * The format can be EvalFormat::OpCode or EvalFormat::JIT.
+*/
+template<class... Arg>
+class EvalInput {
+  public:
+    // construct a evaluation object for all symbolic args with the inputs indep.
+    EvalInput(const std::vector<IndependentVariable> &indep, const Arg&... arg) :
+      EvalInput(EvalFormat::OpCode, indep, arg...) {}
+    // construct a evaluation object for all symbolic args with the inputs indep using the instruction format format
+    EvalInput(EvalFormat format_, const std::vector<IndependentVariable> &indep, const Arg&... arg);
+
+    //! Evaluate all outputs: the value of indep[i] is read from in[i], output o is written to out[o].
+    void operator()(const double *in, double *out) const;
+    //! Return a copy of this object to be used by another thread.
+    EvalInput clone() const { return *this; }
+
+    //! Return the number of inputs (the size of indep).
+    size_t getInputSize() const { return nrInputs; }
+    //! Return the number of outputs (the number of scalar SymbolicExpression's in all args).
+    size_t getOutputSize() const { return program->output.size(); }
+  private:
+    EvalFormat format;
+    std::shared_ptr<const AST::OpCodeProgram> program;
+    std::shared_ptr<const AST::JITProgram> jit;
+    size_t nrInputs;
+    std::vector<int> inputIndex; // for each program->symbol the index in indep or -1 if its not a input
+    mutable std::vector<double> value; // the slots of program (OpCode) or the values of program->symbol (JIT)
+};
+
+template<class... Arg>
+EvalInput<Arg...>::EvalInput(EvalFormat format_, const std::vector<IndependentVariable> &indep, const Arg&... arg) :
+  format(format_), nrInputs(indep.size()) {
+  auto prog = std::make_shared<AST::OpCodeProgram>();
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  (AST::forEachAT(arg, [&prog, &existingVertex](const SymbolicExpression &se) {
+    prog->addOutput(se, existingVertex);
+  }), ...);
+  switch(format) {
+    case EvalFormat::OpCode:
+      prog->reuseSlots();
+      value.resize(prog->nrSlots);
+      prog->initConstants(value.data());
+      break;
+    case EvalFormat::JIT:
+      jit = std::make_shared<AST::JITProgram>(*prog);
+      value.resize(prog->symbol.size());
+      break;
+    default:
+      throw std::runtime_error("EvalInput supports only the formats OpCode and JIT.");
+  }
+  inputIndex = prog->getInputIndex(indep);
+  program = std::move(prog);
+}
+
+template<class... Arg>
+void EvalInput<Arg...>::operator()(const double *in, double *out) const {
+  auto &symbol = program->symbol;
+  if(format == EvalFormat::JIT) {
+    for(size_t i=0; i<symbol.size(); ++i)
+      value[i] = inputIndex[i]>=0 ? in[inputIndex[i]] : symbol[i].first->getValue();
+    (*jit)(value.data(), out);
+  }
+  else {
+    for(size_t i=0; i<symbol.size(); ++i)
+      value[symbol[i].second] = inputIndex[i]>=0 ? in[inputIndex[i]] : symbol[i].first->getValue();
+    program->eval(value.data());
+    for(auto slot : program->output)
+      *(out++) = value[slot];
+  }
+}
+
+template<class... Arg>
+void Eval<Arg...>::ctorOpCode(const Arg&... arg) {
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  walkAT(SymTuple(arg...), numTuple, [this, &existingVertex](auto &sym, auto &num) {
+    program.addOutput(sym, existingVertex);
+    outputPtr.emplace_back(&num);
+  });
+  nrSlotsBeforeReuse = program.reuseSlots();
+  value.resize(program.nrSlots);
+  program.initConstants(value.data());
+}
+
+template<class... Arg>
+void Eval<Arg...>::callOpCode() const {
+#if defined(FMATVEC_DEBUG) && !defined(SWIG)
+  SymbolicExpression::evalOperationsCount = program.code.size();
+#endif
+  // copy the values of the symbols to its slots: this is a "slow" operation since the symbols may be far away
+  for(auto &[sym, slot] : program.symbol)
+    value[slot] = sym->getValue();
+  program.eval(value.data());
+  // copy the outputs to its return value: this is again a "slow" operation
+  auto outputPtrIt = outputPtr.begin();
+  for(auto slot : program.output)
+    **(outputPtrIt++) = value[slot];
+}
+
+template<class... Arg>
+void Eval<Arg...>::ctorJIT(const Arg&... arg) {
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  walkAT(SymTuple(arg...), numTuple, [this, &existingVertex](auto &sym, auto &num) {
+    program.addOutput(sym, existingVertex);
+    outputPtr.emplace_back(&num);
   });
+  // slots are not reused: the C compiler does its own register allocation
+  jit = std::make_unique<AST::JITProgram>(program);
+  value.resize(program.symbol.size()+program.output.size());
+}
+
+template<class... Arg>
+void Eval<Arg...>::callJIT() const {
+#if defined(FMATVEC_DEBUG) && !defined(SWIG)
+  SymbolicExpression::evalOperationsCount = program.code.size();
+#endif
+  auto nrIn = program.symbol.size();
+  for(size_t i=0; i<nrIn; ++i)
+    value[i] = program.symbol[i].first->getValue();
+  (*jit)(value.data(), value.data()+nrIn);
+  auto outputPtrIt = outputPtr.begin();
+  for(size_t o=0; o<program.output.size(); ++o)
+    **(outputPtrIt++) = value[nrIn+o];
+}
+
+/* Class for evaluating the partial derivatives of dep wrt indep using the adjoint (reverse) mode.
+ * Eval{parDer(dep, indep)} builds and evaluates a new symbolic expression for each entry of the derivative.
+ * This class instead evaluates dep once and propagates the adjoints in a reverse sweep over its instructions
+ * (see AST::OpCodeProgram::addAdjoint): the full gradient of each scalar of dep is computed in one sweep at a small
+ * constant multiple of the cost of evaluating dep, independent of the number of independent variables.
+ * dep can be a SymbolicExpression or a vector of SymbolicExpression; indep can be a IndependentVariable or a vector
+ * of IndependentVariable. The return value has the same type and value (up to rounding) as Eval{parDer(dep, indep)}().
+ * The format can be EvalFormat::OpCode or EvalFormat::JIT.
+*/
+template<class Dep, class Indep>
+class EvalAdjoint {
+  public:
+    //! The type of the numeric partial derivative (the type of parDer(dep, indep) with double as atomic type).
+    using RetType = typename ReplaceAT<decltype(parDer(std::declval<Dep>(), std::declval<Indep>())), double>::Type;
+
+    EvalAdjoint(const Dep &dep, const Indep &indep, EvalFormat format_=EvalFormat::OpCode);
+    //! Evaluate the partial derivatives of dep wrt indep.
+    const RetType& operator()() const;
+  private:
+    EvalFormat format;
+    AST::OpCodeProgram program;
+    std::unique_ptr<AST::JITProgram> jit;
+    mutable std::vector<double> value; // the slots of program (OpCode) or the inputs and outputs (JIT)
+    int nrDep { 0 };
+    int nrIndep { 0 };
+    mutable RetType ret;
+};
+
+template<class Dep, class Indep>
+EvalAdjoint<Dep, Indep>::EvalAdjoint(const Dep &dep, const Indep &indep, EvalFormat format_) : format(format_) {
+  std::vector<SymbolicExpression> depVec;
+  AST::forEachAT(dep, [&depVec](const auto &x) { depVec.emplace_back(x); });
+  std::vector<IndependentVariable> indepVec;
+  AST::forEachAT(indep, [&indepVec](const auto &x) { indepVec.emplace_back(x); });
+  nrDep = depVec.size();
+  nrIndep = indepVec.size();
+  if constexpr (!std::is_same_v<RetType, double>) {
+    if constexpr (RetType::isVector)
+      ret.resize(nrDep*nrIndep);
+    else
+      ret.resize(nrDep, nrIndep);
+  }
+
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  program.addAdjoint(depVec, indepVec, existingVertex);
+  switch(format) {
+    case EvalFormat::OpCode:
+      program.reuseSlots();
+      value.resize(program.nrSlots);
+      program.initConstants(value.data());
+      break;
+    case EvalFormat::JIT:
+      jit = std::make_unique<AST::JITProgram>(program);
+      value.resize(program.symbol.size()+program.output.size());
+      break;
+    default:
+      throw std::runtime_error("EvalAdjoint supports only the formats OpCode and JIT.");
+  }
+}
+
+template<class Dep, class Indep>
+auto EvalAdjoint<Dep, Indep>::operator()() const -> const RetType& {
+  const double *out;
+  if(format == EvalFormat::JIT) {
+    auto nrIn = program.symbol.size();
+    for(size_t i=0; i<nrIn; ++i)
+      value[i] = program.symbol[i].first->getValue();
+    (*jit)(value.data(), value.data()+nrIn);
+    out = value.data()+nrIn;
+  }
+  else {
+    for(auto &[sym, slot] : program.symbol)
+      value[slot] = sym->getValue();
+    program.eval(value.data());
+    out = nullptr;
+  }
+  // the output o=r*nrIndep+c is the derivative of the scalar r of dep wrt the scalar c of indep
+  auto get = [this, out](int r, int c) { return out ? out[r*nrIndep+c] : value[program.output[r*nrIndep+c]]; };
+  if constexpr (std::is_same_v<RetType, double>)
+    ret = get(0, 0);
+  else if constexpr (RetType::isVector) {
+    for(int i=0; i<nrDep*nrIndep; ++i)
+      ret(i) = get(0, i);
+  }
+  else {
+    for(int r=0; r<nrDep; ++r)
+      for(int c=0; c<nrIndep; ++c)
+        ret(r,c) = get(r, c);
+  }
+  return ret;
+}
+
+/* Class for evaluating the first and second directional derivatives of dep using the forward mode.
+ * SymbolicFunction::dirDer and similar functions build and evaluate a new symbolic expression for each derivative.
+ * This class instead evaluates the instructions of dep once per call and propagates the value and the derivatives in
+ * one or two directions through all instructions in the same sweep (see AST::OpCodeProgram::evalForward). No
+ * derivative expression is built: the cost is a small multiple of the cost of evaluating dep.
+ * dep can be a SymbolicExpression, vector or matrix; each indep can be a IndependentVariable or a vector of
+ * IndependentVariable. The directions of the indep's are set by setDirection (the direction of all other symbols in dep
+ * is zero). A directional derivative of a rotation matrix is returned as angular vector (like fmatvec::dirDer).
+*/
+template<class Dep, class... Indep>
+class EvalForward {
+  public:
+    //! The type of the numeric value of dep.
+    using DepN = typename ReplaceAT<Dep, double>::Type;
+    //! The type of the numeric directional derivative (equal to DepN except for rotation matrices).
+    using RetType = typename DirDer<DepN, double>::type;
+    //! The type of the numeric direction of the I-th indep.
+    template<size_t I>
+    using DirType = typename ReplaceAT<std::tuple_element_t<I, std::tuple<Indep...>>, double>::Type;
+
+    EvalForward(const Dep &dep, const Indep&... indep);
+    //! Set the direction k (1 or 2) of the I-th indep. All directions are zero initially.
+    //! The directions are inputs of the evaluation, like the values of the independent variables.
+    template<size_t I>
+    void setDirection(int k, const DirType<I> &dir) const;
+    //! Set all directions to zero.
+    void clearDirections() const;
+    //! Evaluate the derivative of dep in direction 1.
+    const RetType& dirDer() const;
+    //! Evaluate the second derivative of dep in direction 1 and 2: the derivative in direction 2 of the derivative of dep
+    //! in direction 1.
+    const RetType& dirDerDirDer() const;
+  private:
+    static constexpr bool isRotation = !std::is_same_v<RetType, DepN>;
+    AST::OpCodeProgram program;
+    std::vector<int> inputIndex; // the index in direction of each program.symbol or -1 if it is not a indep
+    std::array<size_t, sizeof...(Indep)+1> indepOffset; // the index in direction of the first scalar of each indep
+    mutable std::array<std::vector<double>, 2> direction; // the direction 1 and 2 of all scalars of all indep's
+    mutable std::array<std::vector<double>, 2> value; // the slots of program for order 1 and 2
+    mutable std::array<DepN, 4> comp; // the value, derivative in direction 1, 2 and second derivative of dep
+    mutable RetType ret;
+    void eval(int order) const;
+};
+
+template<class Dep, class... Indep>
+EvalForward<Dep, Indep...>::EvalForward(const Dep &dep, const Indep&... indep) {
+  std::vector<IndependentVariable> indepVec;
+  size_t i=0;
+  ((indepOffset[i++]=indepVec.size(), AST::forEachAT(indep, [&indepVec](const auto &x) { indepVec.emplace_back(x); })), ...);
+  indepOffset[i]=indepVec.size();
+  for(auto &d : direction)
+    d.resize(indepVec.size(), 0);
+  if constexpr (!std::is_same_v<DepN, double>) {
+    for(auto &c : comp)
+      if constexpr (DepN::isVector)
+        c.resize(dep.size());
+      else
+        c.resize(dep.rows(), dep.cols());
+  }
+
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  AST::forEachAT(dep, [this, &existingVertex](const SymbolicExpression &se) { program.addOutput(se, existingVertex); });
+  program.reuseSlots();
+  inputIndex = program.getInputIndex(indepVec);
+  // the derivatives of the constants are zero
+  for(int order=1; order<=2; ++order) {
+    auto stride=AST::OpCodeProgram::forwardStride(order);
+    value[order-1].resize(program.nrSlots*stride, 0);
+    for(auto &[slot, c] : program.constant)
+      value[order-1][slot*stride]=c;
+  }
+}
+
+template<class Dep, class... Indep>
+template<size_t I>
+void EvalForward<Dep, Indep...>::setDirection(int k, const DirType<I> &dir) const {
+  auto &d=direction.at(k-1);
+  if constexpr (std::is_same_v<DirType<I>, double>)
+    d[indepOffset[I]]=dir;
+  else {
+    if(static_cast<size_t>(dir.size())!=indepOffset[I+1]-indepOffset[I])
+      throw std::runtime_error("The size of the direction does not match the size of the independent variable.");
+    for(int i=0; i<dir.size(); ++i)
+      d[indepOffset[I]+i]=dir(i);
+  }
+}
+
+template<class Dep, class... Indep>
+void EvalForward<Dep, Indep...>::clearDirections() const {
+  for(auto &d : direction)
+    std::fill(d.begin(), d.end(), 0);
+}
+
+template<class Dep, class... Indep>
+void EvalForward<Dep, Indep...>::eval(int order) const {
+  auto stride=AST::OpCodeProgram::forwardStride(order);
+  auto *v=value[order-1].data();
+  for(size_t i=0; i<program.symbol.size(); ++i) {
+    auto *s=v+program.symbol[i].second*stride;
+    s[0]=program.symbol[i].first->getValue();
+    s[1]=inputIndex[i]<0 ? 0 : direction[0][inputIndex[i]];
+    if(order==2)
+      s[2]=inputIndex[i]<0 ? 0 : direction[1][inputIndex[i]];
+  }
+  program.evalForward(v, order);
+  // copy all components of the outputs to comp
+  int nrComp = order==1 ? 2 : 4;
+  auto out=program.output.begin();
+  if constexpr (std::is_same_v<DepN, double>)
+    for(int k=0; k<nrComp; ++k)
+      comp[k]=v[*out*stride+k];
+  else {
+    std::array<decltype(comp[0].begin()), 4> it { comp[0].begin(), comp[1].begin(), comp[2].begin(), comp[3].begin() };
+    for(; it[0]!=comp[0].end(); ++out)
+      for(int k=0; k<nrComp; ++k)
+        *(it[k]++)=v[*out*stride+k];
+  }
+}
+
+template<class Dep, class... Indep>
+auto EvalForward<Dep, Indep...>::dirDer() const -> const RetType& {
+  eval(1);
+  if constexpr (isRotation) {
+    // the angular vector of the derivative R' of R: the skew symmetric matrix R'*R^T as vector
+    auto &R=comp[0];
+    auto &R1=comp[1];
+    auto tilde=[&R, &R1](int r, int c) { return R1(r,0)*R(c,0)+R1(r,1)*R(c,1)+R1(r,2)*R(c,2); };
+    ret(0)=tilde(2,1);
+    ret(1)=tilde(0,2);
+    ret(2)=tilde(1,0);
+    return ret;
+  }
+  else
+    return comp[1];
+}
+
+template<class Dep, class... Indep>
+auto EvalForward<Dep, Indep...>::dirDerDirDer() const -> const RetType& {
+  eval(2);
+  if constexpr (isRotation) {
+    // the derivative in direction 2 of the angular vector of R'*R^T (' is the derivative in direction 1):
+    // the skew symmetric part of R''*R^T + R'*R^T' as vector (the symmetric part is zero)
+    auto &R=comp[0];
+    auto &R1=comp[1];
+    auto &R2=comp[2];
+    auto &R12=comp[3];
+    auto tilde=[&R, &R1, &R2, &R12](int r, int c) {
+      double t=0;
+      for(int i=0; i<3; ++i)
+        t+=R12(r,i)*R(c,i)+R1(r,i)*R2(c,i);
+      return t;
+    };
+    ret(0)=tilde(2,1);
+    ret(1)=tilde(0,2);
+    ret(2)=tilde(1,0);
+    return ret;
+  }
+  else
+    return comp[3];
+}
+
+/* Class for evaluating the partial derivative of a vector dep wrt a vector indep as sparse matrix (sparse Jacobian).
+ * Eval{parDer(dep, indep)} evaluates and copies all entries of the dense Jacobian even if most of these are zero.
+ * This class detects the structural nonzero pattern once in the ctor (all entries of parDer(dep, indep) which are not
+ * structurally zero) and evaluates only these nonzero entries. The result is returned in compressed row storage
+ * as Matrix<Sparse,Ref,Ref,double>: for a square Jacobian the diagonal is always stored as the first entry of each
+ * row (as required by Matrix<Sparse,Ref,Ref,double>); for a non-square Jacobian the entries of each row are
+ * stored in ascending column order. The sparsity pattern (Ip() and Jp()) is constant for all evaluations.
+ * The format can be EvalFormat::OpCode or EvalFormat::JIT.
+*/
+template<class DepShape, class IndepShape>
+class EvalSparseParDer {
+  public:
+    EvalSparseParDer(const Vector<DepShape, SymbolicExpression> &dep, const Vector<IndepShape, IndependentVariable> &indep,
+                     EvalFormat format_=EvalFormat::OpCode);
+    //! Evaluate the nonzero entries of the Jacobian.
+    const Matrix<Sparse, Ref, Ref, double>& operator()() const;
+    //! Return the number of structurally nonzero entries.
+    int nonZeroElements() const { return ret.nonZeroElements(); }
+  private:
+    EvalFormat format;
+    AST::OpCodeProgram program;
+    std::unique_ptr<AST::JITProgram> jit;
+    mutable std::vector<double> value; // the slots of program (OpCode) or the inputs (JIT)
+    mutable Matrix<Sparse, Ref, Ref, double> ret;
+};
+
+template<class DepShape, class IndepShape>
+EvalSparseParDer<DepShape, IndepShape>::EvalSparseParDer(const Vector<DepShape, SymbolicExpression> &dep,
+                                                         const Vector<IndepShape, IndependentVariable> &indep,
+                                                         EvalFormat format_) : format(format_) {
+  std::vector<SymbolicExpression> depVec(dep.begin(), dep.end());
+  std::vector<IndependentVariable> indepVec(indep.begin(), indep.end());
+  std::map<const AST::Vertex*, AST::OpCode::Index> existingVertex;
+  std::vector<int> I, J;
+  program.addSparseParDer(depVec, indepVec, existingVertex, I, J, dep.size()==indep.size());
+
+  ret.resize(dep.size(), indep.size(), J.size(), NONINIT);
+  std::copy(I.begin(), I.end(), ret.Ip());
+  std::copy(J.begin(), J.end(), ret.Jp());
+  switch(format) {
+    case EvalFormat::OpCode:
+      program.reuseSlots();
+      value.resize(program.nrSlots);
+      program.initConstants(value.data());
+      break;
+    case EvalFormat::JIT:
+      jit = std::make_unique<AST::JITProgram>(program);
+      value.resize(program.symbol.size());
+      break;
+    default:
+      throw std::runtime_error("EvalSparseParDer supports only the formats OpCode and JIT.");
+  }
+}
+
+template<class DepShape, class IndepShape>
+const Matrix<Sparse, Ref, Ref, double>& EvalSparseParDer<DepShape, IndepShape>::operator()() const {
+  if(format == EvalFormat::JIT) {
+    for(size_t i=0; i<program.symbol.size(); ++i)
+      value[i] = program.symbol[i].first->getValue();
+    // the outputs are written directly to the nonzero entries
+    (*jit)(value.data(), ret());
+  }
+  else {
+    for(auto &[sym, slot] : program.symbol)
+      value[slot] = sym->getValue();
+    program.eval(value.data());
+    double *ele = ret();
+    for(auto slot : program.output)
+      *(ele++) = value[slot];
+  }
+  return ret;
 }
 
 template<class RetN, class ArgN>
@@ -4,6 +4,9 @@
 #include "function.h"
 #include "ast.h"
 #include "symbolic.h"
+#include <mutex>
+#include <optional>
+#include <typeinfo>
 
 namespace fmatvec {
 
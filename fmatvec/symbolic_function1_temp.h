@@ -14,6 +14,10 @@ class SymbolicFunction<RET(ARG)> : public virtual Function<RET(ARG)> {
     ArgS& getIndependentVariable();
     RetS& getDependentFunction();
     void init(); // must be called after setIndependentVariable/setDependentFunction.
+    // Set the maximal derivative order whose evaluators are built by init() (default 0 = none).
+    // If init() has already been called these evaluators are built immediately.
+    // The evaluators of all other derivatives are built on first use (thread-safe).
+    void setPrebuildDerivativeOrder(int order);
 
     std::pair<int, int> getRetSize() const override;
     int getArgSize() const override;
@@ -26,6 +30,14 @@ class SymbolicFunction<RET(ARG)> : public virtual Function<RET(ARG)> {
 #ifdef PARDERPARDER
     DDRetDDArg parDerParDer(const ARG &arg) override;
 #endif
+#ifdef PARDER
+    // Return the value and parDer at arg. Both are evaluated by a single Eval sharing all common subexpressions.
+    std::tuple<RET, DRetDArg> valueAndParDer(const ARG &arg);
+#endif
+#ifdef PARDERPARDER
+    // Return the value, parDer and parDerParDer at arg evaluated by a single Eval (like valueAndParDer).
+    std::tuple<RET, DRetDArg, DDRetDDArg> valueParDerAndParDerParDer(const ARG &arg);
+#endif
 #ifdef PARDER
     DRetDArg parDerDirDer(const ARG &argDir, const ARG &arg) override;
 #endif
@@ -35,22 +47,38 @@ class SymbolicFunction<RET(ARG)> : public virtual Function<RET(ARG)> {
   protected:
 
     ArgS argS;
-    ArgS argDirS;
-    ArgS argDirS_2;
     RetS retS;
     std::unique_ptr<Eval<decltype(retS)>> retSEval;
+    // the evaluators of the derivatives, built on first use. These are allocated on the heap since the build closures
+    // capture this struct and its LazyEval's are not movable: hence, SymbolicFunction itself stays movable.
+    struct Lazy {
+      Lazy(const ArgS &argS_, const RetS &retS_) : argS(argS_), retS(retS_) {}
+      ArgS argS;
+      RetS retS;
 #ifdef PARDER
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg, SymbolicExpression>::Type>> pdEval;
+      LazyEval<typename ReplaceAT<DRetDArg, SymbolicExpression>::Type> pdEval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir, SymbolicExpression>::Type>> ddEval;
+      // the directional derivatives are evaluated in forward mode (no derivative expression is built)
+      LazyEvaluator<EvalForward<RetS, ArgS>, RetS, ArgS> fwdEval;
 #ifdef PARDERPARDER
-    std::unique_ptr<Eval<typename ReplaceAT<DDRetDDArg, SymbolicExpression>::Type>> pdpdEval;
+      LazyEval<typename ReplaceAT<DDRetDDArg, SymbolicExpression>::Type> pdpdEval;
 #endif
 #ifdef PARDER
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg, SymbolicExpression>::Type>> pdddEval;
+      LazyEvaluator<EvalForward<typename ReplaceAT<DRetDArg, SymbolicExpression>::Type, ArgS>,
+                    typename ReplaceAT<DRetDArg, SymbolicExpression>::Type, ArgS> pdFwdEval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir, SymbolicExpression>::Type>> ddddEval;
+#ifdef PARDER
+      LazyEval<RetS, typename ReplaceAT<DRetDArg, SymbolicExpression>::Type> vpdEval;
+#endif
+#ifdef PARDERPARDER
+      LazyEval<RetS, typename ReplaceAT<DRetDArg, SymbolicExpression>::Type,
+               typename ReplaceAT<DDRetDDArg, SymbolicExpression>::Type> vpdpdpdEval;
+#endif
+    };
+    std::unique_ptr<Lazy> lazy;
     bool isParDerConst = false;
+    int prebuildDerivativeOrder = 0;
+    void prebuild(); // build the evaluators up to the order prebuildDerivativeOrder
 };
 
 template<TEMPLATE>
@@ -90,21 +118,71 @@ typename SymbolicFunction<RET(ARG)>::RetS& SymbolicFunction<RET(ARG)>::getDepend
 
 template<TEMPLATE>
 void SymbolicFunction<RET(ARG)>::init() {
-  Helper<ArgS>::initIndep(argDirS, Helper<ArgS>::size1(argS));
-  Helper<ArgS>::initIndep(argDirS, Helper<ArgS>::size1(argS));
-  Helper<ArgS>::initIndep(argDirS_2, Helper<ArgS>::size1(argS));
   retSEval.reset(new Eval<decltype(retS)>{retS});
+  lazy.reset(new Lazy(argS, retS));
+  auto *l=lazy.get();
+
+  // the derivatives are derived (or loaded from the on-disk cache, see AST::ExpressionCache) on first use.
+  // Each derivative is derived only once, also if it is used by several evaluators (e.g. pdEval and vpdEval).
+  std::string tag(typeid(SymbolicFunction<RET(ARG)>).name());
+  auto derive=[l, tag](const char *name, auto func) {
+    using Derived = decltype(func());
+    auto derived=std::make_shared<std::pair<std::once_flag, std::optional<Derived>>>();
+    return [l, tag, name, func, derived]() {
+      std::call_once(derived->first, [l, &tag, name, &func, &derived]() {
+        derived->second.emplace(AST::cachedDerive<Derived>(tag+name, std::forward_as_tuple(l->retS),
+                                                           std::forward_as_tuple(l->argS), func));
+      });
+      return *derived->second;
+    };
+  };
+#ifdef PARDER
+  auto pd=derive("pd", [l]() {
+    return typename ReplaceAT<DRetDArg, SymbolicExpression>::Type(fmatvec::parDer(l->retS, l->argS));
+  });
+  l->pdEval.reset(pd);
+  l->vpdEval.reset([l, pd]() { return std::make_tuple(l->retS, pd()); });
+#endif
+  l->fwdEval.reset([l]() { return std::make_tuple(l->retS, l->argS); });
+#ifdef PARDERPARDER
+  auto pdpd=derive("pdpd", [l]() {
+    return typename ReplaceAT<DDRetDDArg, SymbolicExpression>::Type(fmatvec::parDer(fmatvec::parDer(l->retS, l->argS), l->argS));
+  });
+  l->pdpdEval.reset(pdpd);
+  l->vpdpdpdEval.reset([l, pd, pdpd]() { return std::make_tuple(l->retS, pd(), pdpd()); });
+#endif
+#ifdef PARDER
+  l->pdFwdEval.reset([l, pd]() { return std::make_tuple(pd(), l->argS); });
+#endif
+
+  prebuild();
+}
+
+template<TEMPLATE>
+void SymbolicFunction<RET(ARG)>::prebuild() {
+  // build the requested derivatives now
+  if(prebuildDerivativeOrder>=1) {
 #ifdef PARDER
-  pdEval.reset(new Eval<typename ReplaceAT<DRetDArg, SymbolicExpression>::Type>{fmatvec::parDer(retS, argS)});
+    lazy->pdEval.build();
 #endif
-  ddEval.reset(new Eval<typename ReplaceAT<DRetDDir, SymbolicExpression>::Type>{fmatvec::dirDer(retS, argDirS*1, argS)});
+    lazy->fwdEval.build();
+  }
+  if(prebuildDerivativeOrder>=2) {
 #ifdef PARDERPARDER
-  pdpdEval.reset(new Eval<typename ReplaceAT<DDRetDDArg, SymbolicExpression>::Type>{fmatvec::parDer(fmatvec::parDer(retS, argS), argS)});
+    lazy->pdpdEval.build();
 #endif
 #ifdef PARDER
-  pdddEval.reset(new Eval<typename ReplaceAT<DRetDArg, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::parDer(retS, argS), argDirS*1, argS)});
+    lazy->pdFwdEval.build();
 #endif
-  ddddEval.reset(new Eval<typename ReplaceAT<DRetDDir, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::dirDer(retS, argDirS*1, argS), argDirS_2*1, argS)});
+  }
+}
+
+template<TEMPLATE>
+void SymbolicFunction<RET(ARG)>::setPrebuildDerivativeOrder(int order) {
+  prebuildDerivativeOrder=order;
+  // init() has already been called (e.g. by the ctor): build the requested derivatives now
+  if(retSEval)
+    prebuild();
 }
 
 template<TEMPLATE>
@@ -127,40 +205,59 @@ RET SymbolicFunction<RET(ARG)>::operator()(const ARG &arg) {
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG)>::parDer(const ARG &arg) -> DRetDArg {
   argS^=arg;
-  return (*pdEval)();
+  return (*lazy->pdEval)();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG)>::dirDer(const ARG &argDir, const ARG &arg) -> DRetDDir {
-  argDirS^=argDir;
   argS^=arg;
-  return (*ddEval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.template setDirection<0>(1, argDir);
+  return fwd.dirDer();
 }
 
 #ifdef PARDERPARDER
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG)>::parDerParDer(const ARG &arg) -> DDRetDDArg {
   argS^=arg;
-  return (*pdpdEval)();
+  return (*lazy->pdpdEval)();
+}
+#endif
+
+#ifdef PARDER
+template<TEMPLATE>
+auto SymbolicFunction<RET(ARG)>::valueAndParDer(const ARG &arg) -> std::tuple<RET, DRetDArg> {
+  argS^=arg;
+  return (*lazy->vpdEval)();
+}
+#endif
+
+#ifdef PARDERPARDER
+template<TEMPLATE>
+auto SymbolicFunction<RET(ARG)>::valueParDerAndParDerParDer(const ARG &arg) -> std::tuple<RET, DRetDArg, DDRetDDArg> {
+  argS^=arg;
+  return (*lazy->vpdpdpdEval)();
 }
 #endif
 
 #ifdef PARDER
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG)>::parDerDirDer(const ARG &argDir, const ARG &arg) -> DRetDArg {
-  argDirS^=argDir;
   argS^=arg;
-  return (*pdddEval)();
+  auto &fwd=*lazy->pdFwdEval;
+  fwd.template setDirection<0>(1, argDir);
+  return fwd.dirDer();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG)>::dirDerDirDer(const ARG &argDir_1, const ARG &argDir_2, const ARG &arg) -> DRetDDir {
-  argDirS^=argDir_1;
-  argDirS_2^=argDir_2;
   argS^=arg;
-  return (*ddddEval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.template setDirection<0>(1, argDir_1);
+  fwd.template setDirection<0>(2, argDir_2);
+  return fwd.dirDerDirDer();
 }
 
 template<TEMPLATE>
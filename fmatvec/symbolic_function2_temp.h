@@ -21,6 +21,10 @@ class SymbolicFunction<RET(ARG1, ARG2)> : public virtual Function<RET(ARG1, ARG2
     Arg2S& getIndependentVariable2();
     RetS& getDependentFunction();
     void init(); // must be called after setIndependentVariable/setDependentFunction.
+    // Set the maximal derivative order whose evaluators are built by init() (default 0 = none).
+    // If init() has already been called these evaluators are built immediately.
+    // The evaluators of all other derivatives are built on first use (thread-safe).
+    void setPrebuildDerivativeOrder(int order);
 
     std::pair<int, int> getRetSize() const override;
     int getArg1Size() const override;
@@ -61,51 +65,81 @@ class SymbolicFunction<RET(ARG1, ARG2)> : public virtual Function<RET(ARG1, ARG2
 #endif
     bool constParDer1() const override;
     bool constParDer2() const override;
+#ifdef PARDER1
+    // Return the value and parDer1 at arg1, arg2. Both are evaluated by a single Eval sharing all common subexpressions.
+    std::tuple<RET, DRetDArg1> valueAndParDer1(const ARG1 &arg1, const ARG2 &arg2);
+#endif
+#ifdef PARDER2
+    // Return the value and parDer2 at arg1, arg2 evaluated by a single Eval (like valueAndParDer1).
+    std::tuple<RET, DRetDArg2> valueAndParDer2(const ARG1 &arg1, const ARG2 &arg2);
+#endif
+#ifdef PARDER1PARDER1
+    // Return the value, parDer1 and parDer1ParDer1 at arg1, arg2 evaluated by a single Eval (like valueAndParDer1).
+    std::tuple<RET, DRetDArg1, DDRetDDArg1> valueParDer1AndParDer1ParDer1(const ARG1 &arg1, const ARG2 &arg2);
+#endif
+#ifdef PARDER2PARDER2
+    // Return the value, parDer2 and parDer2ParDer2 at arg1, arg2 evaluated by a single Eval (like valueAndParDer1).
+    std::tuple<RET, DRetDArg2, DDRetDDArg2> valueParDer2AndParDer2ParDer2(const ARG1 &arg1, const ARG2 &arg2);
+#endif
 
   protected:
 
     Arg1S arg1S;
     Arg2S arg2S;
-    Arg1S argDir1S;
-    Arg1S argDir1S_2;
-    Arg2S argDir2S;
-    Arg2S argDir2S_2;
     RetS retS;
     std::unique_ptr<Eval<decltype(retS)>> retSEval;
+    // the evaluators of the derivatives, built on first use. These are allocated on the heap since the build closures
+    // capture this struct and its LazyEval's are not movable: hence, SymbolicFunction itself stays movable.
+    struct Lazy {
+      Lazy(const Arg1S &arg1S_, const Arg2S &arg2S_, const RetS &retS_) : arg1S(arg1S_), arg2S(arg2S_), retS(retS_) {}
+      Arg1S arg1S;
+      Arg2S arg2S;
+      RetS retS;
 #ifdef PARDER1
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type>> pd1Eval;
+      LazyEval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type> pd1Eval;
+#endif
+      // the directional derivatives are evaluated in forward mode (no derivative expression is built)
+      LazyEvaluator<EvalForward<RetS, Arg1S, Arg2S>, RetS, Arg1S, Arg2S> fwdEval;
+#ifdef PARDER1
+      LazyEvaluator<EvalForward<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type, Arg1S, Arg2S>,
+                    typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type, Arg1S, Arg2S> pd1FwdEval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir1, SymbolicExpression>::Type>> dd1Eval;
 #ifdef PARDER2
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type>> pd2Eval;
+      LazyEval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type> pd2Eval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir2, SymbolicExpression>::Type>> dd2Eval;
-#ifdef PARDER1PARDER1
-    std::unique_ptr<Eval<typename ReplaceAT<DDRetDDArg1, SymbolicExpression>::Type>> pd1pd1Eval;
+#ifdef PARDER2
+      LazyEvaluator<EvalForward<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type, Arg1S, Arg2S>,
+                    typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type, Arg1S, Arg2S> pd2FwdEval;
 #endif
-#ifdef PARDER1
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type>> pd1dd1Eval;
+#ifdef PARDER1PARDER1
+      LazyEval<typename ReplaceAT<DDRetDDArg1, SymbolicExpression>::Type> pd1pd1Eval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir1, SymbolicExpression>::Type>> dd1dd1Eval;
 #ifdef PARDER2PARDER2
-    std::unique_ptr<Eval<typename ReplaceAT<DDRetDDArg2, SymbolicExpression>::Type>> pd2pd2Eval;
-#endif
-#ifdef PARDER2
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type>> pd2dd2Eval;
+      LazyEval<typename ReplaceAT<DDRetDDArg2, SymbolicExpression>::Type> pd2pd2Eval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir2, SymbolicExpression>::Type>> dd2dd2Eval;
 #ifdef PARDER1PARDER2
-    std::unique_ptr<Eval<typename ReplaceAT<DDRetDArg1DArg2, SymbolicExpression>::Type>> pd1pd2Eval;
+      LazyEval<typename ReplaceAT<DDRetDArg1DArg2, SymbolicExpression>::Type> pd1pd2Eval;
 #endif
 #ifdef PARDER1
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type>> pd1dd2Eval;
+      LazyEval<RetS, typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type> vpd1Eval;
 #endif
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDDir2, SymbolicExpression>::Type>> dd2dd1Eval;
 #ifdef PARDER2
-    std::unique_ptr<Eval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type>> pd2dd1Eval;
+      LazyEval<RetS, typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type> vpd2Eval;
 #endif
+#ifdef PARDER1PARDER1
+      LazyEval<RetS, typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type,
+               typename ReplaceAT<DDRetDDArg1, SymbolicExpression>::Type> vpd1pd1pd1Eval;
+#endif
+#ifdef PARDER2PARDER2
+      LazyEval<RetS, typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type,
+               typename ReplaceAT<DDRetDDArg2, SymbolicExpression>::Type> vpd2pd2pd2Eval;
+#endif
+    };
+    std::unique_ptr<Lazy> lazy;
     bool isParDer1Const = false;
     bool isParDer2Const = false;
+    int prebuildDerivativeOrder = 0;
+    void prebuild(); // build the evaluators up to the order prebuildDerivativeOrder
 };
 
 template<TEMPLATE>
@@ -158,45 +192,101 @@ typename SymbolicFunction<RET(ARG1, ARG2)>::RetS& SymbolicFunction<RET(ARG1, ARG
 
 template<TEMPLATE>
 void SymbolicFunction<RET(ARG1, ARG2)>::init() {
-  Helper<Arg1S>::initIndep(argDir1S, Helper<Arg1S>::size1(arg1S));
-  Helper<Arg1S>::initIndep(argDir1S, Helper<Arg1S>::size1(arg1S));
-  Helper<Arg1S>::initIndep(argDir1S_2, Helper<Arg1S>::size1(arg1S));
-  Helper<Arg2S>::initIndep(argDir2S, Helper<Arg2S>::size1(arg2S));
-  Helper<Arg2S>::initIndep(argDir2S, Helper<Arg2S>::size1(arg2S));
-  Helper<Arg2S>::initIndep(argDir2S_2, Helper<Arg2S>::size1(arg2S));
   retSEval.reset(new Eval<decltype(retS)>{retS});
+  lazy.reset(new Lazy(arg1S, arg2S, retS));
+  auto *l=lazy.get();
+
+  // the derivatives are derived (or loaded from the on-disk cache, see AST::ExpressionCache) on first use.
+  // Each derivative is derived only once, also if it is used by several evaluators (e.g. pdEval and vpdEval).
+  std::string tag(typeid(SymbolicFunction<RET(ARG1, ARG2)>).name());
+  auto derive=[l, tag](const char *name, auto func) {
+    using Derived = decltype(func());
+    auto derived=std::make_shared<std::pair<std::once_flag, std::optional<Derived>>>();
+    return [l, tag, name, func, derived]() {
+      std::call_once(derived->first, [l, &tag, name, &func, &derived]() {
+        derived->second.emplace(AST::cachedDerive<Derived>(tag+name, std::forward_as_tuple(l->retS),
+                                                           std::forward_as_tuple(l->arg1S, l->arg2S), func));
+      });
+      return *derived->second;
+    };
+  };
 #ifdef PARDER1
-  pd1Eval.reset(new Eval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type>{fmatvec::parDer(retS, arg1S)});
+  auto pd1=derive("pd1", [l]() {
+    return typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type(fmatvec::parDer(l->retS, l->arg1S));
+  });
+  l->pd1Eval.reset(pd1);
+  l->vpd1Eval.reset([l, pd1]() { return std::make_tuple(l->retS, pd1()); });
+  l->pd1FwdEval.reset([l, pd1]() { return std::make_tuple(pd1(), l->arg1S, l->arg2S); });
 #endif
-  dd1Eval.reset(new Eval<typename ReplaceAT<DRetDDir1, SymbolicExpression>::Type>{fmatvec::dirDer(retS, argDir1S*1, arg1S)});
 #ifdef PARDER2
-  pd2Eval.reset(new Eval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type>{fmatvec::parDer(retS, arg2S)});
-#endif
-  dd2Eval.reset(new Eval<typename ReplaceAT<DRetDDir2, SymbolicExpression>::Type>{fmatvec::dirDer(retS, argDir2S*1, arg2S)});
+  auto pd2=derive("pd2", [l]() {
+    return typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type(fmatvec::parDer(l->retS, l->arg2S));
+  });
+  l->pd2Eval.reset(pd2);
+  l->vpd2Eval.reset([l, pd2]() { return std::make_tuple(l->retS, pd2()); });
+  l->pd2FwdEval.reset([l, pd2]() { return std::make_tuple(pd2(), l->arg1S, l->arg2S); });
+#endif
+  l->fwdEval.reset([l]() { return std::make_tuple(l->retS, l->arg1S, l->arg2S); });
 #ifdef PARDER1PARDER1
-  pd1pd1Eval.reset(new Eval<typename ReplaceAT<DDRetDDArg1, SymbolicExpression>::Type>{fmatvec::parDer(fmatvec::parDer(retS, arg1S), arg1S)});
+  auto pd1pd1=derive("pd1pd1", [l]() {
+    return typename ReplaceAT<DDRetDDArg1, SymbolicExpression>::Type(fmatvec::parDer(fmatvec::parDer(l->retS, l->arg1S), l->arg1S));
+  });
+  l->pd1pd1Eval.reset(pd1pd1);
+  l->vpd1pd1pd1Eval.reset([l, pd1, pd1pd1]() { return std::make_tuple(l->retS, pd1(), pd1pd1()); });
 #endif
-#ifdef PARDER1
-  pd1dd1Eval.reset(new Eval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::parDer(retS, arg1S), argDir1S*1, arg1S)});
-#endif
-  dd1dd1Eval.reset(new Eval<typename ReplaceAT<DRetDDir1, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::dirDer(retS, argDir1S*1, arg1S), argDir1S_2*1, arg1S)});
 #ifdef PARDER2PARDER2
-  pd2pd2Eval.reset(new Eval<typename ReplaceAT<DDRetDDArg2, SymbolicExpression>::Type>{fmatvec::parDer(fmatvec::parDer(retS, arg2S), arg2S)});
+  auto pd2pd2=derive("pd2pd2", [l]() {
+    return typename ReplaceAT<DDRetDDArg2, SymbolicExpression>::Type(fmatvec::parDer(fmatvec::parDer(l->retS, l->arg2S), l->arg2S));
+  });
+  l->pd2pd2Eval.reset(pd2pd2);
+  l->vpd2pd2pd2Eval.reset([l, pd2, pd2pd2]() { return std::make_tuple(l->retS, pd2(), pd2pd2()); });
+#endif
+#ifdef PARDER1PARDER2
+  l->pd1pd2Eval.reset(derive("pd1pd2", [l]() {
+    return typename ReplaceAT<DDRetDArg1DArg2, SymbolicExpression>::Type(fmatvec::parDer(fmatvec::parDer(l->retS, l->arg1S), l->arg2S));
+  }));
+#endif
+
+  prebuild();
+}
+
+template<TEMPLATE>
+void SymbolicFunction<RET(ARG1, ARG2)>::prebuild() {
+  // build the requested derivatives now
+  if(prebuildDerivativeOrder>=1) {
+#ifdef PARDER1
+    lazy->pd1Eval.build();
 #endif
 #ifdef PARDER2
-  pd2dd2Eval.reset(new Eval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::parDer(retS, arg2S), argDir2S*1, arg2S)});
+    lazy->pd2Eval.build();
+#endif
+    lazy->fwdEval.build();
+  }
+  if(prebuildDerivativeOrder>=2) {
+#ifdef PARDER1PARDER1
+    lazy->pd1pd1Eval.build();
+#endif
+#ifdef PARDER2PARDER2
+    lazy->pd2pd2Eval.build();
 #endif
-  dd2dd2Eval.reset(new Eval<typename ReplaceAT<DRetDDir2, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::dirDer(retS, argDir2S*1, arg2S), argDir2S_2*1, arg2S)});
 #ifdef PARDER1PARDER2
-  pd1pd2Eval.reset(new Eval<typename ReplaceAT<DDRetDArg1DArg2, SymbolicExpression>::Type>{fmatvec::parDer(fmatvec::parDer(retS, arg1S), arg2S)});
+    lazy->pd1pd2Eval.build();
 #endif
 #ifdef PARDER1
-  pd1dd2Eval.reset(new Eval<typename ReplaceAT<DRetDArg1, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::parDer(retS, arg1S), argDir2S*1, arg2S)});
+    lazy->pd1FwdEval.build();
 #endif
-  dd2dd1Eval.reset(new Eval<typename ReplaceAT<DRetDDir2, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::dirDer(retS, argDir2S*1, arg2S), argDir1S*1, arg1S)});
 #ifdef PARDER2
-  pd2dd1Eval.reset(new Eval<typename ReplaceAT<DRetDArg2, SymbolicExpression>::Type>{fmatvec::dirDer(fmatvec::parDer(retS, arg2S), argDir1S*1, arg1S)});
+    lazy->pd2FwdEval.build();
 #endif
+  }
+}
+
+template<TEMPLATE>
+void SymbolicFunction<RET(ARG1, ARG2)>::setPrebuildDerivativeOrder(int order) {
+  prebuildDerivativeOrder=order;
+  // init() has already been called (e.g. by the ctor): build the requested derivatives now
+  if(retSEval)
+    prebuild();
 }
 
 template<TEMPLATE>
@@ -226,16 +316,18 @@ template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer1(const ARG1 &arg1, const ARG2 &arg2) -> DRetDArg1 {
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd1Eval)();
+  return (*lazy->pd1Eval)();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::dirDer1(const ARG1 &arg1Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDDir1 {
-  argDir1S^=arg1Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*dd1Eval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<0>(1, arg1Dir);
+  return fwd.dirDer();
 }
 
 #ifdef PARDER2
@@ -243,16 +335,18 @@ template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer2(const ARG1 &arg1, const ARG2 &arg2) -> DRetDArg2 {
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd2Eval)();
+  return (*lazy->pd2Eval)();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::dirDer2(const ARG2 &arg2Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDDir2 {
-  argDir2S^=arg2Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*dd2Eval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<1>(1, arg2Dir);
+  return fwd.dirDer();
 }
 
 #ifdef PARDER1PARDER1
@@ -260,27 +354,31 @@ template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer1ParDer1(const ARG1 &arg1, const ARG2 &arg2) -> DDRetDDArg1 {
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd1pd1Eval)();
+  return (*lazy->pd1pd1Eval)();
 }
 #endif
 
 #ifdef PARDER1
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer1DirDer1(const ARG1 &arg1Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDArg1 {
-  argDir1S^=arg1Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd1dd1Eval)();
+  auto &fwd=*lazy->pd1FwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<0>(1, arg1Dir);
+  return fwd.dirDer();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::dirDer1DirDer1(const ARG1 &arg1Dir_1, const ARG1 &arg1Dir_2, const ARG1 &arg1, const ARG2 &arg2) -> DRetDDir1 {
-  argDir1S^=arg1Dir_1;
-  argDir1S_2^=arg1Dir_2;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*dd1dd1Eval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<0>(1, arg1Dir_1);
+  fwd.template setDirection<0>(2, arg1Dir_2);
+  return fwd.dirDerDirDer();
 }
 
 #ifdef PARDER2PARDER2
@@ -288,27 +386,31 @@ template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer2ParDer2(const ARG1 &arg1, const ARG2 &arg2) -> DDRetDDArg2 {
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd2pd2Eval)();
+  return (*lazy->pd2pd2Eval)();
 }
 #endif
 
 #ifdef PARDER2
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer2DirDer2(const ARG2 &arg2Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDArg2 {
-  argDir2S^=arg2Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd2dd2Eval)();
+  auto &fwd=*lazy->pd2FwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<1>(1, arg2Dir);
+  return fwd.dirDer();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::dirDer2DirDer2(const ARG2 &arg2Dir_1, const ARG2 &arg2Dir_2, const ARG1 &arg1, const ARG2 &arg2) -> DRetDDir2 {
-  argDir2S^=arg2Dir_1;
-  argDir2S_2^=arg2Dir_2;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*dd2dd2Eval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<1>(1, arg2Dir_1);
+  fwd.template setDirection<1>(2, arg2Dir_2);
+  return fwd.dirDerDirDer();
 }
 
 #ifdef PARDER1PARDER2
@@ -316,36 +418,80 @@ template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer1ParDer2(const ARG1 &arg1, const ARG2 &arg2) -> DDRetDArg1DArg2 {
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd1pd2Eval)();
+  return (*lazy->pd1pd2Eval)();
 }
 #endif
 
 #ifdef PARDER1
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer1DirDer2(const ARG2 &arg2Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDArg1 {
-  argDir2S^=arg2Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd1dd2Eval)();
+  auto &fwd=*lazy->pd1FwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<1>(1, arg2Dir);
+  return fwd.dirDer();
 }
 #endif
 
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::dirDer2DirDer1(const ARG2 &arg2Dir, const ARG1 &arg1Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDDir2 {
-  argDir2S^=arg2Dir;
-  argDir1S^=arg1Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*dd2dd1Eval)();
+  auto &fwd=*lazy->fwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<1>(1, arg2Dir);
+  fwd.template setDirection<0>(2, arg1Dir);
+  return fwd.dirDerDirDer();
 }
 
 #ifdef PARDER2
 template<TEMPLATE>
 auto SymbolicFunction<RET(ARG1, ARG2)>::parDer2DirDer1(const ARG1 &arg1Dir, const ARG1 &arg1, const ARG2 &arg2) -> DRetDArg2 {
-  argDir1S^=arg1Dir;
   arg1S^=arg1;
   arg2S^=arg2;
-  return (*pd2dd1Eval)();
+  auto &fwd=*lazy->pd2FwdEval;
+  fwd.clearDirections();
+  fwd.template setDirection<0>(1, arg1Dir);
+  return fwd.dirDer();
+}
+#endif
+
+#ifdef PARDER1
+template<TEMPLATE>
+auto SymbolicFunction<RET(ARG1, ARG2)>::valueAndParDer1(const ARG1 &arg1, const ARG2 &arg2) -> std::tuple<RET, DRetDArg1> {
+  arg1S^=arg1;
+  arg2S^=arg2;
+  return (*lazy->vpd1Eval)();
+}
+#endif
+
+#ifdef PARDER2
+template<TEMPLATE>
+auto SymbolicFunction<RET(ARG1, ARG2)>::valueAndParDer2(const ARG1 &arg1, const ARG2 &arg2) -> std::tuple<RET, DRetDArg2> {
+  arg1S^=arg1;
+  arg2S^=arg2;
+  return (*lazy->vpd2Eval)();
+}
+#endif
+
+#ifdef PARDER1PARDER1
+template<TEMPLATE>
+auto SymbolicFunction<RET(ARG1, ARG2)>::valueParDer1AndParDer1ParDer1(const ARG1 &arg1, const ARG2 &arg2) ->
+  std::tuple<RET, DRetDArg1, DDRetDDArg1> {
+  arg1S^=arg1;
+  arg2S^=arg2;
+  return (*lazy->vpd1pd1pd1Eval)();
+}
+#endif
+
+#ifdef PARDER2PARDER2
+template<TEMPLATE>
+auto SymbolicFunction<RET(ARG1, ARG2)>::valueParDer2AndParDer2ParDer2(const ARG1 &arg1, const ARG2 &arg2) ->
+  std::tuple<RET, DRetDArg2, DDRetDDArg2> {
+  arg1S^=arg1;
+  arg2S^=arg2;
+  return (*lazy->vpd2pd2pd2Eval)();
 }
 #endif
 